@@ -0,0 +1,337 @@
+/*      aes.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include <pthread.h>
+#include "aes.h"
+#include "cpufeatures.h"
+#ifdef CRYPT_X86
+#include <immintrin.h>
+#endif
+
+#define GETU32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) \
+					| ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+#define PUTU32(p, v) do { (p)[0] = (unsigned char)((v) >> 24); \
+		(p)[1] = (unsigned char)((v) >> 16); \
+		(p)[2] = (unsigned char)((v) >> 8); \
+		(p)[3] = (unsigned char)(v); } while (0)
+
+static const unsigned char sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+	0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+	0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+	0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+	0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+	0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+	0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+	0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+	0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+	0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+	0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+	0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+	0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+	0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+	0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+	0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+	0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static uint32_t te0[256], te1[256], te2[256], te3[256];
+static pthread_once_t tablesonce = PTHREAD_ONCE_INIT;
+
+static void maketables(void);
+static void ctr_portable(const aeskey *k, unsigned char *ctrblk,
+				const unsigned char *in, unsigned char *out, size_t len);
+#ifdef CRYPT_X86
+static void ctr_aesni(const aeskey *k, unsigned char *ctrblk,
+				const unsigned char *in, unsigned char *out, size_t len);
+static void ctr_vaes(const aeskey *k, unsigned char *ctrblk,
+				const unsigned char *in, unsigned char *out, size_t len);
+#endif
+
+void maketables(void)
+{
+	/* The combined SubBytes/MixColumns tables, te1..3 are rotations of
+	 * te0. */
+	int i;
+	for (i = 0; i < 256; i++) {
+		uint32_t s = sbox[i];
+		uint32_t s2 = ((s << 1) ^ ((s & 0x80) ? 0x1b : 0)) & 0xff;
+		uint32_t s3 = s2 ^ s;
+		uint32_t t = (s2 << 24) | (s << 16) | (s << 8) | s3;
+		te0[i] = t;
+		te1[i] = (t >> 8) | (t << 24);
+		te2[i] = (t >> 16) | (t << 16);
+		te3[i] = (t >> 24) | (t << 8);
+	}
+} // maketables()
+
+void aes_setkey(aeskey *k, const unsigned char *key)
+{
+	/* key is 32 bytes. Both forms of the schedule are filled in, the
+	 * byte form is the one the AES-NI instructions take. */
+	static const uint32_t rcon[7] = {
+		0x01000000, 0x02000000, 0x04000000, 0x08000000,
+		0x10000000, 0x20000000, 0x40000000
+	};
+	uint32_t *rk = k->rk;
+	int i;
+
+	pthread_once(&tablesonce, maketables);
+	for (i = 0; i < 8; i++) {
+		rk[i] = GETU32(key + 4 * i);
+	}
+	for (i = 8; i < 4 * (AES_ROUNDS + 1); i++) {
+		uint32_t t = rk[i - 1];
+		if (i % 8 == 0) {
+			t = (t << 8) | (t >> 24);
+			t = ((uint32_t)sbox[t >> 24] << 24)
+				| ((uint32_t)sbox[(t >> 16) & 0xff] << 16)
+				| ((uint32_t)sbox[(t >> 8) & 0xff] << 8)
+				| (uint32_t)sbox[t & 0xff];
+			t ^= rcon[i / 8 - 1];
+		} else if (i % 8 == 4) {
+			t = ((uint32_t)sbox[t >> 24] << 24)
+				| ((uint32_t)sbox[(t >> 16) & 0xff] << 16)
+				| ((uint32_t)sbox[(t >> 8) & 0xff] << 8)
+				| (uint32_t)sbox[t & 0xff];
+		}
+		rk[i] = rk[i - 8] ^ t;
+	}
+	for (i = 0; i < 4 * (AES_ROUNDS + 1); i++) {
+		PUTU32(k->rkb + 4 * i, rk[i]);
+	}
+} // aes_setkey()
+
+void aes_encryptblock(const aeskey *k, const unsigned char *in,
+						unsigned char *out)
+{
+	const uint32_t *rk = k->rk;
+	uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+	int r;
+
+	s0 = GETU32(in) ^ rk[0];
+	s1 = GETU32(in + 4) ^ rk[1];
+	s2 = GETU32(in + 8) ^ rk[2];
+	s3 = GETU32(in + 12) ^ rk[3];
+	for (r = 1; r < AES_ROUNDS; r++) {
+		rk += 4;
+		t0 = te0[s0 >> 24] ^ te1[(s1 >> 16) & 0xff]
+			^ te2[(s2 >> 8) & 0xff] ^ te3[s3 & 0xff] ^ rk[0];
+		t1 = te0[s1 >> 24] ^ te1[(s2 >> 16) & 0xff]
+			^ te2[(s3 >> 8) & 0xff] ^ te3[s0 & 0xff] ^ rk[1];
+		t2 = te0[s2 >> 24] ^ te1[(s3 >> 16) & 0xff]
+			^ te2[(s0 >> 8) & 0xff] ^ te3[s1 & 0xff] ^ rk[2];
+		t3 = te0[s3 >> 24] ^ te1[(s0 >> 16) & 0xff]
+			^ te2[(s1 >> 8) & 0xff] ^ te3[s2 & 0xff] ^ rk[3];
+		s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+	rk += 4;
+	t0 = ((uint32_t)sbox[s0 >> 24] << 24)
+		^ ((uint32_t)sbox[(s1 >> 16) & 0xff] << 16)
+		^ ((uint32_t)sbox[(s2 >> 8) & 0xff] << 8)
+		^ (uint32_t)sbox[s3 & 0xff] ^ rk[0];
+	t1 = ((uint32_t)sbox[s1 >> 24] << 24)
+		^ ((uint32_t)sbox[(s2 >> 16) & 0xff] << 16)
+		^ ((uint32_t)sbox[(s3 >> 8) & 0xff] << 8)
+		^ (uint32_t)sbox[s0 & 0xff] ^ rk[1];
+	t2 = ((uint32_t)sbox[s2 >> 24] << 24)
+		^ ((uint32_t)sbox[(s3 >> 16) & 0xff] << 16)
+		^ ((uint32_t)sbox[(s0 >> 8) & 0xff] << 8)
+		^ (uint32_t)sbox[s1 & 0xff] ^ rk[2];
+	t3 = ((uint32_t)sbox[s3 >> 24] << 24)
+		^ ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16)
+		^ ((uint32_t)sbox[(s1 >> 8) & 0xff] << 8)
+		^ (uint32_t)sbox[s2 & 0xff] ^ rk[3];
+	PUTU32(out, t0);
+	PUTU32(out + 4, t1);
+	PUTU32(out + 8, t2);
+	PUTU32(out + 12, t3);
+} // aes_encryptblock()
+
+void aes_ctr32(const aeskey *k, unsigned char *ctrblk,
+				const unsigned char *in, unsigned char *out, size_t len)
+{
+	/* XOR len bytes of in with the encrypted counter blocks and put
+	 * the result in out. The last 4 bytes of ctrblk are a big endian
+	 * counter which is left pointing after the last block used.
+	*/
+#ifdef CRYPT_X86
+	unsigned f = cpufeatures();
+	if ((f & CPU_VAES) && (f & CPU_AVX2) && (f & CPU_AESNI)
+		&& (f & CPU_SSE41)) {
+		ctr_vaes(k, ctrblk, in, out, len);
+		return;
+	}
+	if ((f & CPU_AESNI) && (f & CPU_SSE41)) {
+		ctr_aesni(k, ctrblk, in, out, len);
+		return;
+	}
+#endif
+	ctr_portable(k, ctrblk, in, out, len);
+} // aes_ctr32()
+
+const char *aes_implname(void)
+{
+#ifdef CRYPT_X86
+	unsigned f = cpufeatures();
+	if ((f & CPU_VAES) && (f & CPU_AVX2) && (f & CPU_AESNI)
+		&& (f & CPU_SSE41)) return "vaes";
+	if ((f & CPU_AESNI) && (f & CPU_SSE41)) return "aes-ni";
+#endif
+	return "portable";
+} // aes_implname()
+
+void ctr_portable(const aeskey *k, unsigned char *ctrblk,
+				const unsigned char *in, unsigned char *out, size_t len)
+{
+	unsigned char ks[16];
+	uint32_t c = GETU32(ctrblk + 12);
+	while (len) {
+		size_t i, n = (len < 16) ? len : 16;
+		aes_encryptblock(k, ctrblk, ks);
+		c++;
+		PUTU32(ctrblk + 12, c);
+		for (i = 0; i < n; i++) {
+			out[i] = in[i] ^ ks[i];
+		}
+		in += n;
+		out += n;
+		len -= n;
+	}
+} // ctr_portable()
+
+#ifdef CRYPT_X86
+__attribute__((target("aes,sse4.1")))
+static inline __m128i ctrblock(__m128i base, uint32_t c)
+{
+	return _mm_insert_epi32(base, (int)__builtin_bswap32(c), 3);
+} // ctrblock()
+
+__attribute__((target("aes,sse4.1")))
+void ctr_aesni(const aeskey *k, unsigned char *ctrblk,
+				const unsigned char *in, unsigned char *out, size_t len)
+{
+	__m128i rk[AES_ROUNDS + 1];
+	__m128i base = _mm_loadu_si128((const __m128i *)ctrblk);
+	uint32_t c = GETU32(ctrblk + 12);
+	int i, r;
+
+	for (r = 0; r <= AES_ROUNDS; r++) {
+		rk[r] = _mm_load_si128((const __m128i *)(k->rkb + 16 * r));
+	}
+	while (len >= 128) {
+		__m128i b[8];
+		for (i = 0; i < 8; i++) {
+			b[i] = _mm_xor_si128(ctrblock(base, c + i), rk[0]);
+		}
+		for (r = 1; r < AES_ROUNDS; r++) {
+			for (i = 0; i < 8; i++) {
+				b[i] = _mm_aesenc_si128(b[i], rk[r]);
+			}
+		}
+		for (i = 0; i < 8; i++) {
+			b[i] = _mm_aesenclast_si128(b[i], rk[AES_ROUNDS]);
+			b[i] = _mm_xor_si128(b[i],
+					_mm_loadu_si128((const __m128i *)(in + 16 * i)));
+			_mm_storeu_si128((__m128i *)(out + 16 * i), b[i]);
+		}
+		c += 8;
+		in += 128;
+		out += 128;
+		len -= 128;
+	}
+	while (len) {
+		unsigned char ks[16];
+		size_t n = (len < 16) ? len : 16;
+		__m128i b = _mm_xor_si128(ctrblock(base, c), rk[0]);
+		for (r = 1; r < AES_ROUNDS; r++) {
+			b = _mm_aesenc_si128(b, rk[r]);
+		}
+		b = _mm_aesenclast_si128(b, rk[AES_ROUNDS]);
+		_mm_storeu_si128((__m128i *)ks, b);
+		for (i = 0; i < (int)n; i++) {
+			out[i] = in[i] ^ ks[i];
+		}
+		c++;
+		in += n;
+		out += n;
+		len -= n;
+	}
+	PUTU32(ctrblk + 12, c);
+} // ctr_aesni()
+
+__attribute__((target("vaes,avx2,aes,sse4.1")))
+void ctr_vaes(const aeskey *k, unsigned char *ctrblk,
+				const unsigned char *in, unsigned char *out, size_t len)
+{
+	/* 16 blocks per pass, two to each ymm register, the remainder
+	 * goes through ctr_aesni(). */
+	__m256i rk[AES_ROUNDS + 1];
+	__m128i base = _mm_loadu_si128((const __m128i *)ctrblk);
+	uint32_t c = GETU32(ctrblk + 12);
+	int i, r;
+
+	for (r = 0; r <= AES_ROUNDS; r++) {
+		rk[r] = _mm256_broadcastsi128_si256(
+				_mm_load_si128((const __m128i *)(k->rkb + 16 * r)));
+	}
+	while (len >= 256) {
+		__m256i b[8];
+		for (i = 0; i < 8; i++) {
+			b[i] = _mm256_set_m128i(ctrblock(base, c + 2 * i + 1),
+									ctrblock(base, c + 2 * i));
+			b[i] = _mm256_xor_si256(b[i], rk[0]);
+		}
+		for (r = 1; r < AES_ROUNDS; r++) {
+			for (i = 0; i < 8; i++) {
+				b[i] = _mm256_aesenc_epi128(b[i], rk[r]);
+			}
+		}
+		for (i = 0; i < 8; i++) {
+			b[i] = _mm256_aesenclast_epi128(b[i], rk[AES_ROUNDS]);
+			b[i] = _mm256_xor_si256(b[i],
+					_mm256_loadu_si256((const __m256i *)(in + 32 * i)));
+			_mm256_storeu_si256((__m256i *)(out + 32 * i), b[i]);
+		}
+		c += 16;
+		in += 256;
+		out += 256;
+		len -= 256;
+	}
+	PUTU32(ctrblk + 12, c);
+	if (len) ctr_aesni(k, ctrblk, in, out, len);
+} // ctr_vaes()
+#endif
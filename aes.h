@@ -0,0 +1,44 @@
+/*
+ * aes.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _AES_H
+# define _AES_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* AES-256 block encryption and the 32 bit counter mode that GCM uses.
+ * The portable code is table driven, AES-NI is used when present and
+ * VAES, two blocks in each 256 bit register, on top of that.
+*/
+#define AES_ROUNDS	14
+
+typedef struct aeskey {
+	uint32_t rk[4 * (AES_ROUNDS + 1)];	// portable schedule
+	unsigned char rkb[16 * (AES_ROUNDS + 1)] __attribute__((aligned(16)));
+} aeskey;
+
+void aes_setkey(aeskey *k, const unsigned char *key);
+void aes_encryptblock(const aeskey *k, const unsigned char *in,
+						unsigned char *out);
+void aes_ctr32(const aeskey *k, unsigned char *ctrblk,
+				const unsigned char *in, unsigned char *out, size_t len);
+const char *aes_implname(void);
+
+#endif
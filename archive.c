@@ -0,0 +1,549 @@
+/*      archive.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "cryptheader.h"
+#include "calc_nonce.h"
+#include "kdf.h"
+
+static void packdir(archwriter *w, const char *dir, const char *rel);
+static void packfile(archwriter *w, const char *path, char *rel,
+						int fd);
+static void emit(archwriter *w, const char *buf, size_t len);
+static unsigned char *buildindex(const archive *a, size_t *len);
+static int readat(archive *a, void *buf, size_t len, uint64_t off);
+static int safename(const char *name, size_t len);
+static int makeparents(char *path, size_t from);
+static int byname(const void *a, const void *b);
+static int byoffset(const void *a, const void *b);
+static int findname(const void *key, const void *m);
+static char *pathcat(const char *dir, const char *name);
+static void put16(unsigned char *p, unsigned v);
+static unsigned get16(const unsigned char *p);
+static void put32(unsigned char *p, uint32_t v);
+static uint32_t get32(const unsigned char *p);
+static void put64(unsigned char *p, uint64_t v);
+static uint64_t get64(const unsigned char *p);
+
+int archive_pack(const char *srcdir, const char *fn, const char *pw,
+					const cryptengine *e, int flags, size_t bufsize)
+{
+	/* Packs the files under srcdir into fn, which may be "-", through
+	 * the streaming interface like any other encryption, the index
+	 * and the footer being the last of the plain text. A file that
+	 * can't be read is reported and left out of the index, and the
+	 * number of them is returned. */
+	archwriter w;
+	unsigned char hbuf[CRYPT_HDRSIZE], foot[ARCHIVE_FOOTSIZE];
+	unsigned char *index;
+	char iv[CRYPT_IVSIZE];
+	cryptheader hdr;
+	struct stat sb;
+	size_t len, i;
+
+	memset(&w, 0, sizeof(archwriter));
+	w.fpo = (strcmp(fn, "-") == 0) ? stdout : fopen(fn, "w");
+	if (!w.fpo || fstat(fileno(w.fpo), &sb) == -1) {
+		perror(fn);
+		exit(EXIT_FAILURE);
+	}
+	w.dev = sb.st_dev;
+	w.ino = sb.st_ino;
+	initheader(&hdr);
+	hdr.engine = e->id;
+	calc_nonce(iv);
+	kdf_prepare(pw, &hdr, iv);
+	packheader(&hdr, hbuf);
+	if (fwrite(hbuf, 1, CRYPT_HDRSIZE, w.fpo) != CRYPT_HDRSIZE
+		|| fwrite(iv, 1, CRYPT_IVSIZE, w.fpo) != CRYPT_IVSIZE) {
+		perror(fn);
+		exit(EXIT_FAILURE);
+	}
+	if (ctx_init(&w.c, e, &hdr, pw, iv, CRYPT_IVSIZE, flags)) {
+		perror(fn);
+		exit(EXIT_FAILURE);
+	}
+	w.bufsize = bufsize;
+	w.in = malloc(bufsize);
+	// up to a segment may be held back from the last update.
+	w.out = malloc(ctx_outsize(&w.c, bufsize) + w.c.job.outseg);
+	if (!w.in || !w.out) {
+		perror("malloc failure in archive_pack()");
+		exit(EXIT_FAILURE);
+	}
+
+	packdir(&w, srcdir, "");
+	qsort(w.a.m, w.a.n, sizeof(archmember), byname);
+	index = buildindex(&w.a, &len);
+	put64(foot, w.off);
+	put64(foot + 8, len);
+	memcpy(foot + 16, ARCHIVE_MAGIC, 8);
+	emit(&w, (char *)index, len);
+	emit(&w, (char *)foot, ARCHIVE_FOOTSIZE);
+	if (ctx_final(&w.c, w.out, &len)) {
+		fprintf(stderr, "encryption failure in archive_pack()\n");
+		exit(EXIT_FAILURE);
+	}
+	if (fwrite(w.out, 1, len, w.fpo) != len || fclose(w.fpo) == EOF) {
+		perror(fn);
+		exit(EXIT_FAILURE);
+	}
+
+	free(index);
+	for (i = 0; i < w.a.n; i++) free(w.a.m[i].name);
+	free(w.a.m);
+	free(w.out);
+	free(w.in);
+	return w.failed;
+} // archive_pack()
+
+void packdir(archwriter *w, const char *dir, const char *rel)
+{
+	/* rel is dir's name in the archive, "" for the top. Symbolic
+	 * links and special files are passed over. */
+	DIR *d = opendir(dir);
+	struct dirent *de;
+
+	if (!d) {
+		perror(dir);
+		w->failed++;
+		return;
+	}
+	while ((de = readdir(d))) {
+		struct stat sb;
+		char *path, *name;
+		int fd;
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		path = pathcat(dir, de->d_name);
+		name = (*rel) ? pathcat(rel, de->d_name) : strdup(de->d_name);
+		if (fstatat(dirfd(d), de->d_name, &sb, AT_SYMLINK_NOFOLLOW)
+			== -1) {
+			perror(path);
+			w->failed++;
+		} else if (S_ISDIR(sb.st_mode)) {
+			packdir(w, path, name);
+		} else if (S_ISREG(sb.st_mode)
+				&& !(sb.st_dev == w->dev && sb.st_ino == w->ino)) {
+			fd = openat(dirfd(d), de->d_name, O_RDONLY | O_NOFOLLOW);
+			if (fd == -1) {
+				perror(path);
+				w->failed++;
+			} else {
+				packfile(w, path, name, fd);
+				name = NULL;	// the index has it, or it is freed.
+				close(fd);
+			}
+		}
+		free(name);
+		free(path);
+	}
+	closedir(d);
+} // packdir()
+
+void packfile(archwriter *w, const char *path, char *rel, int fd)
+{
+	/* Adds the file open on fd as rel, which the index takes. If it
+	 * can't be read to the end what has gone into the archive is left
+	 * there unindexed. */
+	archmember *m;
+	struct stat sb;
+	uint64_t off = w->off;
+	ssize_t got;
+
+	while ((got = read(fd, w->in, w->bufsize)) > 0) {
+		emit(w, w->in, got);
+	}
+	if (got == -1 || fstat(fd, &sb) == -1) {
+		perror(path);
+		w->failed++;
+		free(rel);
+		return;
+	}
+	if (w->a.n == w->a.max) {
+		w->a.max = (w->a.max) ? 2 * w->a.max : 64;
+		w->a.m = realloc(w->a.m, w->a.max * sizeof(archmember));
+		if (!w->a.m) {
+			perror("malloc failure in packfile()");
+			exit(EXIT_FAILURE);
+		}
+	}
+	m = &w->a.m[w->a.n++];
+	m->name = rel;
+	m->off = off;
+	m->len = w->off - off;	// what was read, whatever the size now.
+	m->mtime = (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+	m->mode = sb.st_mode & 07777;
+} // packfile()
+
+void emit(archwriter *w, const char *buf, size_t len)
+{
+	// len bytes more of the plain text, up to bufsize at a time.
+	while (len) {
+		size_t n = (len < w->bufsize) ? len : w->bufsize, outlen;
+		if (ctx_update(&w->c, buf, n, w->out, &outlen)) {
+			fprintf(stderr, "encryption failure in emit()\n");
+			exit(EXIT_FAILURE);
+		}
+		if (fwrite(w->out, 1, outlen, w->fpo) != outlen) {
+			perror("fwrite");
+			exit(EXIT_FAILURE);
+		}
+		w->off += n;
+		buf += n;
+		len -= n;
+	}
+} // emit()
+
+unsigned char *buildindex(const archive *a, size_t *len)
+{
+	// The index of a, which is sorted, and its length in *len.
+	unsigned char *index, *p;
+	size_t i;
+
+	*len = 16;
+	for (i = 0; i < a->n; i++) {
+		*len += ARCHIVE_RECSIZE + strlen(a->m[i].name);
+	}
+	index = malloc(*len);
+	if (!index) {
+		perror("malloc failure in buildindex()");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(index, ARCHIVE_INDEXMAGIC, 8);
+	put64(index + 8, a->n);
+	p = index + 16;
+	for (i = 0; i < a->n; i++) {
+		const archmember *m = &a->m[i];
+		size_t nlen = strlen(m->name);
+		put64(p, m->off);
+		put64(p + 8, m->len);
+		put64(p + 16, m->mtime);
+		put32(p + 24, m->mode);
+		put16(p + 28, nlen);
+		memcpy(p + ARCHIVE_RECSIZE, m->name, nlen);
+		p += ARCHIVE_RECSIZE + nlen;
+	}
+	return index;
+} // buildindex()
+
+int archive_open(archive *a, const char *fn, const char *pw)
+{
+	/* Reads the footer and the index of fn and checks them. Returns
+	 * 0, or -1 with errno set, EBADMSG if fn fails to authenticate or
+	 * isn't an archive. */
+	unsigned char foot[ARCHIVE_FOOTSIZE], *index = NULL, *p, *end;
+	uint64_t size, ioff, ilen, n;
+	char *names;
+	size_t i;
+
+	memset(a, 0, sizeof(archive));
+	a->r = creader_open(fn, pw, 0);
+	if (!a->r) return -1;
+	size = creader_size(a->r);
+	if (size < ARCHIVE_FOOTSIZE) goto bad;
+	if (readat(a, foot, ARCHIVE_FOOTSIZE, size - ARCHIVE_FOOTSIZE))
+		goto fail;
+	if (memcmp(foot + 16, ARCHIVE_MAGIC, 8) != 0) goto bad;
+	ioff = get64(foot);
+	ilen = get64(foot + 8);
+	if (ioff > size - ARCHIVE_FOOTSIZE
+		|| ilen != size - ARCHIVE_FOOTSIZE - ioff || ilen < 16) goto bad;
+
+	index = malloc(ilen);
+	a->names = names = malloc(ilen);	// more than the names need.
+	if (!index || !names) {
+		perror("malloc failure in archive_open()");
+		exit(EXIT_FAILURE);
+	}
+	if (readat(a, index, ilen, ioff)) goto fail;
+	if (memcmp(index, ARCHIVE_INDEXMAGIC, 8) != 0) goto bad;
+	n = get64(index + 8);
+	if (n > (ilen - 16) / ARCHIVE_RECSIZE) goto bad;
+	a->m = malloc((n) ? n * sizeof(archmember) : 1);
+	if (!a->m) {
+		perror("malloc failure in archive_open()");
+		exit(EXIT_FAILURE);
+	}
+	p = index + 16;
+	end = index + ilen;
+	for (i = 0; i < n; i++) {
+		archmember *m = &a->m[i];
+		size_t nlen;
+		if (end - p < ARCHIVE_RECSIZE) goto bad;
+		m->off = get64(p);
+		m->len = get64(p + 8);
+		m->mtime = (int64_t)get64(p + 16);
+		m->mode = get32(p + 24);
+		nlen = get16(p + 28);
+		p += ARCHIVE_RECSIZE;
+		if ((size_t)(end - p) < nlen || !safename((char *)p, nlen))
+			goto bad;
+		if (m->len > ioff || m->off > ioff - m->len) goto bad;
+		memcpy(names, p, nlen);
+		names[nlen] = '\0';
+		m->name = names;
+		names += nlen + 1;
+		p += nlen;
+		// in order and each once, for archive_find().
+		if (i && strcmp(a->m[i - 1].name, m->name) >= 0) goto bad;
+		a->n++;
+	}
+	free(index);
+	return 0;
+
+bad:
+	errno = EBADMSG;
+fail:
+	free(index);
+	archive_close(a);
+	return -1;
+} // archive_open()
+
+const archmember *archive_find(const archive *a, const char *name)
+{
+	// NULL if there's no such member.
+	return bsearch(name, a->m, a->n, sizeof(archmember), findname);
+} // archive_find()
+
+int archive_extract(archive *a, const archmember *m, FILE *fpo,
+					size_t bufsize)
+{
+	/* Writes m to fpo, decrypting only the blocks it is in. Returns 0,
+	 * or -1 with errno set, EBADMSG if they fail to authenticate. */
+	char *buf = malloc(bufsize);
+	uint64_t off = m->off, left = m->len;
+	int res = 0;
+
+	if (!buf) {
+		perror("malloc failure in archive_extract()");
+		exit(EXIT_FAILURE);
+	}
+	while (left) {
+		size_t n = (left < bufsize) ? left : bufsize;
+		if (readat(a, buf, n, off)) {
+			res = -1;
+			break;
+		}
+		if (fwrite(buf, 1, n, fpo) != n) {
+			res = -1;
+			break;
+		}
+		off += n;
+		left -= n;
+	}
+	free(buf);
+	return res;
+} // archive_extract()
+
+int archive_unpack(archive *a, const char *dstdir, size_t bufsize)
+{
+	/* Every member to its name under dstdir, with the directories
+	 * between, in the order they are in the archive so that it is
+	 * read straight through. A member that fails is reported and
+	 * removed, and the number of them is returned. */
+	archmember **order = malloc((a->n + 1) * sizeof(archmember *));
+	size_t i, dlen = strlen(dstdir);
+	int failed = 0;
+
+	if (!order) {
+		perror("malloc failure in archive_unpack()");
+		exit(EXIT_FAILURE);
+	}
+	if (mkdir(dstdir, 0777) == -1 && errno != EEXIST) {
+		perror(dstdir);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < a->n; i++) order[i] = &a->m[i];
+	qsort(order, a->n, sizeof(archmember *), byoffset);
+	for (i = 0; i < a->n; i++) {
+		const archmember *m = order[i];
+		char *out = pathcat(dstdir, m->name);
+		struct timespec ts[2];
+		FILE *fpo;
+		int res;
+		if (makeparents(out, dlen + 1) || !(fpo = fopen(out, "w"))) {
+			perror(out);
+			free(out);
+			failed++;
+			continue;
+		}
+		res = archive_extract(a, m, fpo, bufsize);
+		if (res == 0) {
+			ts[0].tv_sec = ts[1].tv_sec = m->mtime / 1000000000;
+			ts[0].tv_nsec = ts[1].tv_nsec = m->mtime % 1000000000;
+			if (fflush(fpo) == EOF || fchmod(fileno(fpo), m->mode) == -1
+				|| futimens(fileno(fpo), ts) == -1) res = -1;
+		}
+		if (fclose(fpo) == EOF) res = -1;
+		if (res) {
+			if (errno == EBADMSG) {
+				fprintf(stderr, "%s: authentication failed\n", out);
+			} else {
+				perror(out);
+			}
+			unlink(out);
+			failed++;
+		}
+		free(out);
+	}
+	free(order);
+	return failed;
+} // archive_unpack()
+
+void archive_close(archive *a)
+{
+	if (a->r) creader_close(a->r);
+	free(a->m);
+	free(a->names);
+	memset(a, 0, sizeof(archive));
+} // archive_close()
+
+int readat(archive *a, void *buf, size_t len, uint64_t off)
+{
+	// All of len bytes or -1, EBADMSG for a short read too.
+	char *p = buf;
+	while (len) {
+		ssize_t got = creader_pread(a->r, p, len, off);
+		if (got == -1) return -1;
+		if (got == 0) {
+			errno = EBADMSG;
+			return -1;
+		}
+		p += got;
+		off += got;
+		len -= got;
+	}
+	return 0;
+} // readat()
+
+int safename(const char *name, size_t len)
+{
+	/* A name is unpacked under a directory, so it must stay there: not
+	 * empty or absolute, and no part of it "", "." or "..". */
+	const char *part = name, *end = name + len;
+	if (!len || memchr(name, '\0', len)) return 0;
+	while (part <= end) {
+		const char *slash = memchr(part, '/', end - part);
+		size_t plen = ((slash) ? slash : end) - part;
+		if (plen == 0 || (plen == 1 && part[0] == '.')
+			|| (plen == 2 && part[0] == '.' && part[1] == '.')) return 0;
+		if (!slash) break;
+		part = slash + 1;
+	}
+	return 1;
+} // safename()
+
+int makeparents(char *path, size_t from)
+{
+	// the directories of path from offset from on, -1 if one can't be.
+	char *slash;
+	for (slash = strchr(path + from, '/'); slash;
+			slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		if (mkdir(path, 0777) == -1 && errno != EEXIST) {
+			*slash = '/';
+			return -1;
+		}
+		*slash = '/';
+	}
+	return 0;
+} // makeparents()
+
+int byname(const void *a, const void *b)
+{
+	// for qsort()
+	return strcmp(((const archmember *)a)->name,
+					((const archmember *)b)->name);
+} // byname()
+
+int byoffset(const void *a, const void *b)
+{
+	// for qsort() of pointers to members.
+	const archmember *x = *(archmember * const *)a;
+	const archmember *y = *(archmember * const *)b;
+	return (x->off > y->off) - (x->off < y->off);
+} // byoffset()
+
+int findname(const void *key, const void *m)
+{
+	// for bsearch()
+	return strcmp(key, ((const archmember *)m)->name);
+} // findname()
+
+char *pathcat(const char *dir, const char *name)
+{
+	// dir/name, with no doubled '/'.
+	size_t dlen = strlen(dir), nlen = strlen(name);
+	char *path = malloc(dlen + nlen + 2);
+	if (!path) {
+		perror("malloc failure in pathcat()");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(path, dir, dlen);
+	if (!dlen || dir[dlen - 1] != '/') path[dlen++] = '/';
+	memcpy(path + dlen, name, nlen + 1);
+	return path;
+} // pathcat()
+
+void put16(unsigned char *p, unsigned v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+} // put16()
+
+unsigned get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+} // get16()
+
+void put32(unsigned char *p, uint32_t v)
+{
+	int i;
+	for (i = 0; i < 4; i++) p[i] = v >> (8 * i);
+} // put32()
+
+uint32_t get32(const unsigned char *p)
+{
+	uint32_t v = 0;
+	int i;
+	for (i = 3; i >= 0; i--) v = (v << 8) | p[i];
+	return v;
+} // get32()
+
+void put64(unsigned char *p, uint64_t v)
+{
+	int i;
+	for (i = 0; i < 8; i++) p[i] = v >> (8 * i);
+} // put64()
+
+uint64_t get64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+	for (i = 7; i >= 0; i--) v = (v << 8) | p[i];
+	return v;
+} // get64()
@@ -0,0 +1,89 @@
+/*
+ * archive.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _ARCHIVE_H
+# define _ARCHIVE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "engine.h"
+#include "creader.h"
+#include "cryptctx.h"
+
+/* An archive is one encrypted file holding many, an ordinary crypt
+ * file whose plain text is the members one after the other, then an
+ * index of them and then a fixed footer that says where the index is.
+ * The index is encrypted with the rest, and as the file can be read
+ * at any offset through a creader one member is got by decrypting the
+ * footer, the index and the blocks that member is in, and no others.
+ * Layout of the plain text, integers little endian:
+ *   the members' contents
+ *   index  magic "CINDEX01", the number of members, then for each,
+ *          sorted by name, ARCHIVE_RECSIZE bytes of offset, length,
+ *          mtime in nanoseconds, mode and name length, and the name.
+ *   footer the offset and length of the index and magic "CARCHV01".
+ * Names are relative to the directory packed, with '/' between their
+ * parts, and one that is absolute or has a ".." part is refused.
+*/
+#define ARCHIVE_INDEXMAGIC	"CINDEX01"
+#define ARCHIVE_MAGIC		"CARCHV01"
+#define ARCHIVE_RECSIZE		30
+#define ARCHIVE_FOOTSIZE	24
+
+typedef struct archmember {
+	char *name;
+	uint64_t off;		// in the plain text,
+	uint64_t len;
+	int64_t mtime;		// nanoseconds
+	uint32_t mode;
+} archmember;
+
+typedef struct archive {
+	creader *r;			// NULL while packing.
+	archmember *m;		// sorted by name.
+	size_t n;
+	size_t max;
+	char *names;		// that those read point into.
+} archive;
+
+typedef struct archwriter {
+	FILE *fpo;
+	cryptctx c;
+	char *in;			// bufsize bytes,
+	char *out;			// and what they can become.
+	size_t bufsize;
+	uint64_t off;		// of the next member.
+	dev_t dev;			// the archive, not to be packed into itself.
+	ino_t ino;
+	archive a;
+	int failed;
+} archwriter;
+
+int archive_pack(const char *srcdir, const char *fn, const char *pw,
+					const cryptengine *e, int flags, size_t bufsize);
+int archive_open(archive *a, const char *fn, const char *pw);
+const archmember *archive_find(const archive *a, const char *name);
+int archive_extract(archive *a, const archmember *m, FILE *fpo,
+					size_t bufsize);
+int archive_unpack(archive *a, const char *dstdir, size_t bufsize);
+void archive_close(archive *a);
+
+#endif
@@ -21,24 +21,27 @@
 #include "calc_nonce.h"
 #include "calcsha256sum.h"
 
-void *calc_nonce(void)
+void calc_nonce(char *thenonce)
 {
-	/* gets 8 bytes from /dev/random, followed by 8 bytes from time().
-	 * The odds of /dev/random returning a duplicate value in anyone's
+	/* gets 8 bytes from the kernel's random pool with getrandom(2),
+	 * which is /dev/random without opening it for every file, followed
+	 * by 8 bytes from time().
+	 * The odds of the pool returning a duplicate value in anyone's
 	 * lifetime are vanishingly small but still non-zero. The use of
 	 * time() ensures that the nonce will always be unique.
 	 * Once calaculated, I further calculate the sha256 message digest
-	 * and return the 32 byte binary form of it.
+	 * and return the 32 byte binary form of it, in the caller's
+	 * buffer so that threads don't share one.
 	 * */
 
-	static char thenonce[32];
 	char unused[65];
-	FILE *fpi = fopen("/dev/random", "r");
-	size_t ret = fread(thenonce, 1, 8, fpi);
-	fclose(fpi);
+	ssize_t ret;
+	do {
+		ret = getrandom(thenonce, 8, 0);
+	} while (ret == -1 && errno == EINTR);
 	if (ret != 8) {
 		fprintf(stderr,
-		"Expected to gain 8 bytes from /dev/random, but got %lu\n"
+		"Expected to gain 8 bytes from getrandom(), but got %zd\n"
 				,ret);
 		perror("calc_nonce()");
 		exit(EXIT_FAILURE);
@@ -51,5 +54,4 @@ void *calc_nonce(void)
 	(void)memcpy(thenonce+8, hash.chtim, 8);
 	(void)calcsha256sum(thenonce, 16, unused, thenonce);
 	unused[64] = '\0';
-	return thenonce;
 } // calc_nonce()
@@ -25,8 +25,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <sys/random.h>
+#include <errno.h>
 
-
-void *calc_nonce(void);
+/* nonce must hold 32 bytes. */
+void calc_nonce(char *nonce);
 
 #endif
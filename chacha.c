@@ -0,0 +1,344 @@
+/*      chacha.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include "chacha.h"
+#include "cpufeatures.h"
+#ifdef CRYPT_X86
+#include <immintrin.h>
+#endif
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QR(a, b, c, d) do { \
+		a += b; d ^= a; d = ROTL32(d, 16); \
+		c += d; b ^= c; b = ROTL32(b, 12); \
+		a += b; d ^= a; d = ROTL32(d, 8); \
+		c += d; b ^= c; b = ROTL32(b, 7); } while (0)
+
+static uint32_t getle32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+			| ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+} // getle32()
+
+static void chachastate(uint32_t *s, const unsigned char *key,
+					const unsigned char *nonce, uint32_t counter)
+{
+	int i;
+	s[0] = 0x61707865;	// "expand 32-byte k"
+	s[1] = 0x3320646e;
+	s[2] = 0x79622d32;
+	s[3] = 0x6b206574;
+	for (i = 0; i < 8; i++) s[4 + i] = getle32(key + 4 * i);
+	s[12] = counter;
+	for (i = 0; i < 3; i++) s[13 + i] = getle32(nonce + 4 * i);
+} // chachastate()
+
+#ifdef CRYPT_X86
+static size_t blocks_ssse3(const uint32_t *s, const unsigned char *in,
+					unsigned char *out, size_t nblocks);
+static size_t blocks_avx2(const uint32_t *s, const unsigned char *in,
+					unsigned char *out, size_t nblocks);
+static size_t blocks_avx512(const uint32_t *s, const unsigned char *in,
+					unsigned char *out, size_t nblocks);
+#endif
+
+void chacha20_block(const unsigned char *key, const unsigned char *nonce,
+					uint32_t counter, unsigned char *out)
+{
+	uint32_t s[16], x[16];
+	int i;
+
+	chachastate(s, key, nonce, counter);
+	memcpy(x, s, sizeof(x));
+	for (i = 0; i < 10; i++) {
+		QR(x[0], x[4], x[8], x[12]);
+		QR(x[1], x[5], x[9], x[13]);
+		QR(x[2], x[6], x[10], x[14]);
+		QR(x[3], x[7], x[11], x[15]);
+		QR(x[0], x[5], x[10], x[15]);
+		QR(x[1], x[6], x[11], x[12]);
+		QR(x[2], x[7], x[8], x[13]);
+		QR(x[3], x[4], x[9], x[14]);
+	}
+	for (i = 0; i < 16; i++) {
+		uint32_t v = x[i] + s[i];
+		out[4 * i] = (unsigned char)v;
+		out[4 * i + 1] = (unsigned char)(v >> 8);
+		out[4 * i + 2] = (unsigned char)(v >> 16);
+		out[4 * i + 3] = (unsigned char)(v >> 24);
+	}
+} // chacha20_block()
+
+void chacha20_xor(const unsigned char *key, const unsigned char *nonce,
+					uint32_t counter, const unsigned char *in,
+					unsigned char *out, size_t len)
+{
+	/* XOR len bytes of in with the keystream from block counter on
+	 * and put the result in out, which may be the same as in. */
+	uint32_t s[16];
+#ifdef CRYPT_X86
+	unsigned f = cpufeatures();
+	size_t done;
+#endif
+
+	chachastate(s, key, nonce, counter);
+#ifdef CRYPT_X86
+	if (f & CPU_AVX512) {
+		done = blocks_avx512(s, in, out, len / CHACHA_BLOCKSIZE);
+		s[12] += (uint32_t)done;
+		in += done * CHACHA_BLOCKSIZE;
+		out += done * CHACHA_BLOCKSIZE;
+		len -= done * CHACHA_BLOCKSIZE;
+	}
+	if (f & CPU_AVX2) {
+		done = blocks_avx2(s, in, out, len / CHACHA_BLOCKSIZE);
+		s[12] += (uint32_t)done;
+		in += done * CHACHA_BLOCKSIZE;
+		out += done * CHACHA_BLOCKSIZE;
+		len -= done * CHACHA_BLOCKSIZE;
+	}
+	if (f & CPU_SSSE3) {
+		done = blocks_ssse3(s, in, out, len / CHACHA_BLOCKSIZE);
+		s[12] += (uint32_t)done;
+		in += done * CHACHA_BLOCKSIZE;
+		out += done * CHACHA_BLOCKSIZE;
+		len -= done * CHACHA_BLOCKSIZE;
+	}
+#endif
+	while (len) {
+		unsigned char ks[CHACHA_BLOCKSIZE];
+		size_t i, n = (len < CHACHA_BLOCKSIZE) ? len : CHACHA_BLOCKSIZE;
+		chacha20_block(key, nonce, s[12], ks);
+		for (i = 0; i < n; i++) out[i] = in[i] ^ ks[i];
+		s[12]++;
+		in += n;
+		out += n;
+		len -= n;
+	}
+} // chacha20_xor()
+
+const char *chacha20_implname(void)
+{
+#ifdef CRYPT_X86
+	unsigned f = cpufeatures();
+	if (f & CPU_AVX512) return "avx512";
+	if (f & CPU_AVX2) return "avx2";
+	if (f & CPU_SSSE3) return "ssse3";
+#endif
+	return "portable";
+} // chacha20_implname()
+
+#ifdef CRYPT_X86
+/* The multi-block kernels keep word i of the state for every block in
+ * register x[i], one block to each 32 bit lane, and run the rounds on
+ * all of them at once. The results are transposed back into blocks on
+ * the way out. Each returns the number of blocks it did.
+*/
+#define VQR(add, xor, rot, a, b, c, d) do { \
+		a = add(a, b); d = xor(d, a); d = rot(d, 16); \
+		c = add(c, d); b = xor(b, c); b = rot(b, 12); \
+		a = add(a, b); d = xor(d, a); d = rot(d, 8); \
+		c = add(c, d); b = xor(b, c); b = rot(b, 7); } while (0)
+#define VROUNDS(add, xor, rot, x) do { \
+		int r_; \
+		for (r_ = 0; r_ < 10; r_++) { \
+			VQR(add, xor, rot, x[0], x[4], x[8], x[12]); \
+			VQR(add, xor, rot, x[1], x[5], x[9], x[13]); \
+			VQR(add, xor, rot, x[2], x[6], x[10], x[14]); \
+			VQR(add, xor, rot, x[3], x[7], x[11], x[15]); \
+			VQR(add, xor, rot, x[0], x[5], x[10], x[15]); \
+			VQR(add, xor, rot, x[1], x[6], x[11], x[12]); \
+			VQR(add, xor, rot, x[2], x[7], x[8], x[13]); \
+			VQR(add, xor, rot, x[3], x[4], x[9], x[14]); \
+		} } while (0)
+
+__attribute__((target("ssse3")))
+static inline __m128i rot128(__m128i v, int n)
+{
+	if (n == 16) {
+		return _mm_shuffle_epi8(v, _mm_set_epi8(13, 12, 15, 14,
+						9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+	}
+	if (n == 8) {
+		return _mm_shuffle_epi8(v, _mm_set_epi8(14, 13, 12, 15,
+						10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3));
+	}
+	return _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - n));
+} // rot128()
+
+/* 4x4 transpose of 32 bit words within each 128 bit lane. */
+#define TRANSPOSE4(unlo32, unhi32, unlo64, unhi64, a, b, c, d) do { \
+		t0 = unlo32(a, b); t1 = unlo32(c, d); \
+		t2 = unhi32(a, b); t3 = unhi32(c, d); \
+		a = unlo64(t0, t1); b = unhi64(t0, t1); \
+		c = unlo64(t2, t3); d = unhi64(t2, t3); } while (0)
+
+__attribute__((target("ssse3")))
+size_t blocks_ssse3(const uint32_t *s, const unsigned char *in,
+					unsigned char *out, size_t nblocks)
+{
+	size_t done = 0;
+	int i, j;
+	while (nblocks - done >= 4) {
+		__m128i x[16], o[16], t0, t1, t2, t3;
+		for (i = 0; i < 16; i++) o[i] = _mm_set1_epi32((int)s[i]);
+		o[12] = _mm_add_epi32(o[12],
+				_mm_set_epi32((int)done + 3, (int)done + 2,
+							(int)done + 1, (int)done));
+		memcpy(x, o, sizeof(x));
+		VROUNDS(_mm_add_epi32, _mm_xor_si128, rot128, x);
+		for (i = 0; i < 16; i++) x[i] = _mm_add_epi32(x[i], o[i]);
+		for (i = 0; i < 16; i += 4) {
+			TRANSPOSE4(_mm_unpacklo_epi32, _mm_unpackhi_epi32,
+					_mm_unpacklo_epi64, _mm_unpackhi_epi64,
+					x[i], x[i + 1], x[i + 2], x[i + 3]);
+		}
+		// block j is x[j], x[4 + j], x[8 + j], x[12 + j].
+		for (j = 0; j < 4; j++) {
+			for (i = 0; i < 4; i++) {
+				const __m128i *ip = (const __m128i *)(in + 64 * j) + i;
+				_mm_storeu_si128((__m128i *)(out + 64 * j) + i,
+						_mm_xor_si128(_mm_loadu_si128(ip), x[4 * i + j]));
+			}
+		}
+		in += 256;
+		out += 256;
+		done += 4;
+	}
+	return done;
+} // blocks_ssse3()
+
+__attribute__((target("avx2")))
+static inline __m256i rot256(__m256i v, int n)
+{
+	if (n == 16) {
+		return _mm256_shuffle_epi8(v, _mm256_set_epi8(
+						13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+						13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+	}
+	if (n == 8) {
+		return _mm256_shuffle_epi8(v, _mm256_set_epi8(
+						14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+						14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3));
+	}
+	return _mm256_or_si256(_mm256_slli_epi32(v, n),
+							_mm256_srli_epi32(v, 32 - n));
+} // rot256()
+
+__attribute__((target("avx2")))
+size_t blocks_avx2(const uint32_t *s, const unsigned char *in,
+					unsigned char *out, size_t nblocks)
+{
+	size_t done = 0;
+	int i, j;
+	while (nblocks - done >= 8) {
+		__m256i x[16], o[16], t0, t1, t2, t3;
+		for (i = 0; i < 16; i++) o[i] = _mm256_set1_epi32((int)s[i]);
+		o[12] = _mm256_add_epi32(o[12], _mm256_add_epi32(
+				_mm256_set1_epi32((int)done),
+				_mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0)));
+		memcpy(x, o, sizeof(x));
+		VROUNDS(_mm256_add_epi32, _mm256_xor_si256, rot256, x);
+		for (i = 0; i < 16; i++) x[i] = _mm256_add_epi32(x[i], o[i]);
+		for (i = 0; i < 16; i += 4) {
+			TRANSPOSE4(_mm256_unpacklo_epi32, _mm256_unpackhi_epi32,
+					_mm256_unpacklo_epi64, _mm256_unpackhi_epi64,
+					x[i], x[i + 1], x[i + 2], x[i + 3]);
+		}
+		/* Lane k of x[4 * g + j] holds words 4g..4g+3 of block
+		 * 4k + j. */
+		for (j = 0; j < 4; j++) {
+			__m256i b[4];
+			b[0] = _mm256_permute2x128_si256(x[j], x[4 + j], 0x20);
+			b[1] = _mm256_permute2x128_si256(x[8 + j], x[12 + j], 0x20);
+			b[2] = _mm256_permute2x128_si256(x[j], x[4 + j], 0x31);
+			b[3] = _mm256_permute2x128_si256(x[8 + j], x[12 + j], 0x31);
+			for (i = 0; i < 4; i++) {
+				size_t off = 64 * (j + 4 * (i / 2)) + 32 * (i % 2);
+				_mm256_storeu_si256((__m256i *)(out + off),
+					_mm256_xor_si256(b[i],
+					_mm256_loadu_si256((const __m256i *)(in + off))));
+			}
+		}
+		in += 512;
+		out += 512;
+		done += 8;
+	}
+	return done;
+} // blocks_avx2()
+
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i rot512(__m512i v, int n)
+{
+	switch (n) {
+		case 16: return _mm512_rol_epi32(v, 16);
+		case 12: return _mm512_rol_epi32(v, 12);
+		case 8: return _mm512_rol_epi32(v, 8);
+		default: return _mm512_rol_epi32(v, 7);
+	}
+} // rot512()
+
+__attribute__((target("avx512f,avx512bw")))
+size_t blocks_avx512(const uint32_t *s, const unsigned char *in,
+					unsigned char *out, size_t nblocks)
+{
+	size_t done = 0;
+	int i, j, k;
+	while (nblocks - done >= 16) {
+		__m512i x[16], o[16], t0, t1, t2, t3;
+		for (i = 0; i < 16; i++) o[i] = _mm512_set1_epi32((int)s[i]);
+		o[12] = _mm512_add_epi32(o[12], _mm512_add_epi32(
+				_mm512_set1_epi32((int)done),
+				_mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+								7, 6, 5, 4, 3, 2, 1, 0)));
+		memcpy(x, o, sizeof(x));
+		VROUNDS(_mm512_add_epi32, _mm512_xor_si512, rot512, x);
+		for (i = 0; i < 16; i++) x[i] = _mm512_add_epi32(x[i], o[i]);
+		for (i = 0; i < 16; i += 4) {
+			TRANSPOSE4(_mm512_unpacklo_epi32, _mm512_unpackhi_epi32,
+					_mm512_unpacklo_epi64, _mm512_unpackhi_epi64,
+					x[i], x[i + 1], x[i + 2], x[i + 3]);
+		}
+		/* Lane k of x[4 * g + j] holds words 4g..4g+3 of block
+		 * 4k + j, so a 4x4 transpose of lanes gives whole blocks. */
+		for (j = 0; j < 4; j++) {
+			__m512i b[4];
+			t0 = _mm512_shuffle_i32x4(x[j], x[4 + j], 0x44);
+			t1 = _mm512_shuffle_i32x4(x[j], x[4 + j], 0xee);
+			t2 = _mm512_shuffle_i32x4(x[8 + j], x[12 + j], 0x44);
+			t3 = _mm512_shuffle_i32x4(x[8 + j], x[12 + j], 0xee);
+			b[0] = _mm512_shuffle_i32x4(t0, t2, 0x88);
+			b[1] = _mm512_shuffle_i32x4(t0, t2, 0xdd);
+			b[2] = _mm512_shuffle_i32x4(t1, t3, 0x88);
+			b[3] = _mm512_shuffle_i32x4(t1, t3, 0xdd);
+			for (k = 0; k < 4; k++) {
+				size_t off = 64 * (4 * k + j);
+				_mm512_storeu_si512(out + off, _mm512_xor_si512(b[k],
+						_mm512_loadu_si512(in + off)));
+			}
+		}
+		in += 1024;
+		out += 1024;
+		done += 16;
+	}
+	return done;
+} // blocks_avx512()
+#endif
@@ -0,0 +1,39 @@
+/*
+ * chacha.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _CHACHA_H
+# define _CHACHA_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* ChaCha20 as in RFC 8439, 32 byte key, 96 bit nonce and a 32 bit
+ * block counter. Long runs are done 16 blocks at a time with AVX-512,
+ * 8 with AVX2 or 4 with SSSE3, whatever is left one block at a time.
+*/
+#define CHACHA_BLOCKSIZE	64
+
+void chacha20_block(const unsigned char *key, const unsigned char *nonce,
+					uint32_t counter, unsigned char *out);
+void chacha20_xor(const unsigned char *key, const unsigned char *nonce,
+					uint32_t counter, const unsigned char *in,
+					unsigned char *out, size_t len);
+const char *chacha20_implname(void);
+
+#endif
@@ -0,0 +1,247 @@
+/*      chachapoly.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "chachapoly.h"
+
+/* Poly1305 with 44/44/42 bit limbs and 128 bit products. The AEAD
+ * only ever MACs whole, zero padded, 16 byte blocks so there is no
+ * partial block handling.
+*/
+typedef unsigned __int128 u128;
+#define M44	0xfffffffffffULL
+#define M42	0x3ffffffffffULL
+
+typedef struct poly1305 {
+	uint64_t r[3];
+	uint64_t h[3];
+	uint64_t pad[2];
+} poly1305;
+
+static uint64_t getle64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+	for (i = 7; i >= 0; i--) v = (v << 8) | p[i];
+	return v;
+} // getle64()
+
+static void putle64(unsigned char *p, uint64_t v)
+{
+	int i;
+	for (i = 0; i < 8; i++) {
+		p[i] = (unsigned char)v;
+		v >>= 8;
+	}
+} // putle64()
+
+static void poly_init(poly1305 *p, const unsigned char *key)
+{
+	uint64_t t0 = getle64(key), t1 = getle64(key + 8);
+	p->r[0] = t0 & 0xffc0fffffffULL;
+	p->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+	p->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+	p->h[0] = p->h[1] = p->h[2] = 0;
+	p->pad[0] = getle64(key + 16);
+	p->pad[1] = getle64(key + 24);
+} // poly_init()
+
+static void poly_blocks(poly1305 *p, const unsigned char *m,
+						size_t nblocks)
+{
+	uint64_t r0 = p->r[0], r1 = p->r[1], r2 = p->r[2];
+	uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+	uint64_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2];
+	while (nblocks--) {
+		uint64_t t0 = getle64(m), t1 = getle64(m + 8), c;
+		u128 d0, d1, d2;
+		h0 += t0 & M44;
+		h1 += ((t0 >> 44) | (t1 << 20)) & M44;
+		h2 += ((t1 >> 24) & M42) | (1ULL << 40);
+		d0 = (u128)h0 * r0 + (u128)h1 * s2 + (u128)h2 * s1;
+		d1 = (u128)h0 * r1 + (u128)h1 * r0 + (u128)h2 * s2;
+		d2 = (u128)h0 * r2 + (u128)h1 * r1 + (u128)h2 * r0;
+		c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & M44;
+		d1 += c; c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & M44;
+		d2 += c; c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & M42;
+		h0 += c * 5; c = h0 >> 44; h0 &= M44;
+		h1 += c;
+		m += 16;
+	}
+	p->h[0] = h0;
+	p->h[1] = h1;
+	p->h[2] = h2;
+} // poly_blocks()
+
+static void poly_padded(poly1305 *p, const unsigned char *m, size_t len)
+{
+	if (len / 16) poly_blocks(p, m, len / 16);
+	if (len % 16) {
+		unsigned char last[16];
+		memset(last, 0, 16);
+		memcpy(last, m + len - len % 16, len % 16);
+		poly_blocks(p, last, 1);
+	}
+} // poly_padded()
+
+static void poly_finish(poly1305 *p, unsigned char *tag)
+{
+	uint64_t h0 = p->h[0], h1 = p->h[1], h2 = p->h[2];
+	uint64_t g0, g1, g2, c, mask, t0, t1;
+
+	c = h1 >> 44; h1 &= M44; h2 += c;
+	c = h2 >> 42; h2 &= M42; h0 += c * 5;
+	c = h0 >> 44; h0 &= M44; h1 += c;
+	c = h1 >> 44; h1 &= M44; h2 += c;
+	c = h2 >> 42; h2 &= M42; h0 += c * 5;
+	c = h0 >> 44; h0 &= M44; h1 += c;
+
+	// h - p, used if it doesn't go negative.
+	g0 = h0 + 5; c = g0 >> 44; g0 &= M44;
+	g1 = h1 + c; c = g1 >> 44; g1 &= M44;
+	g2 = h2 + c - (1ULL << 42);
+	mask = (g2 >> 63) - 1;
+	h0 = (h0 & ~mask) | (g0 & mask);
+	h1 = (h1 & ~mask) | (g1 & mask);
+	h2 = (h2 & ~mask) | (g2 & mask);
+
+	t0 = p->pad[0];
+	t1 = p->pad[1];
+	h0 += t0 & M44; c = h0 >> 44; h0 &= M44;
+	h1 += (((t0 >> 44) | (t1 << 20)) & M44) + c; c = h1 >> 44; h1 &= M44;
+	h2 += ((t1 >> 24) & M42) + c; h2 &= M42;
+	putle64(tag, h0 | (h1 << 44));
+	putle64(tag + 8, (h1 >> 20) | (h2 << 24));
+} // poly_finish()
+
+static void chachapoly_tag(const unsigned char *key,
+				const unsigned char *nonce,
+				const unsigned char *aad, size_t aadlen,
+				const unsigned char *ct, size_t len, unsigned char *tag)
+{
+	unsigned char otk[CHACHA_BLOCKSIZE], lens[16];
+	poly1305 p;
+
+	chacha20_block(key, nonce, 0, otk);
+	poly_init(&p, otk);
+	poly_padded(&p, aad, aadlen);
+	poly_padded(&p, ct, len);
+	putle64(lens, aadlen);
+	putle64(lens + 8, len);
+	poly_blocks(&p, lens, 1);
+	poly_finish(&p, tag);
+	memset(otk, 0, sizeof(otk));
+	memset(&p, 0, sizeof(p));
+} // chachapoly_tag()
+
+void chachapoly_encrypt(const unsigned char *key,
+				const unsigned char *nonce,
+				const unsigned char *aad, size_t aadlen,
+				const unsigned char *in, unsigned char *out, size_t len,
+				unsigned char *tag)
+{
+	/* out may be the same as in. */
+	chacha20_xor(key, nonce, 1, in, out, len);
+	chachapoly_tag(key, nonce, aad, aadlen, out, len, tag);
+} // chachapoly_encrypt()
+
+int chachapoly_decrypt(const unsigned char *key,
+				const unsigned char *nonce,
+				const unsigned char *aad, size_t aadlen,
+				const unsigned char *in, unsigned char *out, size_t len,
+				const unsigned char *tag)
+{
+	/* Returns 0 and the plaintext in out if the tag matches, -1 and
+	 * leaves out untouched if it does not. */
+	unsigned char calc[CHACHAPOLY_TAGSIZE];
+	unsigned char diff = 0;
+	int i;
+
+	chachapoly_tag(key, nonce, aad, aadlen, in, len, calc);
+	for (i = 0; i < CHACHAPOLY_TAGSIZE; i++) {
+		diff |= calc[i] ^ tag[i];
+	}
+	if (diff) return -1;
+	chacha20_xor(key, nonce, 1, in, out, len);
+	return 0;
+} // chachapoly_decrypt()
+
+static int unhex(unsigned char *out, const char *hex)
+{
+	int n = 0;
+	while (hex[0] && hex[1]) {
+		unsigned v;
+		sscanf(hex, "%2x", &v);
+		out[n++] = (unsigned char)v;
+		hex += 2;
+	}
+	return n;
+} // unhex()
+
+int chachapoly_selftest(void)
+{
+	/* The AEAD example of RFC 8439 section 2.8.2, then a longer
+	 * message, so that the multi-block kernels run, must round trip.
+	 * Returns 0 on success. */
+	static const char *pt = "Ladies and Gentlemen of the class of '99: "
+		"If I could offer you only one tip for the future, sunscreen "
+		"would be it.";
+	static const char *wantct =
+		"d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+		"3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+		"92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+		"3ff4def08e4b7a9de576d26586cec64b6116";
+	unsigned char key[32], nonce[12], aad[12], ct[114], tag[16];
+	unsigned char want[114], wanttag[16], out[114];
+	unsigned char big[4096 + 100], bigct[4096 + 100];
+	size_t len = strlen(pt);
+	int i;
+
+	unhex(key, "808182838485868788898a8b8c8d8e8f"
+				"909192939495969798999a9b9c9d9e9f");
+	unhex(nonce, "070000004041424344454647");
+	unhex(aad, "50515253c0c1c2c3c4c5c6c7");
+	unhex(want, wantct);
+	unhex(wanttag, "1ae10b594f09e26a7e902ecbd0600691");
+	chachapoly_encrypt(key, nonce, aad, 12, (const unsigned char *)pt,
+						ct, len, tag);
+	if (memcmp(ct, want, len) || memcmp(tag, wanttag, 16)) return -1;
+	if (chachapoly_decrypt(key, nonce, aad, 12, ct, out, len, tag)
+		|| memcmp(out, pt, len)) return -1;
+	tag[15] ^= 0x80;
+	if (!chachapoly_decrypt(key, nonce, aad, 12, ct, out, len, tag))
+		return -1;
+
+	// the wide kernels against one block at a time.
+	for (i = 0; i < (int)sizeof(big); i++) big[i] = (unsigned char)i;
+	chacha20_xor(key, nonce, 7, big, bigct, sizeof(big));
+	for (i = 0; i < (int)sizeof(big); i += CHACHA_BLOCKSIZE) {
+		unsigned char ks[CHACHA_BLOCKSIZE];
+		int j, n = (int)sizeof(big) - i;
+		if (n > CHACHA_BLOCKSIZE) n = CHACHA_BLOCKSIZE;
+		chacha20_block(key, nonce, 7 + i / CHACHA_BLOCKSIZE, ks);
+		for (j = 0; j < n; j++) {
+			if ((unsigned char)(big[i + j] ^ ks[j]) != bigct[i + j])
+				return -1;
+		}
+	}
+	return 0;
+} // chachapoly_selftest()
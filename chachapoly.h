@@ -0,0 +1,43 @@
+/*
+ * chachapoly.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _CHACHAPOLY_H
+# define _CHACHAPOLY_H
+#include <stdint.h>
+#include <stddef.h>
+#include "chacha.h"
+
+/* The ChaCha20-Poly1305 AEAD of RFC 8439. */
+#define CHACHAPOLY_NONCESIZE	12
+#define CHACHAPOLY_TAGSIZE		16
+
+void chachapoly_encrypt(const unsigned char *key,
+				const unsigned char *nonce,
+				const unsigned char *aad, size_t aadlen,
+				const unsigned char *in, unsigned char *out, size_t len,
+				unsigned char *tag);
+int chachapoly_decrypt(const unsigned char *key,
+				const unsigned char *nonce,
+				const unsigned char *aad, size_t aadlen,
+				const unsigned char *in, unsigned char *out, size_t len,
+				const unsigned char *tag);
+int chachapoly_selftest(void);
+
+#endif
@@ -0,0 +1,62 @@
+/*      cpufeatures.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include "cpufeatures.h"
+
+static void detect(void);
+
+static unsigned features;
+static pthread_once_t featuresonce = PTHREAD_ONCE_INIT;
+
+unsigned cpufeatures(void)
+{
+	/* Returns the set of CPU_* extensions usable on this host. The
+	 * environment variable CRYPT_CPUMASK, if set, is a mask of the
+	 * extensions that may be used, so CRYPT_CPUMASK=0 forces the
+	 * portable code everywhere. The answer never changes during a run
+	 * so it's worked out once, by whichever thread asks first.
+	*/
+	pthread_once(&featuresonce, detect);
+	return features;
+} // cpufeatures()
+
+void detect(void)
+{
+	unsigned f = 0;
+	char *mask;
+
+#ifdef CRYPT_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) f |= CPU_SSSE3;
+	if (__builtin_cpu_supports("sse4.1")) f |= CPU_SSE41;
+	if (__builtin_cpu_supports("aes")) f |= CPU_AESNI;
+	if (__builtin_cpu_supports("pclmul")) f |= CPU_PCLMUL;
+	if (__builtin_cpu_supports("avx2")) f |= CPU_AVX2;
+	if (__builtin_cpu_supports("vaes")) f |= CPU_VAES;
+	if (__builtin_cpu_supports("vpclmulqdq")) f |= CPU_VPCLMUL;
+	if (__builtin_cpu_supports("avx512f")
+		&& __builtin_cpu_supports("avx512bw")) f |= CPU_AVX512;
+	if (__builtin_cpu_supports("sha")) f |= CPU_SHANI;
+#endif
+	mask = getenv("CRYPT_CPUMASK");
+	if (mask) f &= (unsigned)strtoul(mask, NULL, 0);
+	features = f;
+} // detect()
@@ -0,0 +1,44 @@
+/*
+ * cpufeatures.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _CPUFEATURES_H
+# define _CPUFEATURES_H
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define CRYPT_X86 1
+#endif
+
+/* Instruction set extensions that the accelerated code paths use. */
+enum {
+	CPU_SSSE3	= 1 << 0,
+	CPU_SSE41	= 1 << 1,
+	CPU_AESNI	= 1 << 2,
+	CPU_PCLMUL	= 1 << 3,
+	CPU_AVX2	= 1 << 4,
+	CPU_VAES	= 1 << 5,
+	CPU_VPCLMUL	= 1 << 6,
+	CPU_AVX512	= 1 << 7,
+	CPU_SHANI	= 1 << 8
+};
+
+unsigned cpufeatures(void);
+
+#endif
@@ -0,0 +1,323 @@
+/*      creader.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "creader.h"
+#include "cryptheader.h"
+#include "kdf.h"
+
+static crblock *getblock(creader *r, uint64_t b);
+static int loadblock(creader *r, uint64_t b, crblock *cb);
+static void legacyblock(creader *r, uint64_t b, const char *in,
+						char *out, size_t len);
+static void unlink_lru(creader *r, int i);
+static void push_lru(creader *r, int i);
+static unsigned hashblock(const creader *r, uint64_t b);
+static int readat(int fd, char *buf, size_t len, off_t off);
+
+creader *creader_open(const char *fn, const char *pw, int ncache)
+{
+	/* Opens fn, in any of the formats crypt reads, to be read with
+	 * pw. ncache is the number of decrypted blocks kept. Returns NULL
+	 * with errno set if fn can't be opened, is too short to be an
+	 * encrypted file or has a header that can't be used. */
+	unsigned char hbuf[CRYPT_HDRSIZE];
+	char iv[CRYPT_IVSIZE];
+	cryptheader hdr;
+	struct stat sb;
+	creader *r;
+	int fd, i, res, err;
+
+	fd = open(fn, O_RDONLY);
+	if (fd == -1) return NULL;
+	if (fstat(fd, &sb) == -1) goto fail;
+	r = calloc(1, sizeof(creader));
+	if (!r) goto fail;
+	r->fd = fd;
+	if (readat(fd, (char *)hbuf, CRYPT_HDRSIZE, 0) == 0
+		&& (res = unpackheader(hbuf, CRYPT_HDRSIZE, &hdr)) != 0) {
+		if (res < 0) goto errfail;
+		r->dataoff = CRYPT_HDRSIZE + CRYPT_IVSIZE;
+		if (readat(fd, iv, CRYPT_IVSIZE, CRYPT_HDRSIZE)) goto freefail;
+		r->e = engine_byid(hdr.engine);
+	} else if ((res = readtrailer(fd, sb.st_size, &hdr, iv)) != 0) {
+		if (res < 0) goto errfail;
+		r->dataoff = 0;
+		sb.st_size -= CRYPT_HDRSIZE + CRYPT_IVSIZE;
+		r->e = engine_byid(hdr.engine);
+	} else {
+		r->dataoff = CRYPT_IVSIZE;
+		if (readat(fd, iv, CRYPT_IVSIZE, 0)) goto freefail;
+		r->e = engine_byid(ENGINE_LEGACY);
+	}
+	if (!r->e || sb.st_size < r->dataoff) goto freefail;
+	if (r->e->id != ENGINE_LEGACY && hdr.codec) {
+		// compressed, offsets in the plain text can't be found.
+		free(r);
+		close(fd);
+		errno = ENOTSUP;
+		return NULL;
+	}
+	r->datalen = sb.st_size - r->dataoff;
+
+	if (r->e->props & ENGINE_AEAD) {
+		r->block = (size_t)1 << hdr.segshift;
+	} else {
+		r->block = CREADER_BLOCK;
+	}
+	r->cblock = r->block + r->e->overhead;
+	r->nblocks = (r->datalen + r->cblock - 1) / r->cblock;
+	// authenticated streams always have a final segment.
+	if (!r->nblocks && (r->e->props & ENGINE_AEAD)) r->nblocks = 1;
+	if (r->nblocks * r->e->overhead > r->datalen) goto freefail;
+	r->size = r->datalen - r->nblocks * r->e->overhead;
+
+	if (r->e->id == ENGINE_LEGACY) {
+		r->ckpt = malloc((r->nblocks + 1) * sizeof(legacychain));
+		if (!r->ckpt) goto nomem;
+		legacychain_start(&r->ckpt[0], iv, CRYPT_IVSIZE, pw);
+		r->nckpt = 1;
+	} else {
+		char key[KDF_KEYSIZE];
+		unsigned char packed[CRYPT_HDRSIZE];
+		const char *k = kdf_key(pw, &hdr, iv, key);
+		if (!k) goto errfail;
+		packheader(&hdr, packed);
+		r->ctx = r->e->init(packed, iv, CRYPT_IVSIZE, k, r->block,
+							ENGINE_DECRYPT);
+		memset(key, 0, sizeof(key));
+	}
+
+	r->ncache = (ncache > 0) ? ncache : CREADER_CACHE;
+	for (r->nbucket = 1; r->nbucket < 2 * (unsigned)r->ncache; )
+		r->nbucket <<= 1;
+	r->cache = calloc(r->ncache, sizeof(crblock));
+	r->bucket = malloc(r->nbucket * sizeof(int));
+	r->cbuf = malloc(r->cblock);
+	if (!r->cache || !r->bucket || !r->cbuf) goto nomem;
+	for (i = 0; i < (int)r->nbucket; i++) r->bucket[i] = -1;
+	r->head = r->tail = -1;
+	return r;
+
+nomem:	// the block size is the file's to say, so this is not fatal.
+	creader_close(r);
+	errno = ENOMEM;
+	return NULL;
+
+freefail:
+	errno = EINVAL;
+errfail:
+	err = errno;
+	free(r);
+	close(fd);
+	errno = err;
+	return NULL;
+fail:
+	close(fd);
+	return NULL;
+} // creader_open()
+
+ssize_t creader_pread(creader *r, void *buf, size_t len, off_t off)
+{
+	/* Like pread(2) on the plain text: up to len bytes from off, 0 at
+	 * or past the end. Returns -1 if a block the read needs fails to
+	 * authenticate or can't be read, with errno EBADMSG or from the
+	 * read. */
+	size_t done = 0;
+	if (off < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((uint64_t)off >= r->size) return 0;
+	if (len > r->size - off) len = r->size - off;
+	while (done < len) {
+		uint64_t pos = off + done;
+		size_t boff = pos % r->block, n;
+		crblock *cb = getblock(r, pos / r->block);
+		if (!cb) return (done) ? (ssize_t)done : -1;
+		n = cb->len - boff;
+		if (n > len - done) n = len - done;
+		memcpy((char *)buf + done, cb->data + boff, n);
+		done += n;
+	}
+	return done;
+} // creader_pread()
+
+uint64_t creader_size(const creader *r)
+{
+	return r->size;
+} // creader_size()
+
+void creader_close(creader *r)
+{
+	int i;
+	for (i = 0; i < r->used; i++) {
+		memset(r->cache[i].data, 0, r->block);
+		free(r->cache[i].data);
+	}
+	if (r->ctx) r->e->finalize(r->ctx);
+	if (r->ckpt) {
+		memset(r->ckpt, 0, (r->nblocks + 1) * sizeof(legacychain));
+		free(r->ckpt);
+	}
+	close(r->fd);
+	free(r->cache);
+	free(r->bucket);
+	free(r->cbuf);
+	free(r);
+} // creader_close()
+
+crblock *getblock(creader *r, uint64_t b)
+{
+	/* Block b from the cache, decrypting it into the least recently
+	 * used entry if it isn't there. NULL if it can't be had. */
+	unsigned h = hashblock(r, b);
+	int i, *pi;
+	for (i = r->bucket[h]; i != -1; i = r->cache[i].chain) {
+		if (r->cache[i].block == b) {
+			unlink_lru(r, i);
+			push_lru(r, i);
+			return &r->cache[i];
+		}
+	}
+	if (r->used < r->ncache) {
+		i = r->used++;
+		r->cache[i].data = malloc(r->block);
+		if (!r->cache[i].data) {
+			r->used--;
+			errno = ENOMEM;
+			return NULL;
+		}
+	} else {
+		// evict the tail, out of its bucket and the order of use.
+		i = r->tail;
+		pi = &r->bucket[hashblock(r, r->cache[i].block)];
+		while (*pi != i) pi = &r->cache[*pi].chain;
+		*pi = r->cache[i].chain;
+		unlink_lru(r, i);
+	}
+	if (loadblock(r, b, &r->cache[i])) {
+		// an unused entry, put it where it will be taken next.
+		r->cache[i].prev = r->tail;
+		r->cache[i].next = -1;
+		if (r->tail != -1) r->cache[r->tail].next = i;
+		r->tail = i;
+		if (r->head == -1) r->head = i;
+		r->cache[i].block = UINT64_MAX;
+		r->cache[i].chain = r->bucket[hashblock(r, UINT64_MAX)];
+		r->bucket[hashblock(r, UINT64_MAX)] = i;
+		return NULL;
+	}
+	r->cache[i].block = b;
+	r->cache[i].chain = r->bucket[h];
+	r->bucket[h] = i;
+	push_lru(r, i);
+	return &r->cache[i];
+} // getblock()
+
+int loadblock(creader *r, uint64_t b, crblock *cb)
+{
+	// Reads and decrypts block b into cb. Returns 0 or -1.
+	size_t clen = r->datalen - b * r->cblock;
+	if (clen > r->cblock) clen = r->cblock;
+	if (readat(r->fd, r->cbuf, clen, r->dataoff + b * r->cblock)) {
+		return -1;
+	}
+	if (r->ckpt) {
+		legacyblock(r, b, r->cbuf, cb->data, clen);
+		cb->len = clen;
+		return 0;
+	}
+	if (r->e->transform(r->ctx, b, r->cbuf, clen, cb->data, &cb->len,
+						b + 1 == r->nblocks)) {
+		errno = EBADMSG;
+		return -1;
+	}
+	return 0;
+} // loadblock()
+
+void legacyblock(creader *r, uint64_t b, const char *in, char *out,
+					size_t len)
+{
+	/* The chain is run on from the last checkpoint, noting the start
+	 * of every block it passes, then used for block b. */
+	unsigned char ks[32];
+	legacychain lc;
+	size_t i, j;
+	while (r->nckpt <= b) {
+		lc = r->ckpt[r->nckpt - 1];
+		for (i = 0; i < r->block; i += 32) legacychain_next(&lc);
+		r->ckpt[r->nckpt++] = lc;
+	}
+	lc = r->ckpt[b];
+	for (i = 0; i < len; i += 32) {
+		size_t n = (len - i < 32) ? len - i : 32;
+		legacychain_block(&lc, ks);
+		for (j = 0; j < n; j++) out[i + j] = in[i + j] ^ ks[j];
+		legacychain_next(&lc);
+	}
+	memset(ks, 0, sizeof(ks));
+} // legacyblock()
+
+void unlink_lru(creader *r, int i)
+{
+	crblock *cb = &r->cache[i];
+	if (cb->prev != -1) r->cache[cb->prev].next = cb->next;
+	else r->head = cb->next;
+	if (cb->next != -1) r->cache[cb->next].prev = cb->prev;
+	else r->tail = cb->prev;
+} // unlink_lru()
+
+void push_lru(creader *r, int i)
+{
+	crblock *cb = &r->cache[i];
+	cb->prev = -1;
+	cb->next = r->head;
+	if (r->head != -1) r->cache[r->head].prev = i;
+	r->head = i;
+	if (r->tail == -1) r->tail = i;
+} // push_lru()
+
+unsigned hashblock(const creader *r, uint64_t b)
+{
+	return (unsigned)((b * 0x9e3779b97f4a7c15ULL) >> 32) & (r->nbucket - 1);
+} // hashblock()
+
+int readat(int fd, char *buf, size_t len, off_t off)
+{
+	// pread() all of len bytes. Returns 0, or -1 if short or failed.
+	size_t got = 0;
+	while (got < len) {
+		ssize_t n = pread(fd, buf + got, len - got, off + got);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) {
+			if (!n) errno = EIO;
+			return -1;
+		}
+		got += n;
+	}
+	return 0;
+} // readat()
@@ -0,0 +1,75 @@
+/*
+ * creader.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _CREADER_H
+# define _CREADER_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "engine.h"
+#include "legacychain.h"
+
+/* Random access to the plain text of an encrypted file. A read only
+ * decrypts the blocks it touches, and the most recently used blocks
+ * are kept decrypted. A block is one segment for the authenticated
+ * engines, which are checked as they are read, and CREADER_BLOCK
+ * bytes otherwise. The legacy chain can't be entered part way, so
+ * its state at the start of each block is noted the first time the
+ * chain is run past it.
+ * A creader is not to be shared between threads.
+*/
+#define CREADER_BLOCK	(64 * 1024)
+#define CREADER_CACHE	64	// blocks, when 0 is asked for.
+
+typedef struct crblock {
+	uint64_t block;
+	char *data;
+	size_t len;
+	int prev, next;		// in order of use, most recent first.
+	int chain;			// the next in the same hash bucket.
+} crblock;
+
+typedef struct creader {
+	int fd;
+	const cryptengine *e;
+	void *ctx;			// the engine's, NULL for the legacy chain.
+	legacychain *ckpt;	// the chain at the start of each block,
+	uint64_t nckpt;		// this many of them known so far.
+	off_t dataoff;		// where the cipher text starts,
+	uint64_t datalen;	// and its length.
+	uint64_t size;		// the plain text length.
+	size_t block;		// plain text bytes per block,
+	size_t cblock;		// and what they take in the file.
+	uint64_t nblocks;
+	crblock *cache;
+	int ncache, used;
+	int head, tail;
+	int *bucket;
+	unsigned nbucket;
+	char *cbuf;			// cipher text of one block.
+} creader;
+
+creader *creader_open(const char *fn, const char *pw, int ncache);
+ssize_t creader_pread(creader *r, void *buf, size_t len, off_t off);
+uint64_t creader_size(const creader *r);
+void creader_close(creader *r);
+
+#endif
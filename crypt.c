@@ -30,15 +30,40 @@
 #include <limits.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include "readfile.h"
 #include "writefile.h"
 #include "sha256.h"
 #include "calc_nonce.h"
-#include "calcsha256sum.h"
+#include "cryptheader.h"
+#include "parallel.h"
+#include "engine.h"
+#include "legacymb.h"
+#include "uring.h"
+#include "inplace.h"
+#include "creader.h"
+#include "cryptctx.h"
+#include "kdf.h"
+#include "liststate.h"
+#include "manifest.h"
+#include "tree.h"
+#include "archive.h"
+#include "lz.h"
+#include "store.h"
 
 char *helpmsg = "\n\tUsage: crypt [option] infile pass-phrase outfile.\n"
   "\t       crypt -s file_to_shred/delete\n"
   "\t       crypt -l infile pass-phrase\n"
+  "\t       crypt -i [-d] file pass-phrase\n"
+  "\t       crypt --tree [-d] srcdir pass-phrase dstdir\n"
+  "\t       crypt --pack srcdir pass-phrase archive\n"
+  "\t       crypt --unpack archive pass-phrase dstdir\n"
+  "\t       crypt --member name archive pass-phrase outfile\n"
+  "\t       crypt --members archive pass-phrase\n"
+  "\t       crypt --store dir [-d] infile pass-phrase outfile\n"
   "\n\tOptions:\n"
   "\t-h outputs this help message.\n"
   "\t-d decryption mode. encryption is asymmetric due to the use of\n"
@@ -48,35 +73,176 @@ char *helpmsg = "\n\tUsage: crypt [option] infile pass-phrase outfile.\n"
   "\t-D debug mode. Writes the hex representations of the sha256sums\n"
   "\t   to stderr. If you direct stderr to a file note that the size\n"
   "\t   of that file will be double that of the source file.\n"
+  "\t-c cipher, --engine cipher, the cipher to encrypt with.\n"
+  "\t   sha256-ctr (the default), aes-256-gcm or chacha20-poly1305.\n"
+  "\t   The last two are authenticated. aes-256-gcm is fastest with\n"
+  "\t   AES-NI, chacha20-poly1305 where the cpu lacks it. auto picks\n"
+  "\t   the fastest on this machine. Decryption reads the cipher\n"
+  "\t   from the file.\n"
+  "\t--list-engines lists the ciphers with the implementation in use,\n"
+  "\t   the result of a self test and a measured speed in MB/s.\n"
+  "\t-b size, the size of the read and write buffers, eg 512K or\n"
+  "\t   16M. The default is 4M.\n"
+  "\t--mmap maps the input and output files and transforms from one\n"
+  "\t   mapping straight into the other.\n"
+  "\t--uring[=N] reads and writes through io_uring with N buffers,\n"
+  "\t   default 4, in flight while earlier ones are transformed.\n"
+  "\t   Falls back to blocking I/O where io_uring is unavailable.\n"
+  "\t--direct reads and writes with O_DIRECT so that neither file\n"
+  "\t   passes through the page cache. Overrides --uring and -j.\n"
+  "\t--range offset[:length] decrypts only length bytes from offset,\n"
+  "\t   or to the end, reading just the blocks that hold them.\n"
+  "\t--kdf-time ms, how long to stretch the pass phrase for when\n"
+  "\t   encrypting, default 250. The time is calibrated on this\n"
+  "\t   machine and the cost recorded in the file, at most 2^28\n"
+  "\t   iterations. 0 uses the pass phrase directly, as version 2\n"
+  "\t   did.\n"
+  "\t-i, --in-place transforms the file where it is, with sha256-ctr,\n"
+  "\t   keeping progress in file.cjournal. If it is interrupted run\n"
+  "\t   the same command to finish, or --rollback to undo it.\n"
+  "\t--compress[=N] compresses before encrypting, N from 1, fast and\n"
+  "\t   the default, to 9, smallest. Decryption finds it in the file.\n"
+  "\t   A compressed file is done in one pass on one thread, and\n"
+  "\t   --range can't be used on it.\n"
+  "\t-j N use N threads for counter mode files. 0 means one per\n"
+  "\t   cpu. The output is the same whatever the number of threads.\n"
   "\t-l mode. Listing mode. Expect to find the objects to en/decrypt\n"
   "\t   in a formatted file. Such file is expected to be encrypted\n"
   "\t   so -d is implied.\n"
   "\t   An output file is not required, nor if specified will it be\n"
   "\t   written.\n"
+  "\t--list-jobs N, the number of list or tree entries done at\n"
+  "\t   once, those of a list largest first. 0, the default, means\n"
+  "\t   one per cpu. Each list entry is reported as it finishes and\n"
+  "\t   a failed one doesn't stop the others.\n"
+  "\t   What each entry did is kept, encrypted, in list.cstate and an\n"
+  "\t   entry whose source and output are unchanged is skipped.\n"
+  "\t--full runs every list entry, changed or not.\n"
+  "\t--tree encrypts or decrypts every file under srcdir to the same\n"
+  "\t   name under dstdir, making the directories as it goes.\n"
+  "\t   --list-jobs sets the number of threads reading directories\n"
+  "\t   and transforming files, a file of 64M or more being given\n"
+  "\t   any that are idle. Symbolic links are not followed and only\n"
+  "\t   the files that fail are reported.\n"
+  "\t--pack puts every file under srcdir into one encrypted archive\n"
+  "\t   with an encrypted index of them, --unpack takes them all out\n"
+  "\t   again under dstdir, --member just the one named, to outfile,\n"
+  "\t   decrypting none of the others, and --members lists them.\n"
+  "\t--store dir backs up infile to dir, which holds the chunks of\n"
+  "\t   every backup made to it, each only once, and writes outfile,\n"
+  "\t   the encrypted recipe of this one. With -d infile is a recipe\n"
+  "\t   and outfile is made from its chunks. Every backup to a store\n"
+  "\t   must use the pass phrase it was made with. --compress and\n"
+  "\t   -c apply to the chunks that are new.\n"
+  "\tFiles are encrypted in the counter mode format. Files in the\n"
+  "\tolder chained format are recognised and can still be decrypted.\n"
+  "\tinfile and outfile may be - for stdin and stdout, so that crypt\n"
+  "\tcan sit in a pipeline.\n"
   "\tNB the passphrase if it contains spaces must be quoted.\n"
   "\tA 7 word or longer passphrase is recommended.\n"
   ;
-typedef struct prmstr {
-	char *param;
-	char *nextfrom;
-} prmstr;
+#define IOBUFSIZE	(4 * 1024 * 1024)
+#define URINGDEPTH	4
+#define URINGMAX	64
+#define DIRECTALIGN	4096
+
+enum {
+	IO_MMAP		= 1 << 0,	// what streamloop() may do with the output,
+	IO_DIRECT	= 1 << 1	// --mmap and --direct unless it is stdout.
+};
+
+typedef struct listentry {
+	char *in;
+	char *out;
+	char *pw;
+	off_t size;
+	int res;		// 0 when done, -1 if it failed.
+	staterec st;	// what the state file is to say of it,
+	int recorded;	// if anything.
+} listentry;
+
+typedef struct listpool {
+	listentry *ent;
+	const liststate *old;
+	size_t n;
+	size_t next;	// next entry to be claimed, shared.
+	legacyjob *batch;	// legacy entries, done by one of the threads.
+	size_t nbatch;
+} listpool;
 
 static void dohelp(int forced);
-static void listdecrypt(const char *pw, char *from, char *to,
+static void listdecrypt(const char *fn, const char *pw, char *from,
+							char *to,
 						size_t ivmode);
-static void	processlist(char *writefrom, char *to);
+static void	processlist(char *writefrom, char *to, const char *listfn,
+						const char *pw, const cryptheader *hdr,
+						const char *iv);
+static char *joinpath(const char *dir, const char *name);
+static size_t runlist(listentry *ent, size_t nent, legacyjob *batch,
+						size_t nbatch, const liststate *old);
+static void *listworker(void *arg);
+static void *legacyworker(void *arg);
+static void legacyreport(const legacyjob *job);
+static int bysize(const void *a, const void *b);
+static int legacybysize(const void *a, const void *b);
+static void runtree(const char *src, const char *dst, const char *pw);
+static int treefile(const char *in, const char *out, int threads,
+						void *arg);
+static void runarchive(const char *infile, const char *outfile,
+						const char *pw);
+static void runstore(const char *infile, const char *outfile,
+						const char *pw);
 			// Only needs the decrypted image.
-static prmstr getparam(const char *srchfor, char *from, char *to,
-						int fatal, int wantsts);
-static void dosystem(const char *cmd);
-static void readwriteloop(const char *infile, const char *outfile,
-					const char *pw, size_t chunksize, size_t ivsize);
+static int readwriteloop(const char *infile, const char *outfile,
+					const char *pw, size_t ivsize, int threads);
+static void readrange(const char *infile, const char *outfile,
+					const char *pw);
+static void parserange(const char *s);
+static int streamloop(FILE *fpi, FILE *fpo, const cryptengine *e,
+				const cryptheader *hdr, const char *iv, size_t ivsize,
+				const char *pw, off_t ifsize, int threads, int io);
+static int segloop(FILE *fpi, FILE *fpo, cryptctx *c,
+					uint64_t limit, off_t ifsize);
+static int lzloop(FILE *fpi, FILE *fpo, cryptctx *c, uint64_t limit);
+static int unframe(char *fbuf, size_t *nf, char *raw, FILE *fpo);
+static int regularfile(FILE *fp);
+static int maploop(FILE *fpi, FILE *fpo, segjob *job,
+					const cryptengine *e, off_t ifsize, int threads);
+static void filejob(FILE *fpi, FILE *fpo, segjob *job,
+					const cryptengine *e, off_t ifsize);
+static int uringloop(FILE *fpi, FILE *fpo, segjob *job,
+					const cryptengine *e, off_t ifsize);
+static int directloop(FILE *fpi, FILE *fpo, segjob *job,
+					const cryptengine *e, off_t ifsize);
+static int setdirect(int fd, int on);
+static void dropcache(int fd, off_t off, size_t len, int written);
+static int memtransform(const segjob *job, const char *in, size_t len,
+					char *out, size_t *outlen);
+static const cryptengine *headerengine(const cryptheader *hdr);
+static char *iobuffer(size_t size);
+static size_t readfull(char *buf, size_t len, FILE *fp);
+static size_t parsesize(const char *s);
 //static void logthisbin(void *buf, size_t size, const char *fn);
 static void shredfile(const char *fn);
 static int debug, list;
 static char themode;
-static char *program;
+static int listjobs;
+static int fullrun;
+static int treemode;
+static char archmode;	// 'p'ack, 'u'npack, 'm'ember or 'n'ames.
+static char *membername;
+static int compresslevel;	// 0 unless --compress.
+static char *storedir;
 static int decrypt;
+static int nthreads;
+static const cryptengine *engine;
+static size_t iobufsize;
+static int usemmap;
+static unsigned uringdepth;	// 0 unless --uring.
+static int usedirect;
+static int inplacemode, rollback;
+static int userange;
+static uint64_t rangeoff, rangelen;
 
 int main(int argc, char **argv)
 {
@@ -85,7 +251,34 @@ int main(int argc, char **argv)
 	char *tmpdir = NULL;
 	list = debug = 0;
 	decrypt = 0;
-	while((opt = getopt(argc, argv, ":hds:t:Dl:")) != -1) {
+	nthreads = 1;
+	listjobs = numthreads(0);
+	engine = engine_byid(ENGINE_SHA256CTR);
+	iobufsize = IOBUFSIZE;
+	atexit(kdf_forget);	// derived keys are not left in memory.
+	static struct option longopts[] = {
+		{"engine", required_argument, NULL, 'c'},
+		{"list-engines", no_argument, NULL, 'L'},
+		{"mmap", no_argument, NULL, 'M'},
+		{"uring", optional_argument, NULL, 'U'},
+		{"direct", no_argument, NULL, 'O'},
+		{"in-place", no_argument, NULL, 'i'},
+		{"rollback", no_argument, NULL, 'R'},
+		{"range", required_argument, NULL, 'r'},
+		{"kdf-time", required_argument, NULL, 'K'},
+		{"list-jobs", required_argument, NULL, 'J'},
+		{"full", no_argument, NULL, 'F'},
+		{"tree", no_argument, NULL, 'T'},
+		{"pack", no_argument, NULL, 'P'},
+		{"unpack", no_argument, NULL, 'X'},
+		{"member", required_argument, NULL, 'm'},
+		{"members", no_argument, NULL, 'n'},
+		{"compress", optional_argument, NULL, 'z'},
+		{"store", required_argument, NULL, 'S'},
+		{NULL, 0, NULL, 0}
+	};
+	while((opt = getopt_long(argc, argv, ":hds:t:Dl:j:c:b:i", longopts,
+								NULL)) != -1) {
 		switch(opt){
 		char wrk[NAME_MAX];
 		case 'h':
@@ -107,6 +300,98 @@ int main(int argc, char **argv)
 			exit(EXIT_FAILURE);
 		}
 		break;
+		case 'c': // cipher to encrypt with
+		engine = engine_byname(optarg);
+		if (!engine || (engine->props & ENGINE_NOWRITE)) {
+			fprintf(stderr, "Unknown cipher: %s\n", optarg);
+			exit(EXIT_FAILURE);
+		}
+		break;
+		case 'M': // transform between mappings of the files
+		usemmap = 1;
+		break;
+		case 'i': // transform the file where it is
+		inplacemode = 1;
+		break;
+		case 'R': // undo an unfinished in place run
+		inplacemode = rollback = 1;
+		break;
+		case 'r': // decrypt only part of the file
+		parserange(optarg);
+		userange = decrypt = 1;
+		break;
+		case 'K': // milliseconds to stretch the pass phrase for
+		{
+			long ms = strtol(optarg, NULL, 10);
+			if (ms < 0 || ms > 3600000) {
+				fprintf(stderr, "Illegal kdf time: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			kdf_settime(ms);
+		}
+		break;
+		case 'O': // keep the files out of the page cache
+		usedirect = 1;
+		break;
+		case 'U': // asynchronous reads and writes
+		uringdepth = (optarg) ? strtol(optarg, NULL, 10) : URINGDEPTH;
+		if (uringdepth < 1 || uringdepth > URINGMAX) {
+			fprintf(stderr, "Illegal queue depth: %s\n", optarg);
+			exit(EXIT_FAILURE);
+		}
+		break;
+		case 'L': // list the engines
+		engine_list(stdout);
+		exit(EXIT_SUCCESS);
+		break;
+		case 'j': // number of worker threads
+		nthreads = strtol(optarg, NULL, 10);
+		if (nthreads < 0) {
+			fprintf(stderr, "Illegal number of threads: %s\n", optarg);
+			exit(EXIT_FAILURE);
+		}
+		nthreads = numthreads(nthreads);
+		break;
+		case 'J': // list entries done at once
+		listjobs = strtol(optarg, NULL, 10);
+		if (listjobs < 0) {
+			fprintf(stderr, "Illegal number of list jobs: %s\n", optarg);
+			exit(EXIT_FAILURE);
+		}
+		listjobs = numthreads(listjobs);
+		break;
+		case 'F': // run every list entry, changed or not
+		fullrun = 1;
+		break;
+		case 'T': // a directory tree
+		treemode = 1;
+		break;
+		case 'P': // many files into one archive
+		archmode = 'p';
+		break;
+		case 'X': // and out of it
+		archmode = 'u';
+		break;
+		case 'm': // one member of an archive
+		archmode = 'm';
+		membername = optarg;
+		break;
+		case 'n': // what's in an archive
+		archmode = 'n';
+		break;
+		case 'z': // compress before encrypting
+		compresslevel = (optarg) ? strtol(optarg, NULL, 10) : 1;
+		if (compresslevel < 1 || compresslevel > LZ_MAXLEVEL) {
+			fprintf(stderr, "Illegal compression level: %s\n", optarg);
+			exit(EXIT_FAILURE);
+		}
+		break;
+		case 'S': // backups as chunks in a store
+		storedir = optarg;
+		break;
+		case 'b': // size of the I/O buffers
+		iobufsize = parsesize(optarg);
+		break;
 		case 't': // write output file to a sub dir in /tmp/
 		totmp = 1;
 		strcpy(wrk, "/tmp/");
@@ -133,8 +418,6 @@ int main(int argc, char **argv)
 	}//while()
 	// now process the non-option arguments
 
-	program = argv[0];	// needed sometimes
-
 	// 1.Check that argv[???] exists.
 	if (!(argv[optind])) {
 		fprintf(stderr, "No infile provided\n");
@@ -155,7 +438,7 @@ int main(int argc, char **argv)
 	char *outfile = NULL;
 
 	// The output file.
-	if (!list) {
+	if (!list && !inplacemode && archmode != 'n') {
 		optind++;
 		if (!(argv[optind])) {
 			fprintf(stderr, "No output file provided\n");
@@ -179,17 +462,43 @@ int main(int argc, char **argv)
 	// added an IV, a nonce based on 16 bytes from calc_nonce(). When
 	// encrypting the nonce will be created, when decrypting it will be
 	// read from the encrypted file.
+	// Encryption always writes the version 3 counter mode format, or
+	// version 4 if it is compressed, decryption accepts those and the
+	// legacy chained format.
+	if (compresslevel && (inplacemode || archmode)) {
+		fprintf(stderr, "--compress is for whole files only\n");
+		exit(EXIT_FAILURE);
+	}
+	if (storedir && (inplacemode || list || userange || treemode
+						|| archmode)) {
+		fprintf(stderr, "--store can't be used with that\n");
+		exit(EXIT_FAILURE);
+	}
 
 	// The actual encryption
-	if (list) {	// in memory processing
+	if (inplacemode) {	// no output file, the journal is beside it
+		int flags = (decrypt) ? ENGINE_DECRYPT : 0;
+		if (debug) flags |= ENGINE_DEBUG;
+		inplace(infile, pw, engine, flags, rollback, iobufsize);
+	} else if (list) {	// in memory processing
 		fdata fdat = readfile(infile, 0, 1);
-		listdecrypt(pw, fdat.from, fdat.to, 32);
+		listdecrypt(infile, pw, fdat.from, fdat.to, 32);
 		free(fdat.from);
+	} else if (userange) {	// just the blocks that hold the range
+		readrange(infile, outfile, pw);
+	} else if (treemode) {	// infile and outfile are directories
+		runtree(infile, outfile, pw);
+	} else if (archmode) {	// one or other is an archive
+		runarchive(infile, outfile, pw);
+	} else if (storedir) {	// outfile or infile is a recipe
+		runstore(infile, outfile, pw);
 	} else {	// process in chunks so will handle huge files
-		readwriteloop(infile, outfile, pw, 32, 32);
+		if (readwriteloop(infile, outfile, pw, 32, nthreads)) {
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	if (!list) free(outfile);
+	free(outfile);
 	free(pw);
 	free(infile);
 	return 0;
@@ -201,295 +510,1204 @@ void dohelp(int forced)
   exit(forced);
 }
 
-void listdecrypt(const char *pw, char *from, char *to, size_t ivsize)
-{
-	unsigned char result[32];
-	char *cp;
-	char *pwbuf;
-	// pwbuf may be any length subject only to available memory.
-	size_t pwblen = strlen(pw) + ivsize;
-	size_t pwbuflen = (pwblen < 64) ? 64 : pwblen;
-	pwbuf = malloc(pwbuflen + 1);	// terminating '\0'
-	memcpy(pwbuf, from, ivsize); // no strcpy(), may have embedded '\0'.
-	strcpy(pwbuf + ivsize, pw);
-	from += ivsize;
-	cp = from;
-	// NB arg1 is the input, arg3 64 bit sha256sum, arg4 32 bit sum.
-	(void)calcsha256sum(pwbuf, pwblen, pwbuf, result);
-
-	while(1) {
-		if (debug) {
-			// write the hex version of the sum to stderr
-			fprintf(stderr, "%s\n", pwbuf);
-		} // debug
-
-		// the actual decryption.
-		size_t i;
-		for (i=0; i<32; i++) {
-			*cp ^= result[i];
-			cp++;
-			if (cp > to) goto writeresult;	// the only exit point
-		}
-		// get the next sum
-		/*         input64bytes, size, output64bytes, output32bytes */
-		(void)calcsha256sum(pwbuf, 64, pwbuf, result);
-	}
-
-writeresult:
-	processlist(from, to); // Only needs the decrypted image.
-} // listdecrypt()
+void listdecrypt(const char *fn, const char *pw, char *from, char *to,
+					size_t ivsize)
+{
+	/* The list file fn may be in either format, the legacy chain is
+	 * just another engine as far as this is concerned. */
+	const cryptengine *e;
+	cryptheader hdr, *hp = &hdr;
+	segjob job;
+	size_t outlen;
+	int flags = ENGINE_DECRYPT | ((debug) ? ENGINE_DEBUG : 0);
+	int res = unpackheader((unsigned char *)from, to - from, &hdr);
 
-void processlist(char *writefrom, char *to)
-{
-	// invoke this program to process a list of objects
-	char *cp;
-	int incomment = 0;
-	prmstr prmd;
-	cp = writefrom;
-	// first job, replace all commented material with ' '.
-	while (cp < to) {
-		switch(*cp) {
-			case '#':
-			incomment = 1;
-			*cp = ' ';
-			break;
-			case '\t':
-			*cp = ' ';
-			break;
-			case '\n':
-			incomment = 0;
-			break;
-			default:
-			if(incomment) *cp = ' ';
-			break;
-		}
-		cp++;
+	if (!res && to - from >= CRYPT_HDRSIZE + (ptrdiff_t)ivsize) {
+		res = unpackheader((unsigned char *)to - CRYPT_HDRSIZE - ivsize,
+							CRYPT_HDRSIZE, &hdr);
+		if (res > 0 && !(hdr.flags & CRYPT_TRAILER)) res = 0;
+		if (res > 0) res = 2;	// a trailer.
 	}
-	cp = writefrom;
-	char *ptpath;
-	// See if I have a from and or to path specified
-	prmd = getparam("PTPATH=", cp, to, 0, 1);
-	// I'm not using nextfrom here because I will enforce no ordering
-	// on these objects.
-	if (prmd.param) {
-		ptpath = strdup(prmd.param);
-	} else {
-		ptpath = NULL;	// NULL
+	if (res < 0) {
+		fprintf(stderr, "List file: %s\n", headerwhy(errno));
+		exit(EXIT_FAILURE);
 	}
-	char *etpath;
-	prmd = getparam("ETPATH=", cp, to, 0, 1);
-	if (prmd.param) {
-		etpath = strdup(prmd.param);
+	if (res == 1) {
+		from += CRYPT_HDRSIZE;
+		e = headerengine(&hdr);
+	} else if (res == 2) {
+		// encrypted in place, move the IV to the front.
+		char iv[CRYPT_IVSIZE];
+		memcpy(iv, to - ivsize, ivsize);
+		to -= CRYPT_HDRSIZE + ivsize;
+		memmove(from + ivsize, from, to - from);
+		memcpy(from, iv, ivsize);
+		to += ivsize;
+		e = headerengine(&hdr);
 	} else {
-		etpath = NULL;	// NULL
+		e = engine_byid(ENGINE_LEGACY);
+		hp = NULL;
+	}
+	if (!e) {
+		fprintf(stderr, "List file: unknown cipher %d\n", hdr.engine);
+		exit(EXIT_FAILURE);
+	}
+	if (to - from < (ptrdiff_t)ivsize) {
+		fprintf(stderr, "List file has a truncated header\n");
+		exit(EXIT_FAILURE);
+	}
+	if (engine_setup(&job, e, hp, from, ivsize, pw, flags)) {
+		fprintf(stderr, "List file: %s\n", headerwhy(errno));
+		exit(EXIT_FAILURE);
+	}
+	from += ivsize;
+	// plain text is never longer than what it came from.
+	char *plain = malloc(to - from + 1);
+	if (memtransform(&job, from, to - from, plain, &outlen)) {
+		fprintf(stderr, "List file failed to authenticate\n");
+		exit(EXIT_FAILURE);
+	}
+	engine_finish(&job, e);
+	if (hp && hp->codec) {	// made with --compress
+		char *lzin = plain;
+		plain = lz_expand(lzin, outlen, &outlen);
+		free(lzin);
+		if (!plain) {
+			fprintf(stderr, "List file is corrupt\n");
+			exit(EXIT_FAILURE);
+		}
 	}
+	processlist(plain, plain + outlen, fn, pw, hp, from - ivsize);
+	free(plain);
+} // listdecrypt()
 
-	cp = writefrom;	// init for while loop
-	// I do use nextfrom here because I do want to enforce ordering,
-	// PT, ET, then PP. Not only that ordering, the set must comprise
-	// all 3 objects, else it's fatal.
-	char *fmt;
-	if (themode == 'd') { // protect all strings
-		fmt = "%s -d '%s' '%s' '%s'";
-	} else {
-		fmt = "%s '%s' '%s' '%s'";
-	}
-	while(1) {
-		char command[PATH_MAX];
-		char *pt, *et, *pp, *in, *out, *inpath, *outpath;
-		// PT
-		prmd = getparam("PT=", cp, to, 0, 0);
-		if (!prmd.param) break;	// done
-		pt = strdup(prmd.param);
-		// ET
-		prmd = getparam("ET=", prmd.nextfrom, to, 1, 0);
-		// no return if non existent.
-		et = strdup(prmd.param);
-		// PP
-		prmd = getparam("PP=", prmd.nextfrom, to, 1, 0);
-		pp = strdup(prmd.param);
+void processlist(char *writefrom, char *to, const char *listfn,
+					const char *pw, const cryptheader *hdr, const char *iv)
+{
+	/* Entries to decrypt that are in the legacy format are kept apart
+	 * to be done together by legacy_batch() on one of runlist()'s
+	 * threads, the others are done by the rest of them, all in this
+	 * process so that a pass phrase used for more than one of them is
+	 * only stretched once. */
+	manifest m;
+	legacyjob *batch = NULL;
+	size_t nbatch = 0, batchmax = 0, k;
+	listentry *ent = NULL;
+	size_t nent = 0, entmax = 0;
+	manifest_parse(&m, writefrom, to);
+	decrypt = (themode == 'd');	// it was set for the list file.
+	for (k = 0; k < m.n; k++) {
+		const char *in, *out, *inpath, *outpath;
+		char *in_name, *out_name;
+		struct stat sb;
+		off_t size;
 		if (themode == 'd') {
-			in = et;
-			out = pt;
-			inpath = etpath;
-			outpath = ptpath;
+			in = m.ent[k].et;
+			out = m.ent[k].pt;
+			inpath = m.etpath;
+			outpath = m.ptpath;
 		} else {
-			in = pt;
-			out = et;
-			inpath = ptpath;
-			outpath = etpath;
-		}
-		// NB *path may be NULL
-		char in_name[NAME_MAX];
-		char out_name[NAME_MAX];
-		in_name[0] = '\0';
-		out_name[0] = '\0';
-		strcat(in_name, inpath);	// NULL path auto handled
-		strcat(in_name, in);
-		strcat(out_name, outpath);	// NULL path auto handled
-		strcat(out_name, out);
-		// now prepare the command
-		sprintf(command, fmt, program, in_name, pp, out_name);
-		// free the strdups
-		free(pp);
-		free(et);
-		free(pt);
-		// do the command
-		fprintf(stdout, "%s\n", command);
-		dosystem(command);
-		cp = prmd.nextfrom;	// initialise for the next pass.
+			in = m.ent[k].pt;
+			out = m.ent[k].et;
+			inpath = m.ptpath;
+			outpath = m.etpath;
+		}
+		in_name = joinpath(inpath, in);	// the paths may be NULL.
+		out_name = joinpath(outpath, out);
+		// one that can't be read fails when its turn comes.
+		size = (stat(in_name, &sb) == 0) ? sb.st_size : 0;
+		if (themode == 'd' && !debug && islegacyfile(in_name)) {
+			if (nbatch == batchmax) {
+				batchmax = (batchmax) ? 2 * batchmax : 16;
+				batch = realloc(batch, batchmax * sizeof(legacyjob));
+				if (!batch) {
+					perror("malloc failure in processlist()");
+					exit(EXIT_FAILURE);
+				}
+			}
+			batch[nbatch].in = in_name;
+			batch[nbatch].pw = strdup(m.ent[k].pp);
+			batch[nbatch].out = out_name;
+			batch[nbatch].size = size;
+			batch[nbatch].res = 0;
+			nbatch++;
+		} else {
+			if (nent == entmax) {
+				entmax = (entmax) ? 2 * entmax : 16;
+				ent = realloc(ent, entmax * sizeof(listentry));
+				if (!ent) {
+					perror("malloc failure in processlist()");
+					exit(EXIT_FAILURE);
+				}
+			}
+			ent[nent].in = in_name;
+			ent[nent].pw = strdup(m.ent[k].pp);
+			ent[nent].out = out_name;
+			ent[nent].size = size;
+			nent++;
+		}
+	}
+	manifest_free(&m);
+	if (nent || nbatch) {
+		/* The state is of the entries that aren't legacy and those of
+		 * runs the other way, the legacy ones and any since taken out
+		 * of the list are forgotten. */
+		liststate old, now;
+		size_t i, nfailed;
+		char *statefn = malloc(strlen(listfn) + strlen(LISTSTATE_SUFFIX)
+								+ 1);
+		sprintf(statefn, "%s%s", listfn, LISTSTATE_SUFFIX);
+		liststate_load(&old, statefn, pw);
+		nfailed = runlist(ent, nent, batch, nbatch, &old);
+		memset(&now, 0, sizeof(liststate));
+		for (i = 0; i < old.n; i++) {
+			if (old.rec[i].mode != themode) liststate_add(&now, &old.rec[i]);
+		}
+		for (i = 0; i < nent; i++) {
+			if (ent[i].recorded) {
+				ent[i].st.in = ent[i].in;
+				ent[i].st.out = ent[i].out;
+				liststate_add(&now, &ent[i].st);
+			}
+			free(ent[i].in);
+			free(ent[i].pw);
+			free(ent[i].out);
+		}
+		for (i = 0; i < nbatch; i++) {
+			free(batch[i].in);
+			free(batch[i].pw);
+			free(batch[i].out);
+		}
+		liststate_save(&now, statefn, pw, hdr, iv);
+		liststate_free(&now);
+		liststate_free(&old);
+		free(statefn);
+		if (nfailed) {
+			fprintf(stderr, "%zu of %zu list entries failed\n", nfailed,
+					nent + nbatch);
+			exit(EXIT_FAILURE);
+		}
 	}
+	free(batch);
+	free(ent);
 
 } // processlist()
 
-prmstr getparam(const char *srchfor, char *from, char *to, int fatal,
-				int wantsts)
-{
-	/* Looks for text strings that begin with ??=sometext and returns
-	 * sometext. It also sets nextfrom to near the end of line of the
-	 * discovered parameter for the next search.
-	 * fatal is set to 0 if a searched for parameter is not necessarily
-	 * required. In that case a NULL * is returned if absent. If fatal
-	 * is 1 the program will terminate with error message.
-	 * wantsts if non zero will cause a '/' to be appended to the found
-	 * text if it's not present. Ie this is for dir names.
-	 * NB Real data lines must start at line 2 or after, and the file
-	 * must end with '\n'.
-	*/
-	char srchstr[128];
-	static char result[NAME_MAX];
-	char line[80];
-	char *bod, *eod, *eol, *cp;
-	prmstr prmd;
-
-	size_t len = strlen(srchfor) + 1;	// will prepend '\n'
-
-	strcpy(srchstr, "\n");
-	strcat(srchstr, srchfor);
-	cp = memmem(from, to - from, srchstr, len);
-	if(!cp) {
-		if (fatal){
-			fprintf(stderr, "Fatal error, could not find: %s\n",
-						srchfor);
+char *joinpath(const char *dir, const char *name)
+{
+	// dir, which may be NULL, ends with '/' if it isn't.
+	size_t dlen = (dir) ? strlen(dir) : 0, nlen = strlen(name);
+	char *path = malloc(dlen + nlen + 1);
+	if (!path) {
+		perror("malloc failure in joinpath()");
+		exit(EXIT_FAILURE);
+	}
+	if (dlen) memcpy(path, dir, dlen);
+	memcpy(path + dlen, name, nlen + 1);
+	return path;
+} // joinpath()
+
+size_t runlist(listentry *ent, size_t nent, legacyjob *batch,
+				size_t nbatch, const liststate *old)
+{
+	/* Runs the entries on listjobs threads, largest first so that a
+	 * big file found late doesn't leave the others idle at the end.
+	 * The first thread does the legacy batch, also largest first,
+	 * before it joins the others. Those that old shows to be unchanged
+	 * are skipped unless this is a --full run. Each one is reported as
+	 * it finishes and the number that failed is returned. */
+	listpool pool;
+	pthread_t *tids;
+	size_t i, nfailed = 0, njobs = nent + (nbatch != 0);
+	int n = (njobs < (size_t)listjobs) ? (int)njobs : listjobs;
+
+	qsort(ent, nent, sizeof(listentry), bysize);
+	qsort(batch, nbatch, sizeof(legacyjob), legacybysize);
+	pool.ent = ent;
+	pool.old = old;
+	pool.n = nent;
+	pool.next = 0;
+	pool.batch = batch;
+	pool.nbatch = nbatch;
+	tids = malloc(n * sizeof(pthread_t));
+	if (!tids) {
+		perror("malloc failure in runlist()");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < (size_t)n; i++) {
+		int res = pthread_create(&tids[i], NULL,
+								(i == 0 && nbatch) ? legacyworker
+													: listworker, &pool);
+		if (res) {
+			errno = res;
+			perror("pthread_create");
 			exit(EXIT_FAILURE);
-		} else {
-			prmd.param = NULL;
-			return prmd;
 		}
 	}
-	bod = cp + len;	// beginning of data
-	eol = memchr(bod, '\n', to - bod);
-	if (!eol) {
-		fprintf(stderr, "Fatal, no line end where expected\n");
+	for (i = 0; i < (size_t)n; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+	for (i = 0; i < nent; i++) {
+		if (ent[i].res) nfailed++;
+	}
+	for (i = 0; i < nbatch; i++) {
+		if (batch[i].res) nfailed++;
+	}
+	return nfailed;
+} // runlist()
+
+void *listworker(void *arg)
+{
+	listpool *pool = arg;
+	while (1) {
+		size_t k = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+		if (k >= pool->n) break;
+		listentry *le = &pool->ent[k];
+		if (!fullrun && liststate_unchanged(pool->old, le->in, le->out,
+									themode, engine->id, compresslevel,
+									kdf_gettime(), le->pw, &le->st)) {
+			le->res = 0;
+			le->recorded = 1;
+			fprintf(stdout, "%s -> %s: unchanged\n", le->in, le->out);
+			continue;
+		}
+		int noted = liststate_begin(le->in, &le->st) == 0;
+		le->res = readwriteloop(le->in, le->out, le->pw, 32, nthreads);
+		le->recorded = !le->res && noted
+						&& liststate_record(le->in, le->out, themode,
+									engine->id, compresslevel, kdf_gettime(),
+									le->pw, &le->st) == 0;
+		fprintf(stdout, "%s -> %s: %s\n", le->in, le->out,
+				(le->res) ? "FAILED" : "ok");
+	}
+	return NULL;
+} // listworker()
+
+void *legacyworker(void *arg)
+{
+	// the legacy batch, then whatever is left of the other entries.
+	listpool *pool = arg;
+	legacy_batch(pool->batch, pool->nbatch, 32, legacyreport);
+	return listworker(arg);
+} // legacyworker()
+
+void legacyreport(const legacyjob *job)
+{
+	// a legacydone for legacy_batch(), as listworker() reports.
+	fprintf(stdout, "%s -> %s: %s\n", job->in, job->out,
+			(job->res) ? "FAILED" : "ok");
+} // legacyreport()
+
+int bysize(const void *a, const void *b)
+{
+	// for qsort(), largest first.
+	const listentry *x = a, *y = b;
+	return (x->size < y->size) - (x->size > y->size);
+} // bysize()
+
+int legacybysize(const void *a, const void *b)
+{
+	const legacyjob *x = a, *y = b;
+	return (x->size < y->size) - (x->size > y->size);
+} // legacybysize()
+
+void runtree(const char *src, const char *dst, const char *pw)
+{
+	/* --tree, on listjobs threads. The other options apply to each
+	 * file as they would to one on its own, but for -j, a file's
+	 * threads being given it by the pool. */
+	treestats st;
+	size_t nfailed = tree_run(src, dst, listjobs, treefile, (void *)pw,
+								&st);
+	fprintf(stdout, "%zu files, %.1f MB, %zu directories, %zu skipped\n",
+			st.files, st.bytes / 1048576.0, st.dirs, st.skipped);
+	if (nfailed) {
+		fprintf(stderr, "%zu files or directories failed\n", nfailed);
 		exit(EXIT_FAILURE);
 	}
-	memset(line, 0 ,80);
-	memcpy(line, bod, eol - bod);
-	eod = line + strlen(line) - 1;
-	// next logic expects that commented stuff and '\t' is all ' '.
-	while(*eod == ' ') eod--;
-	if (wantsts && *eod != '/') {
-		eod++;
-		*eod = '/';
-	}
-	eod++;	// location of '\0'
-	*eod = '\0';
-	strcpy(result, line);
-	prmd.param = result;
-	prmd.nextfrom = eol - 2;	// next search if any may start here.
-	return prmd;
-} // getparam()
-
-void dosystem(const char *cmd)
-{
-    const int status = system(cmd);
-
-    if (status == -1) {
-        fprintf(stderr, "System to execute: %s\n", cmd);
-        exit(EXIT_FAILURE);
-    }
-
-    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
-        fprintf(stderr, "%s failed with non-zero exit\n", cmd);
-        exit(EXIT_FAILURE);
-    }
-    return;
-} // dosystem()
-
-void readwriteloop(const char *infile, const char *outfile,
-					const char *pw, size_t chunksize, size_t ivsize)
-{
-	size_t ifsize;
-	struct stat sb;
-	if (stat(infile, &sb) == -1) {
-		perror(infile);
+} // runtree()
+
+int treefile(const char *in, const char *out, int threads, void *arg)
+{
+	// a treefunc for tree_run(), arg is the pass phrase.
+	return readwriteloop(in, out, arg, 32, threads);
+} // treefile()
+
+void runarchive(const char *infile, const char *outfile, const char *pw)
+{
+	/* --pack, --unpack, --member and --members. Reading an archive
+	 * only decrypts the blocks of it that are wanted. */
+	archive a;
+	const archmember *m;
+	size_t i;
+	int res;
+
+	if (archmode == 'p') {
+		int flags = (debug) ? ENGINE_DEBUG : 0;
+		res = archive_pack(infile, outfile, pw, engine, flags, iobufsize);
+		if (res) {
+			fprintf(stderr, "%d files or directories were left out\n", res);
+			exit(EXIT_FAILURE);
+		}
+		return;
+	}
+	if (archive_open(&a, infile, pw)) {
+		if (errno == EBADMSG) {
+			fprintf(stderr, "%s: not an archive or authentication failed\n",
+					infile);
+		} else {
+			perror(infile);
+		}
 		exit(EXIT_FAILURE);
 	}
-	ifsize = (size_t) sb.st_size - 1;
-	ifsize = (decrypt) ? ifsize - ivsize : ifsize;
+	if (archmode == 'n') {
+		for (i = 0; i < a.n; i++) {
+			fprintf(stdout, "%12llu %s\n", (unsigned long long)a.m[i].len,
+					a.m[i].name);
+		}
+	} else if (archmode == 'm') {
+		int tostdout = strcmp(outfile, "-") == 0;
+		FILE *fpo;
+		m = archive_find(&a, membername);
+		if (!m) {
+			fprintf(stderr, "%s: no member %s\n", infile, membername);
+			exit(EXIT_FAILURE);
+		}
+		fpo = (tostdout) ? stdout : fopen(outfile, "w");
+		if (!fpo) {
+			perror(outfile);
+			exit(EXIT_FAILURE);
+		}
+		res = archive_extract(&a, m, fpo, iobufsize);
+		if (fclose(fpo) == EOF) res = -1;
+		if (res) {
+			if (errno == EBADMSG) {
+				fprintf(stderr, "%s: authentication failed\n", infile);
+			} else {
+				perror(outfile);
+			}
+			if (!tostdout) unlink(outfile);
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		res = archive_unpack(&a, outfile, iobufsize);
+		if (res) {
+			fprintf(stderr, "%d members failed\n", res);
+			exit(EXIT_FAILURE);
+		}
+	}
+	archive_close(&a);
+} // runarchive()
+
+void runstore(const char *infile, const char *outfile, const char *pw)
+{
+	/* --store, a backup of infile to the store and its recipe to
+	 * outfile, or with -d outfile from the recipe infile. */
+	chunkstore s;
+	int tostdout = strcmp(outfile, "-") == 0;
+	FILE *fp;
+
+	store_open(&s, storedir, pw, engine, compresslevel);
+	if (decrypt) {
+		fp = (tostdout) ? stdout : fopen(outfile, "w");
+		if (!fp) {
+			perror(outfile);
+			exit(EXIT_FAILURE);
+		}
+		if (store_restore(&s, infile, fp) || fclose(fp) == EOF) {
+			if (!tostdout) unlink(outfile);
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		fp = (strcmp(infile, "-") == 0) ? stdin : fopen(infile, "r");
+		if (!fp) {
+			perror(infile);
+			exit(EXIT_FAILURE);
+		}
+		(void)store_backup(&s, fp, outfile, iobufsize);
+		fclose(fp);
+		fprintf(stderr, "%zu chunks, %zu new, %.1f MB read, "
+				"%.1f MB stored\n", s.chunks, s.newchunks,
+				s.bytes / 1e6, s.stored / 1e6);
+	}
+	store_close(&s);
+} // runstore()
+
+int readwriteloop(const char *infile, const char *outfile,
+					const char *pw, size_t ivsize, int threads)
+{
+	/* "-" is stdin or stdout. A pipe has no size, so the input is
+	 * read until end of file. Returns 0, or -1 having said why, so
+	 * that a list can go on with its other entries. threads is the
+	 * most the transform of this one file may use. */
+	struct stat sb;
+	int tostdout = strcmp(outfile, "-") == 0;
+	off_t ifsize;
+	const char *why = "authentication failed";
 	// Open the input file
 
-	FILE *fpi = fopen(infile, "r");
-	if(!fpi) {
+	FILE *fpi = (strcmp(infile, "-") == 0) ? stdin : fopen(infile, "r");
+	if(!fpi || fstat(fileno(fpi), &sb) == -1) {
 		perror(infile);
-		exit(EXIT_FAILURE);
+		if (fpi) fclose(fpi);
+		return -1;
 	}
-	FILE *fpo = fopen(outfile, "w");
+	ifsize = (S_ISREG(sb.st_mode)) ? sb.st_size : -1;
+	/* a shared writable mapping needs the file open for reading too,
+	 * and so does --direct, to read back the header block. stdout may
+	 * be write only. */
+	int io = (tostdout) ? 0 : ((usemmap) ? IO_MMAP : 0)
+							| ((usedirect) ? IO_DIRECT : 0);
+	FILE *fpo = (tostdout) ? stdout : fopen(outfile, (io) ? "w+" : "w");
 	if(!fpo) {
 		perror(outfile);
-		exit(EXIT_FAILURE);
+		fclose(fpi);
+		return -1;
 	}
 
-	size_t buflen = chunksize;
-	buflen = (ivsize > chunksize) ? ivsize : chunksize;
-	char *buf = malloc(buflen);
-	size_t pwlen = ivsize + strlen(pw);
-	size_t pwbuflen;
-	char *pwbuf;	// holds hex format sha256sum also.
-	pwbuflen = (pwlen < 64) ? 64 : pwlen;
-	pwbuf = malloc(pwbuflen + 1);
-
+	char *iv = malloc(ivsize);
+	unsigned char hbuf[CRYPT_HDRSIZE];
+	cryptheader hdr;
+	int res = 0;
 	if (decrypt) {
-		size_t x = fread(pwbuf, 1, ivsize, fpi);
-		x++;	// stop gcc bitching
-		//logthisbin(pwbuf, ivsize, "deciv.dat");
+		size_t x = fread(hbuf, 1, CRYPT_HDRSIZE, fpi);
+		const cryptengine *e = NULL;
+		int hres = unpackheader(hbuf, x, &hdr);
+		if (!hres) hres = 2 * readtrailer(fileno(fpi), ifsize, &hdr, iv);
+		if (hres > 0 && !(e = headerengine(&hdr))) {
+			why = "unknown cipher";
+			res = -1;
+		} else if (hres < 0) {
+			why = headerwhy(errno);
+			res = -1;
+		} else if (hres == 1) {
+			x = fread(iv, 1, ivsize, fpi);
+			if (x != ivsize) {
+				why = "truncated header";
+				res = -1;
+			} else {
+				res = streamloop(fpi, fpo, e, &hdr, iv, ivsize, pw,
+									ifsize, threads, io);
+			}
+		} else if (hres == 2) {
+			/* encrypted in place, the data runs from the start of the
+			 * file to the trailer and is read by offset, not to end
+			 * of file. */
+			fseeko(fpi, 0, SEEK_SET);
+			res = streamloop(fpi, fpo, e, &hdr, iv, ivsize, pw,
+						ifsize - CRYPT_HDRSIZE - ivsize, threads, io);
+		} else {
+			// no header, what was read is the start of a legacy IV.
+			memcpy(iv, hbuf, x);
+			x += fread(iv + x, 1, ivsize - x, fpi);
+			if (x != ivsize) {
+				why = "truncated header";
+				res = -1;
+			} else {
+				//logthisbin(iv, ivsize, "deciv.dat");
+				res = streamloop(fpi, fpo, engine_byid(ENGINE_LEGACY),
+									NULL, iv, ivsize, pw, ifsize,
+									threads, io);
+			}
+		}
 	} else {
-		char *np = calc_nonce();
+		char np[CRYPT_IVSIZE];
+		initheader(&hdr);
+		hdr.engine = engine->id;
+		hdr.codec = (compresslevel) ? CRYPT_CODEC_LZ : CRYPT_CODEC_NONE;
+		calc_nonce(np);
+		kdf_prepare(pw, &hdr, np);
+		packheader(&hdr, hbuf);
+		fwrite(hbuf, 1, CRYPT_HDRSIZE, fpo);
 		fwrite(np, 1, ivsize, fpo);	// write the iv out unencrypted.
-		memcpy(pwbuf, np, ivsize);	// memcpy, np may have embedded '\0'
-		//logthisbin(pwbuf, ivsize, "enciv.dat");
+		memcpy(iv, np, ivsize);	// memcpy, np may have embedded '\0'
+		//logthisbin(iv, ivsize, "enciv.dat");
+		res = streamloop(fpi, fpo, engine, &hdr, iv, ivsize, pw,
+							ifsize, threads, io);
 	}
+	free(iv);
+	fclose(fpo);
+	fclose(fpi);
+	if (res) {
+		// don't leave unauthenticated plaintext lying about.
+		fprintf(stderr, "%s: %s\n", infile, why);
+		if (!tostdout) unlink(outfile);
+	}
+	return res;
+} // readwriteloop()
+
+void readrange(const char *infile, const char *outfile, const char *pw)
+{
+	/* --range. The input goes through a creader, so only the blocks
+	 * holding the range are read and decrypted. */
+	creader *r = creader_open(infile, pw, 0);
+	int tostdout = strcmp(outfile, "-") == 0;
+	FILE *fpo;
+	char *buf;
+	uint64_t off = rangeoff, left = rangelen;
+
+	if (!r) {
+		perror(infile);
+		exit(EXIT_FAILURE);
+	}
+	fpo = (tostdout) ? stdout : fopen(outfile, "w");
+	if (!fpo) {
+		perror(outfile);
+		exit(EXIT_FAILURE);
+	}
+	buf = iobuffer(iobufsize);
+	while (left) {
+		size_t n = (left < iobufsize) ? left : iobufsize;
+		ssize_t got = creader_pread(r, buf, n, off);
+		if (got == -1) {
+			if (errno == EBADMSG) {
+				fprintf(stderr, "%s: authentication failed\n", infile);
+			} else {
+				perror(infile);
+			}
+			if (!tostdout) unlink(outfile);
+			exit(EXIT_FAILURE);
+		}
+		if (!got) break;
+		if (fwrite(buf, 1, got, fpo) != (size_t)got) {
+			perror("fwrite");
+			exit(EXIT_FAILURE);
+		}
+		off += got;
+		left -= got;
+	}
+	free(buf);
+	fclose(fpo);
+	creader_close(r);
+} // readrange()
+
+void parserange(const char *s)
+{
+	// offset[:length], each with an optional K, M or G suffix.
+	char *copy = strdup(s), *colon = strchr(copy, ':');
+	if (colon) *colon = '\0';
+	rangeoff = (strcmp(copy, "0") == 0) ? 0 : parsesize(copy);
+	rangelen = (colon) ? parsesize(colon + 1) : UINT64_MAX;
+	free(copy);
+} // parserange()
 
-	strcpy(pwbuf+ivsize, pw);	// initial key.
-	/*
-	if (decrypt){
-		logthisbin(pwbuf, pwlen, "decivpw.dat");
+int streamloop(FILE *fpi, FILE *fpo, const cryptengine *e,
+				const cryptheader *hdr, const char *iv, size_t ivsize,
+				const char *pw, off_t ifsize, int threads, int io)
+{
+	/* The input is processed in segments and the loop ends on end of
+	 * file rather than a precomputed size. For the seekable engines
+	 * the segments depend only on the key and their own position, so
+	 * with more than one thread the rest of the input is handed to
+	 * paralleltransform() instead, each thread working on its own
+	 * segments at their own offsets.
+	 * hdr is NULL for the legacy format. ifsize is -1 when the input
+	 * is a pipe, which like a pipe for output leaves only segloop().
+	 * A file encrypted in place is read up to its trailer.
+	 * Returns 0, or -1 if a segment fails to authenticate.
+	*/
+	segjob job;
+	int res;
+	int flags = (decrypt) ? ENGINE_DECRYPT : 0;
+	int threaded = threads > 1 && !debug && (e->props & ENGINE_SEEKABLE);
+	uint64_t limit = UINT64_MAX;
+	if (debug) flags |= ENGINE_DEBUG;
+	if (hdr && (hdr->flags & CRYPT_TRAILER)) limit = ifsize - ftello(fpi);
+
+	if (hdr && hdr->codec) {
+		cryptctx c;
+		if (ctx_init(&c, e, hdr, pw, iv, ivsize, flags)) return -1;
+		return lzloop(fpi, fpo, &c, limit);
+	}
+	if (ifsize < 0 || !regularfile(fpo)
+		|| !(io || uringdepth || threaded)) {
+		cryptctx c;
+		if (ctx_init(&c, e, hdr, pw, iv, ivsize, flags)) return -1;
+		return segloop(fpi, fpo, &c, limit, ifsize);
+	}
+	if (engine_setup(&job, e, hdr, iv, ivsize, pw, flags)) return -1;
+	if (io & IO_MMAP) {
+		res = maploop(fpi, fpo, &job, e, ifsize, threads);
+	} else if (io & IO_DIRECT) {
+		res = directloop(fpi, fpo, &job, e, ifsize);
+	} else if (uringdepth) {
+		res = uringloop(fpi, fpo, &job, e, ifsize);
 	} else {
-		logthisbin(pwbuf, pwlen, "encivpw.dat");
+		filejob(fpi, fpo, &job, e, ifsize);
+		res = paralleltransform(&job, threads);
 	}
+	engine_finish(&job, e);
+	return res;
+} // streamloop()
+
+int maploop(FILE *fpi, FILE *fpo, segjob *job, const cryptengine *e,
+			off_t ifsize, int threads)
+{
+	/* --mmap. The input is mapped read only, the output is extended to
+	 * its final size and mapped read write, and the segments go from
+	 * one mapping to the other, on as many threads as the engine
+	 * allows. Nothing passes through stdio buffers.
 	*/
+	size_t inmaplen, outmaplen;
+	char *inmap = NULL, *outmap = NULL;
+	static char empty[1];	// stands in for a zero length mapping.
+	int res;
 
-	unsigned char brp[32];
-	void *binresult = brp;
-	size_t totalout = 0;
-	(void)calcsha256sum(pwbuf, pwlen, pwbuf, binresult);
-	while(1) {
-		if(debug) fprintf(stderr, "%s\n", pwbuf);
-		size_t bytesread = fread(buf, 1, chunksize, fpi);
-		size_t i = 0;
-		for(; i < chunksize; i++){
-			buf[i] ^= brp[i];
-		}
-		fwrite(buf, 1, bytesread, fpo);
-		totalout += bytesread;
-		/* It does not matter when bytesread < chunksize, we just
-		 * encrypt a few bytes of garbage in buf beyond the file end,
-		 * but only the number of bytes read in get written. */
-		if (totalout > ifsize) break;
-		(void)calcsha256sum(pwbuf, 64, pwbuf, binresult);
+	filejob(fpi, fpo, job, e, ifsize);
+	// every segment grows or shrinks by the same amount.
+	if (job->outseg < job->inseg
+		&& job->len < job->nsegs * (job->inseg - job->outseg)) {
+		return -1;	// too short to hold the tags.
 	}
+	outmaplen = job->outoff + job->len + job->nsegs * job->outseg
+				- job->nsegs * job->inseg;
+	inmaplen = job->inoff + job->len;
+
+	if (job->len) {
+		inmap = mmap(NULL, inmaplen, PROT_READ, MAP_SHARED, job->fdi, 0);
+		if (inmap == MAP_FAILED) {
+			perror("mmap input");
+			exit(EXIT_FAILURE);
+		}
+		(void)madvise(inmap, inmaplen, MADV_SEQUENTIAL);
+		(void)madvise(inmap, inmaplen, MADV_HUGEPAGE);	// a hint, may fail
+	}
+	if (ftruncate(job->fdo, outmaplen) == -1) {
+		perror("ftruncate");
+		exit(EXIT_FAILURE);
+	}
+	if (outmaplen) {
+		outmap = mmap(NULL, outmaplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+						job->fdo, 0);
+		if (outmap == MAP_FAILED) {
+			perror("mmap output");
+			exit(EXIT_FAILURE);
+		}
+		(void)madvise(outmap, outmaplen, MADV_SEQUENTIAL);
+		(void)madvise(outmap, outmaplen, MADV_HUGEPAGE);
+	}
+
+	job->inmap = (inmap) ? inmap : "";
+	job->outmap = (outmap) ? outmap : empty;
+	if (!(e->props & ENGINE_SEEKABLE) || debug) threads = 1;
+	res = paralleltransform(job, threads);
+	if (outmap) munmap(outmap, outmaplen);
+	if (inmap) munmap(inmap, inmaplen);
+	// the output stream is at the end of the file for fclose().
+	fseeko(fpo, 0, SEEK_END);
+	return res;
+} // maploop()
+
+void filejob(FILE *fpi, FILE *fpo, segjob *job, const cryptengine *e,
+				off_t ifsize)
+{
+	/* Fills in the file side of job for the loops that read and write
+	 * the descriptors at explicit offsets, from the current positions
+	 * of the two streams on. */
+	job->inoff = ftello(fpi);
+	fflush(fpo);
+	job->outoff = ftello(fpo);
+	job->fdi = fileno(fpi);
+	job->fdo = fileno(fpo);
+	job->len = (ifsize > job->inoff) ? ifsize - job->inoff : 0;
+	job->nsegs = (job->len + job->inseg - 1) / job->inseg;
+	// authenticated streams always have a final segment.
+	if (!job->nsegs && (e->props & ENGINE_AEAD)) job->nsegs = 1;
+} // filejob()
+
+int uringloop(FILE *fpi, FILE *fpo, segjob *job, const cryptengine *e,
+				off_t ifsize)
+{
+	/* --uring. uringdepth pairs of input and output buffers are
+	 * registered with the ring. Reads run ahead into every free pair,
+	 * each buffer is transformed in order as soon as its read is in
+	 * and its write is queued at once, so the device has requests in
+	 * flight while the cpu works on the next buffer. A pair is free
+	 * again when its write completes.
+	*/
+	enum { FREE, READING, READY, WRITING };
+	typedef struct urslot {
+		int state;
+		uint64_t chunk;
+		size_t want, done;
+	} urslot;
+	size_t nseg = iobufsize / job->inseg;
+	if (!nseg) nseg = 1;
+	size_t inbuf = nseg * job->inseg;
+	size_t outbuf = nseg * job->outseg;
+	size_t bufsize = (inbuf > outbuf) ? inbuf : outbuf;
+	unsigned depth = uringdepth, i, inflight = 0;
+	char **bufs = malloc(2 * depth * sizeof(char *));
+	urslot *slot = calloc(depth, sizeof(urslot));
+	uint64_t nchunks, nextread = 0, nextxform = 0, written = 0;
+	uring u;
+	int res = 0;
+
+	if (!bufs || !slot) {
+		perror("malloc failure in uringloop()");
+		exit(EXIT_FAILURE);
+	}
+	filejob(fpi, fpo, job, e, ifsize);
+	nchunks = (job->nsegs + nseg - 1) / nseg;
+	for (i = 0; i < 2 * depth; i++) bufs[i] = iobuffer(bufsize);
+	// input buffer i is registered as i, output buffer i as depth + i.
+	uring_init(&u, depth, bufs, 2 * depth, bufsize);
+	if (debug) fprintf(stderr, "I/O: %s, depth %u\n",
+						uring_implname(&u), depth);
+
+	while (written < nchunks) {
+		urslot *s;
+		uint64_t tag;
+		ssize_t n;
+		// fill every free pair with the next read.
+		while (!res && nextread < nchunks
+				&& slot[nextread % depth].state == FREE) {
+			s = &slot[nextread % depth];
+			s->chunk = nextread++;
+			s->want = job->len - s->chunk * inbuf;
+			if (s->want > inbuf) s->want = inbuf;
+			s->done = 0;
+			if (s->want) {
+				uring_read(&u, job->fdi, s - slot, bufs[s - slot],
+							s->want, job->inoff + s->chunk * inbuf, s - slot);
+				s->state = READING;
+				inflight++;
+			} else {
+				s->state = READY;	// the empty authenticated stream.
+			}
+		}
+		uring_submit(&u);
+		s = &slot[nextxform % depth];
+		if (!res && nextxform < nchunks && s->state == READY) {
+			char *in = bufs[s - slot], *out = bufs[depth + (s - slot)];
+			uint64_t segno = s->chunk * nseg;
+			size_t off = 0, outlen = 0;
+			do {
+				size_t len = s->want - off, got;
+				if (len > job->inseg) len = job->inseg;
+				if (job->fn(job->ctx, segno, in + off, len, out + outlen,
+							&got, segno + 1 == job->nsegs)) {
+					res = -1;
+					break;
+				}
+				segno++;
+				off += len;
+				outlen += got;
+			} while (off < s->want);
+			if (res) continue;	// drain what is in flight.
+			s->want = outlen;
+			s->done = 0;
+			nextxform++;
+			if (outlen) {
+				uring_write(&u, job->fdo, depth + (s - slot), out, outlen,
+						job->outoff + s->chunk * outbuf, s - slot);
+				s->state = WRITING;
+				inflight++;
+			} else {
+				s->state = FREE;
+				written++;
+			}
+			continue;
+		}
+		if (!inflight) break;
+		// nothing to transform yet, wait for the device.
+		n = uring_wait(&u, &tag);
+		inflight--;
+		s = &slot[tag];
+		if (n < 0) {
+			errno = -n;
+			perror((s->state == READING) ? "read" : "write");
+			exit(EXIT_FAILURE);
+		}
+		if (n == 0) {
+			fputs("Unexpected end of file\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		s->done += n;
+		if (s->done < s->want) {	// short, ask for the rest.
+			char *buf = bufs[(s->state == READING) ? tag : depth + tag];
+			if (s->state == READING) {
+				uring_read(&u, job->fdi, tag, buf + s->done,
+						s->want - s->done,
+						job->inoff + s->chunk * inbuf + s->done, tag);
+			} else {
+				uring_write(&u, job->fdo, depth + tag, buf + s->done,
+						s->want - s->done,
+						job->outoff + s->chunk * outbuf + s->done, tag);
+			}
+			inflight++;
+		} else if (s->state == READING) {
+			s->state = READY;
+		} else {
+			s->state = FREE;
+			written++;
+		}
+	}
+	uring_free(&u);
+	for (i = 0; i < 2 * depth; i++) free(bufs[i]);
+	free(bufs);
+	free(slot);
+	// the output stream is at the end of the file for fclose().
+	fseeko(fpo, 0, SEEK_END);
+	return res;
+} // uringloop()
+
+int directloop(FILE *fpi, FILE *fpo, segjob *job, const cryptengine *e,
+				off_t ifsize)
+{
+	/* --direct. Both descriptors are switched to O_DIRECT, which wants
+	 * file offsets, lengths and buffers in whole DIRECTALIGN blocks.
+	 * So each input buffer is read from the start of the block that
+	 * holds it and the bytes before it skipped, and the output is
+	 * gathered in a buffer that begins on a block boundary: the block
+	 * holding the header is read back into it first, whole blocks are
+	 * written as they fill, and the part block left at the end is
+	 * written once O_DIRECT is cleared. Where the file system refuses
+	 * O_DIRECT the same transfers go through the cache and the pages
+	 * are dropped behind them.
+	*/
+	size_t nseg = iobufsize / job->inseg;
+	if (!nseg) nseg = 1;
+	size_t inbuf = nseg * job->inseg;
+	size_t mask = DIRECTALIGN - 1;
+	char *in = iobuffer(((inbuf + mask) & ~mask) + DIRECTALIGN);
+	char *out = iobuffer(((nseg * job->outseg + mask) & ~mask)
+							+ DIRECTALIGN);
+	uint64_t segno = 0, pos;
+	off_t opos;
+	size_t ofill;
+	int direct, res = 0;
+
+	filejob(fpi, fpo, job, e, ifsize);
+	opos = job->outoff & ~(off_t)mask;
+	ofill = job->outoff - opos;
+	if (pread(job->fdo, out, ofill, opos) != (ssize_t)ofill) {
+		perror("read back header");
+		exit(EXIT_FAILURE);
+	}
+	direct = setdirect(job->fdi, 1) == 0;
+	direct = setdirect(job->fdo, 1) == 0 && direct;
+	if (debug) fprintf(stderr, "I/O: %s\n",
+					(direct) ? "O_DIRECT" : "cached, pages dropped");
+
+	for (pos = 0; segno < job->nsegs; pos += inbuf) {
+		off_t start = job->inoff + pos;
+		off_t ipos = start & ~(off_t)mask;
+		size_t want = job->len - pos, skip = start - ipos, got = 0;
+		size_t off = 0, outlen;
+		if (want > inbuf) want = inbuf;
+		while (got < skip + want) {
+			ssize_t n = pread(job->fdi, in + got,
+					(skip + want - got + mask) & ~mask, ipos + got);
+			if (n == -1 && errno == EINTR) continue;
+			if (n <= 0) {
+				if (n) perror("read");
+				else fputs("Unexpected end of file\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+			got += n;
+		}
+		if (!direct) dropcache(job->fdi, ipos, got, 0);
+		do {
+			size_t len = want - off;
+			if (len > job->inseg) len = job->inseg;
+			if (job->fn(job->ctx, segno, in + skip + off, len,
+						out + ofill, &outlen, segno + 1 == job->nsegs)) {
+				res = -1;
+				goto done;
+			}
+			segno++;
+			off += len;
+			ofill += outlen;
+		} while (off < want);
+		// write the whole blocks, keep the part block for next time.
+		outlen = ofill & ~mask;
+		if (outlen) {
+			size_t put = 0;
+			while (put < outlen) {
+				ssize_t n = pwrite(job->fdo, out + put, outlen - put,
+									opos + put);
+				if (n == -1 && errno == EINTR) continue;
+				if (n <= 0) {
+					perror("write");
+					exit(EXIT_FAILURE);
+				}
+				put += n;
+			}
+			if (!direct) dropcache(job->fdo, opos, outlen, 1);
+			memmove(out, out + outlen, ofill - outlen);
+			opos += outlen;
+			ofill -= outlen;
+		}
+	}
+	setdirect(job->fdo, 0);
+	if (ofill && pwrite(job->fdo, out, ofill, opos) != (ssize_t)ofill) {
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+	dropcache(job->fdo, opos, ofill, 1);
+done:
+	setdirect(job->fdi, 0);
+	setdirect(job->fdo, 0);
+	free(in);
+	free(out);
+	// the output stream is at the end of the file for fclose().
+	fseeko(fpo, 0, SEEK_END);
+	return res;
+} // directloop()
+
+int setdirect(int fd, int on)
+{
+	// Sets or clears O_DIRECT on fd. Returns -1 if it is refused.
+	int fl = fcntl(fd, F_GETFL);
+	if (fl == -1) return -1;
+	fl = (on) ? fl | O_DIRECT : fl & ~O_DIRECT;
+	return fcntl(fd, F_SETFL, fl);
+} // setdirect()
+
+void dropcache(int fd, off_t off, size_t len, int written)
+{
+	/* Drops the cached pages of a range, written data is put on disk
+	 * first since dirty pages cannot be dropped. */
+	if (!len) return;
+	if (written) {
+		(void)sync_file_range(fd, off, len, SYNC_FILE_RANGE_WAIT_BEFORE
+						| SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	}
+	(void)posix_fadvise(fd, off, len, POSIX_FADV_DONTNEED);
+} // dropcache()
+
+int segloop(FILE *fpi, FILE *fpo, cryptctx *c, uint64_t limit,
+				off_t ifsize)
+{
+	/* Single threaded, through the streaming interface, which is
+	 * finished with here. The file is
+	 * read iobufsize bytes at a time, as many whole segments as fit,
+	 * into aligned buffers, until end of file so the input can be a
+	 * pipe. No more than limit bytes are read. A file known, by
+	 * ifsize, to be smaller than that gets buffers of its own size,
+	 * which matters when a tree has millions of them.
+	*/
+	size_t nseg = iobufsize / c->job.inseg;
+	if (ifsize >= 0 && (uint64_t)ifsize < iobufsize) {
+		nseg = ifsize / c->job.inseg + 1;	// + 1 to see end of file.
+	}
+	if (!nseg) nseg = 1;
+	size_t inbuf = nseg * c->job.inseg;
+	size_t outbuf = ctx_outsize(c, inbuf);
+	char *in = iobuffer(inbuf);
+	char *out = iobuffer(outbuf);
+	size_t inlen, outlen;
+	int res = 0, last;
+
+	do {
+		size_t want = (limit < inbuf) ? limit : inbuf;
+		inlen = readfull(in, want, fpi);
+		limit -= inlen;
+		last = inlen < want || !limit;
+		res = ctx_update(c, in, inlen, out, &outlen);
+		if (res || last) {	// ctx_final() frees c either way.
+			size_t n;
+			if (ctx_final(c, out + outlen, &n)) res = -1;
+			outlen += n;
+			last = 1;
+		}
+		if (res) break;
+		if (fwrite(out, 1, outlen, fpo) != outlen) {
+			perror("fwrite");
+			exit(EXIT_FAILURE);
+		}
+	} while (!last);
+	free(out);
+	free(in);
+	return res;
+} // segloop()
+
+int lzloop(FILE *fpi, FILE *fpo, cryptctx *c, uint64_t limit)
+{
+	/* --compress, and decrypting what it made. The plain text goes to
+	 * or comes from the streaming interface, which is finished with
+	 * here, as LZ_BLOCK frames, see lz.h, read and written iobufsize
+	 * bytes or so at a time. Sizes in the file no longer follow those
+	 * of the plain text, so this is the one pass on one thread
+	 * whatever else was asked for.
+	*/
+	size_t nblk = iobufsize / LZ_BLOCK, inbuf, fsize, nf = 0, outlen;
+	char *in, *fbuf, *out = NULL, *raw = NULL;
+	lzstate z;
+	int res = 0, last;
+
+	if (!nblk) nblk = 1;
+	inbuf = nblk * LZ_BLOCK;
+	if (decrypt) {
+		// what is left of a frame and what one update can add.
+		fsize = lz_bound(LZ_BLOCK) + ctx_outsize(c, inbuf)
+				+ c->job.outseg;
+		raw = iobuffer(LZ_BLOCK);
+	} else {
+		// the frames of inbuf and what they become.
+		fsize = nblk * lz_bound(LZ_BLOCK);
+		lz_init(&z, compresslevel);
+	}
+	in = iobuffer(inbuf);
+	fbuf = iobuffer(fsize);
+	if (!decrypt) out = iobuffer(ctx_outsize(c, fsize) + c->job.outseg);
+	do {
+		size_t want = (limit < inbuf) ? limit : inbuf;
+		size_t inlen = readfull(in, want, fpi), n;
+		limit -= inlen;
+		last = inlen < want || !limit;
+		if (decrypt) {
+			res = ctx_update(c, in, inlen, fbuf + nf, &outlen);
+			if (res || last) {
+				if (ctx_final(c, fbuf + nf + outlen, &n)) res = -1;
+				outlen += n;
+				last = 1;
+			}
+			nf += outlen;
+			if (!res) res = unframe(fbuf, &nf, raw, fpo);
+			if (!res && last && nf) res = -1;	// cut short.
+		} else {
+			for (n = 0; n < inlen; n += LZ_BLOCK) {
+				size_t blk = (inlen - n < LZ_BLOCK) ? inlen - n : LZ_BLOCK;
+				nf += lz_frame(&z, in + n, blk, fbuf + nf);
+			}
+			(void)ctx_update(c, fbuf, nf, out, &outlen);
+			nf = 0;
+			if (last) {
+				(void)ctx_final(c, out + outlen, &n);
+				outlen += n;
+			}
+			if (fwrite(out, 1, outlen, fpo) != outlen) {
+				perror("fwrite");
+				exit(EXIT_FAILURE);
+			}
+		}
+	} while (!last && !res);
+	if (!last) (void)ctx_final(c, fbuf, &outlen);	// a corrupt frame.
+	if (!decrypt) lz_free(&z);
+	free(out);
+	free(raw);
+	free(fbuf);
+	free(in);
+	return res;
+} // lzloop()
+
+int unframe(char *fbuf, size_t *nf, char *raw, FILE *fpo)
+{
+	/* Writes out the whole frames of the *nf bytes at fbuf and moves
+	 * what is left of the next to the front. -1 if one is corrupt. */
+	size_t pos = 0, len;
+	while (*nf - pos >= LZ_FRAMEHDR) {
+		ssize_t flen = lz_framelen(fbuf + pos);
+		if (flen == -1) return -1;
+		if ((size_t)flen > *nf - pos) break;
+		if (lz_unframe(fbuf + pos, raw, &len)) return -1;
+		if (fwrite(raw, 1, len, fpo) != len) {
+			perror("fwrite");
+			exit(EXIT_FAILURE);
+		}
+		pos += flen;
+	}
+	memmove(fbuf, fbuf + pos, *nf - pos);
+	*nf -= pos;
+	return 0;
+} // unframe()
+
+int regularfile(FILE *fp)
+{
+	// 1 for a regular file, 0 for a pipe, socket, terminal etc.
+	struct stat sb;
+	return fstat(fileno(fp), &sb) == 0 && S_ISREG(sb.st_mode);
+} // regularfile()
+
+int memtransform(const segjob *job, const char *in, size_t len,
+					char *out, size_t *outlen)
+{
+	/* The in memory equivalent of segloop(). out must have room for
+	 * the transformed segments. */
+	uint64_t segno, nsegs = (len + job->inseg - 1) / job->inseg;
+	if (!nsegs) nsegs = 1;
+	*outlen = 0;
+	for (segno = 0; segno < nsegs; segno++) {
+		size_t n = len - segno * job->inseg, got;
+		if (n > job->inseg) n = job->inseg;
+		if (job->fn(job->ctx, segno, in + segno * job->inseg, n,
+					out + segno * job->outseg, &got,
+					segno == nsegs - 1)) return -1;
+		*outlen += got;
+	}
+	return 0;
+} // memtransform()
+
+char *iobuffer(size_t size)
+{
+	// page aligned, the size rounded up to suit aligned_alloc().
+	char *buf = aligned_alloc(4096, (size + 4095) & ~(size_t)4095);
+	if (!buf) {
+		perror("malloc failure in iobuffer()");
+		exit(EXIT_FAILURE);
+	}
+	return buf;
+} // iobuffer()
+
+size_t readfull(char *buf, size_t len, FILE *fp)
+{
+	// fread() until len bytes or end of file.
+	size_t got = 0;
+	while (got < len) {
+		size_t n = fread(buf + got, 1, len - got, fp);
+		if (!n) {
+			if (ferror(fp)) {
+				perror("fread");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		got += n;
+	}
+	return got;
+} // readfull()
+
+size_t parsesize(const char *s)
+{
+	/* A byte count with an optional K, M or G suffix. Fatal if it is
+	 * not a number. */
+	char *end;
+	unsigned long long v = strtoull(s, &end, 10);
+	if (end == s) goto bad;
+	switch (toupper((unsigned char)*end)) {
+		case 'G':
+		v *= 1024;
+		// fall through
+		case 'M':
+		v *= 1024;
+		// fall through
+		case 'K':
+		v *= 1024;
+		end++;
+		break;
+		case '\0':
+		break;
+		default:
+		goto bad;
+	}
+	if (*end || !v) goto bad;
+	return (size_t)v;
+bad:
+	fprintf(stderr, "Illegal size: %s\n", s);
+	exit(EXIT_FAILURE);
+} // parsesize()
+
+const cryptengine *headerengine(const cryptheader *hdr)
+{
+	// the engine recorded in a version 2 header, NULL if unknown.
+	const cryptengine *e = engine_byid(hdr->engine);
+	if (!e || e->id == ENGINE_LEGACY) return NULL;
+	return e;
+} // headerengine()
 
-} // readwriteloop()
 
 /* Un-comment to use this.
 void logthisbin(void *buf, size_t size, const char *fn)
@@ -0,0 +1,119 @@
+/*      cryptctx.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "cryptctx.h"
+
+static int flush(cryptctx *c, const char *in, size_t len, char *out,
+					size_t *outlen, int final);
+
+int ctx_init(cryptctx *c, const cryptengine *e, const cryptheader *hdr,
+				const char *key, const char *iv, size_t ivsize,
+				int flags)
+{
+	/* key is the pass phrase, flags the ENGINE_ flags. hdr may be
+	 * NULL for the legacy engine. Returns 0, or -1 with errno set if
+	 * hdr names a key derivation not known here or a segment too big
+	 * to hold, when there is nothing for ctx_final() to do. */
+	memset(c, 0, sizeof(cryptctx));
+	c->e = e;
+	if (engine_setup(&c->job, e, hdr, iv, ivsize, key, flags)) return -1;
+	c->pending = malloc(c->job.inseg);
+	if (!c->pending) {
+		engine_finish(&c->job, e);
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+} // ctx_init()
+
+size_t ctx_outsize(const cryptctx *c, size_t len)
+{
+	/* The most that ctx_update() of len bytes and a ctx_final() after
+	 * it can write between them. */
+	return ((c->npending + len) / c->job.inseg + 1) * c->job.outseg;
+} // ctx_outsize()
+
+int ctx_update(cryptctx *c, const char *in, size_t len, char *out,
+				size_t *outlen)
+{
+	/* Transforms every whole segment of input that is known not to
+	 * be the last and sets *outlen to the bytes written. Returns 0, or
+	 * -1 if a segment fails to authenticate. Segments are taken
+	 * straight from in where they can be, only the held back part is
+	 * copied. */
+	size_t inseg = c->job.inseg, got;
+	*outlen = 0;
+	if (c->failed) return -1;
+	while (len) {
+		if (c->npending == inseg) {	// and there is more, so not last.
+			if (flush(c, c->pending, inseg, out, &got, 0)) return -1;
+			c->npending = 0;
+			out += got;
+			*outlen += got;
+		}
+		if (!c->npending && len > inseg) {
+			if (flush(c, in, inseg, out, &got, 0)) return -1;
+			in += inseg;
+			len -= inseg;
+			out += got;
+			*outlen += got;
+			continue;
+		}
+		got = inseg - c->npending;
+		if (got > len) got = len;
+		memcpy(c->pending + c->npending, in, got);
+		c->npending += got;
+		in += got;
+		len -= got;
+	}
+	return 0;
+} // ctx_update()
+
+int ctx_final(cryptctx *c, char *out, size_t *outlen)
+{
+	/* Transforms the held back input as the last segment and frees
+	 * the context, whatever the result. Returns 0, or -1 if the last
+	 * segment fails to authenticate. An authenticated stream always
+	 * has a last segment, even an empty one. */
+	int res = (c->failed) ? -1 : 0;
+	*outlen = 0;
+	if (!res && (c->npending || (c->e->props & ENGINE_AEAD))) {
+		res = flush(c, c->pending, c->npending, out, outlen, 1);
+	}
+	engine_finish(&c->job, c->e);
+	memset(c->pending, 0, c->job.inseg);
+	free(c->pending);
+	memset(c, 0, sizeof(cryptctx));
+	return res;
+} // ctx_final()
+
+int flush(cryptctx *c, const char *in, size_t len, char *out,
+			size_t *outlen, int final)
+{
+	if (c->job.fn(c->job.ctx, c->segno++, in, len, out, outlen, final)) {
+		c->failed = 1;
+		return -1;
+	}
+	return 0;
+} // flush()
@@ -0,0 +1,66 @@
+/*
+ * cryptctx.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _CRYPTCTX_H
+# define _CRYPTCTX_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "engine.h"
+#include "cryptheader.h"
+
+/* The streaming interface of libcryptstream, for programs that
+ * encrypt or decrypt in process rather than running crypt. A cryptctx
+ * holds all there is to a stream. The only other state the library
+ * keeps is kdf.c's, the kdf_settime() setting and a cache of the keys
+ * derived so far, found by a hash of the pass phrase, salt and count,
+ * which is locked and is wiped by kdf_forget(). So any number of
+ * streams can run at once on different threads.
+ * Nothing in the library exits or prints on bad input. A header that
+ * can't be used, an unknown key derivation, a segment too big to
+ * hold or one that fails to authenticate is returned as an error. It
+ * still exits, having said why, if memory or threads run out
+ * elsewhere or a self test fails.
+ * Input goes to ctx_update() in pieces of any size. A segment is only
+ * transformed once more input shows that it is not the last, so up to
+ * a segment is held back, and ctx_final() does the last one and
+ * frees the context, also after a failure. The
+ * header and the IV are the caller's to write or read, see
+ * cryptheader.h and calc_nonce.h, and a new one should be given to
+ * kdf_prepare() before it is written, see kdf.h.
+*/
+typedef struct cryptctx {
+	const cryptengine *e;
+	segjob job;
+	uint64_t segno;
+	char *pending;		// input held back, up to a segment.
+	size_t npending;
+	int failed;			// a segment failed to authenticate.
+} cryptctx;
+
+int ctx_init(cryptctx *c, const cryptengine *e, const cryptheader *hdr,
+				const char *key, const char *iv, size_t ivsize,
+				int flags);
+size_t ctx_outsize(const cryptctx *c, size_t len);
+int ctx_update(cryptctx *c, const char *in, size_t len, char *out,
+				size_t *outlen);
+int ctx_final(cryptctx *c, char *out, size_t *outlen);
+
+#endif
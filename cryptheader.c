@@ -0,0 +1,118 @@
+/*      cryptheader.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <errno.h>
+#include "cryptheader.h"
+#include "kdf.h"
+
+void initheader(cryptheader *hdr)
+{
+	memset(hdr, 0, sizeof(cryptheader));
+	hdr->version = CRYPT_VERSION;
+	hdr->engine = ENGINE_SHA256CTR;
+	hdr->segshift = CRYPT_SEGSHIFT;
+} // initheader()
+
+void packheader(const cryptheader *hdr, unsigned char *buf)
+{
+	/* buf must hold CRYPT_HDRSIZE bytes. */
+	int i;
+	memset(buf, 0, CRYPT_HDRSIZE);
+	memcpy(buf, CRYPT_MAGIC, CRYPT_MAGICLEN);
+	buf[6] = (hdr->version > 3 && !hdr->codec) ? 3 : hdr->version;
+	buf[7] = hdr->engine;
+	buf[8] = hdr->segshift;
+	buf[9] = hdr->flags;
+	buf[10] = hdr->kdf;
+	for (i = 0; i < 4; i++) buf[11 + i] = hdr->kdfcost >> (8 * i);
+	buf[15] = hdr->codec;
+} // packheader()
+
+int unpackheader(const unsigned char *buf, size_t len, cryptheader *hdr)
+{
+	/* Returns 1 and fills in hdr if buf starts with a version 2 or
+	 * later header, 0 if it does not, in which case the data is the
+	 * legacy chained format. Returns -1 for a header that can't be
+	 * used, with errno ENOTSUP if it is from a newer version of crypt,
+	 * whose layout can't be known here, or EINVAL if a field is out
+	 * of range. Nothing is printed, see headerwhy().
+	*/
+	int i;
+	if (len < CRYPT_HDRSIZE) return 0;
+	if (memcmp(buf, CRYPT_MAGIC, CRYPT_MAGICLEN) != 0) return 0;
+	if (buf[6] > CRYPT_VERSION) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	initheader(hdr);
+	hdr->version = buf[6];
+	hdr->engine = buf[7];
+	hdr->segshift = buf[8];
+	hdr->flags = buf[9];
+	if (hdr->version >= 3) {	// version 2 has no key derivation.
+		hdr->kdf = buf[10];
+		for (i = 0; i < 4; i++) {
+			hdr->kdfcost |= (uint32_t)buf[11 + i] << (8 * i);
+		}
+		if (hdr->kdf > KDF_PBKDF2 || (hdr->kdf && (!hdr->kdfcost
+			|| hdr->kdfcost > KDF_MAXCOST))) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (hdr->version >= 4) {
+		hdr->codec = buf[15];
+		if (hdr->codec > CRYPT_CODEC_LZ) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (hdr->engine != ENGINE_SHA256CTR
+		&& (hdr->segshift < 10 || hdr->segshift > 30)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 1;
+} // unpackheader()
+
+const char *headerwhy(int err)
+{
+	// What to say of a header that unpackheader() refused with err.
+	return (err == ENOTSUP) ? "unsupported file format version"
+							: "bad header";
+} // headerwhy()
+
+int readtrailer(int fd, off_t size, cryptheader *hdr, char *iv)
+{
+	/* Returns 1 if the file of size bytes open on fd was encrypted in
+	 * place, filling in hdr and the CRYPT_IVSIZE bytes at iv from the
+	 * end of it. Returns 0 otherwise, or -1 as unpackheader() does if
+	 * the trailer is a header that can't be used. */
+	unsigned char buf[CRYPT_HDRSIZE + CRYPT_IVSIZE];
+	int res;
+	if (size < (off_t)sizeof(buf)) return 0;
+	if (pread(fd, buf, sizeof(buf), size - sizeof(buf))
+		!= (ssize_t)sizeof(buf)) return 0;
+	res = unpackheader(buf, CRYPT_HDRSIZE, hdr);
+	if (res <= 0) return res;
+	if (!(hdr->flags & CRYPT_TRAILER)) return 0;
+	memcpy(iv, buf + CRYPT_HDRSIZE, CRYPT_IVSIZE);
+	return 1;
+} // readtrailer()
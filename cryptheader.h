@@ -0,0 +1,84 @@
+/*
+ * cryptheader.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _CRYPTHEADER_H
+# define _CRYPTHEADER_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Files written by crypt from version 2 on start with a fixed size
+ * header followed by the IV. Files written before that (the legacy
+ * chained format) start directly with the 32 byte IV and are
+ * recognised by the absence of the magic.
+ * Header layout:
+ *   0..5  magic "CRYPT\x1a"
+ *   6     format version
+ *   7     keystream engine
+ *   8     log2 of the segment size for the authenticated engines
+ *   9     flags
+ *   10    key derivation, from version 3, see kdf.h
+ *   11..14 its iteration count, little endian
+ *   15    compression, from version 4, see lz.h.
+ * A file that isn't compressed is still written as version 3 so that
+ * the crypt before compression can read it.
+ * A file encrypted in place (crypt -i) keeps its length, so the header
+ * and IV go at the end of the file instead, with CRYPT_TRAILER set.
+*/
+#define CRYPT_MAGIC		"CRYPT\x1a"
+#define CRYPT_MAGICLEN	6
+#define CRYPT_HDRSIZE	16
+#define CRYPT_VERSION	4
+#define CRYPT_IVSIZE	32
+#define CRYPT_TRAILER	1	// header flag, see above.
+
+enum {
+	ENGINE_SHA256CTR = 0,
+	ENGINE_AES256GCM = 1,
+	ENGINE_CHACHA20POLY1305 = 2
+};
+
+enum {
+	CRYPT_CODEC_NONE = 0,
+	CRYPT_CODEC_LZ = 1
+};
+
+#define CRYPT_SEGSHIFT	16	// 64 KiB segments by default.
+
+typedef struct cryptheader {
+	unsigned char version;
+	unsigned char engine;
+	unsigned char segshift;
+	unsigned char flags;
+	unsigned char kdf;
+	uint32_t kdfcost;
+	unsigned char codec;
+} cryptheader;
+
+void initheader(cryptheader *hdr);
+void packheader(const cryptheader *hdr, unsigned char *buf);
+int unpackheader(const unsigned char *buf, size_t len, cryptheader *hdr);
+const char *headerwhy(int err);
+int readtrailer(int fd, off_t size, cryptheader *hdr, char *iv);
+
+#endif
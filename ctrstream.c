@@ -0,0 +1,105 @@
+/*      ctrstream.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include "ctrstream.h"
+
+void ctr_setkey(ctrkey *ck, const char *iv, size_t ivsize,
+				const char *pw)
+{
+	/* The key is derived exactly as the first legacy block was, from
+	 * the iv followed by the passphrase. */
+	size_t pwlen = strlen(pw);
+	char *wrk = malloc(ivsize + pwlen);
+	if (!wrk) {
+		perror("malloc failure in ctr_setkey()");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(wrk, iv, ivsize);	// iv may have embedded '\0'
+	memcpy(wrk + ivsize, pw, pwlen);
+	sha256_buffer(wrk, ivsize + pwlen, ck->key);
+	memset(wrk, 0, ivsize + pwlen);
+	free(wrk);
+} // ctr_setkey()
+
+void ctr_block(const ctrkey *ck, uint64_t counter, unsigned char *out)
+{
+	/* out receives CTR_BLOCKSIZE bytes of keystream. */
+	char msg[40];
+	int i;
+	memcpy(msg, ck->key, 32);
+	for (i = 0; i < 8; i++) {
+		msg[32 + i] = (char)(counter >> (8 * i));
+	}
+	sha256_buffer(msg, 40, out);
+} // ctr_block()
+
+void ctr_blocks(const ctrkey *ck, uint64_t counter, int n,
+				unsigned char *out)
+{
+	/* n consecutive blocks from counter, n no more than
+	 * SHA256MB_MAXLANES. They are independent so they are hashed side
+	 * by side. */
+	unsigned char msg[SHA256MB_MAXLANES][40];
+	const unsigned char *mp[SHA256MB_MAXLANES];
+	unsigned char *dp[SHA256MB_MAXLANES];
+	int i, j;
+	for (i = 0; i < n; i++) {
+		memcpy(msg[i], ck->key, 32);
+		for (j = 0; j < 8; j++) {
+			msg[i][32 + j] = (unsigned char)((counter + i) >> (8 * j));
+		}
+		mp[i] = msg[i];
+		dp[i] = out + i * CTR_BLOCKSIZE;
+	}
+	sha256mb_buffers(mp, 40, dp, n);
+} // ctr_blocks()
+
+void ctr_crypt(const ctrkey *ck, uint64_t offset, const char *in,
+				char *out, size_t len)
+{
+	/* XOR len bytes of in with the keystream starting at byte offset
+	 * and put the result in out. in and out may be the same buffer.
+	 * The keystream is made a buffer at a time, a lane's worth of
+	 * blocks per call, and applied with xorbuf().
+	*/
+	unsigned char ks[CTR_KSBUF] __attribute__((aligned(64)));
+	uint64_t counter = offset / CTR_BLOCKSIZE;
+	size_t skip = offset % CTR_BLOCKSIZE;
+	int lanes = sha256mb_lanes();
+	while (len) {
+		size_t b, n;
+		size_t nb = (skip + len + CTR_BLOCKSIZE - 1) / CTR_BLOCKSIZE;
+		if (nb > CTR_KSBUF / CTR_BLOCKSIZE) nb = CTR_KSBUF / CTR_BLOCKSIZE;
+		for (b = 0; b < nb; b += lanes) {
+			int k = (nb - b < (size_t)lanes) ? (int)(nb - b) : lanes;
+			ctr_blocks(ck, counter + b, k, ks + b * CTR_BLOCKSIZE);
+		}
+		n = nb * CTR_BLOCKSIZE - skip;
+		if (n > len) n = len;
+		xorbuf((unsigned char *)out, (const unsigned char *)in,
+				ks + skip, n);
+		in += n;
+		out += n;
+		len -= n;
+		skip = 0;
+		counter += nb;
+	}
+} // ctr_crypt()
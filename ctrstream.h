@@ -0,0 +1,51 @@
+/*
+ * ctrstream.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _CTRSTREAM_H
+# define _CTRSTREAM_H
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include "sha256.h"
+#include "sha256mb.h"
+#include "xorbuf.h"
+
+/* Counter mode keystream. Block i of the keystream is
+ * sha256(key || i) where key is sha256(iv || passphrase) and i is a
+ * 64 bit little endian counter, so any offset in the stream can be
+ * produced without computing the blocks before it.
+*/
+#define CTR_BLOCKSIZE	32
+#define CTR_KSBUF		4096	// keystream made per pass of ctr_crypt()
+
+typedef struct ctrkey {
+	unsigned char key[32];
+} ctrkey;
+
+void ctr_setkey(ctrkey *ck, const char *iv, size_t ivsize,
+				const char *pw);
+void ctr_block(const ctrkey *ck, uint64_t counter, unsigned char *out);
+void ctr_blocks(const ctrkey *ck, uint64_t counter, int n,
+				unsigned char *out);
+void ctr_crypt(const ctrkey *ck, uint64_t offset, const char *in,
+				char *out, size_t len);
+
+#endif
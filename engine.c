@@ -0,0 +1,631 @@
+/*      engine.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "engine.h"
+#include "ctrstream.h"
+#include "calcsha256sum.h"
+#include "sha256accel.h"
+#include "sha256mb.h"
+#include "legacychain.h"
+#include "ring.h"
+#include "xorbuf.h"
+#include "gcm.h"
+#include "chachapoly.h"
+#include "kdf.h"
+
+/* counter mode */
+typedef struct ctrctx {
+	ctrkey ck;
+	size_t chunk;
+	int flags;
+} ctrctx;
+
+/* the authenticated engines */
+typedef struct gcmsegctx {
+	gcmctx g;
+	int flags;
+	unsigned char aad[CRYPT_HDRSIZE + CRYPT_IVSIZE + 1];
+	size_t aadlen;		// without the last segment flag.
+} gcmsegctx;
+
+typedef struct chachactx {
+	unsigned char key[32];
+	int flags;
+	unsigned char aad[CRYPT_HDRSIZE + CRYPT_IVSIZE + 1];
+	size_t aadlen;
+} chachactx;
+
+/* The legacy chain. Each 32 byte block of keystream is the sha256sum
+ * of the hex form of the one before, so the segments have to come in
+ * order. The chain can't be split up but it can run ahead of the I/O,
+ * so a producer thread fills a ring with keystream while the caller
+ * reads, XORs and writes. In debug mode the hex of each block is
+ * wanted as it is used, so then the chain is run inline.
+*/
+#define LEGACY_SLOT		(64 * 1024)
+#define LEGACY_SLOTS	8
+
+typedef struct legacyctx {
+	legacychain lc;
+	unsigned char brp[32];
+	size_t used;	// bytes of brp already used.
+	int flags;
+	int threaded;
+	ring r;
+	pthread_t producer;
+	const unsigned char *slot;	// being consumed, NULL for none.
+	size_t slotused;
+} legacyctx;
+
+static void *ctr_init(const unsigned char *hdr, const char *iv,
+					size_t ivsize, const char *pw, size_t segsize, int flags);
+static int ctr_transform(void *ctx, uint64_t segno, const char *in,
+					size_t len, char *out, size_t *outlen, int final);
+static void ctr_finalize(void *ctx);
+static int ctr_selftest(void);
+static const char *ctr_implname(void);
+static void *gcm_init(const unsigned char *hdr, const char *iv,
+					size_t ivsize, const char *pw, size_t segsize, int flags);
+static int gcm_transform(void *ctx, uint64_t segno, const char *in,
+					size_t len, char *out, size_t *outlen, int final);
+static void gcm_finalize(void *ctx);
+static const char *gcm_enginename(void);
+static void gcm_makename(void);
+static void *chacha_init(const unsigned char *hdr, const char *iv,
+					size_t ivsize, const char *pw, size_t segsize, int flags);
+static int chacha_transform(void *ctx, uint64_t segno, const char *in,
+					size_t len, char *out, size_t *outlen, int final);
+static void chacha_finalize(void *ctx);
+static void *legacy_init(const unsigned char *hdr, const char *iv,
+					size_t ivsize, const char *pw, size_t segsize, int flags);
+static int legacy_transform(void *ctx, uint64_t segno, const char *in,
+					size_t len, char *out, size_t *outlen, int final);
+static void legacy_finalize(void *ctx);
+static int legacy_selftest(void);
+static void *legacy_producer(void *arg);
+static const char *legacy_implname(void);
+static void segnonce(uint64_t segno, unsigned char *nonce);
+static size_t bindaad(unsigned char *aad, const unsigned char *hdr,
+						const char *iv, size_t ivsize);
+static void debugkeystream(const ctrkey *ck, uint64_t offset,
+							size_t len);
+
+static char gcmname[40];
+static pthread_once_t gcmnameonce = PTHREAD_ONCE_INIT;
+
+const cryptengine engines[] = {
+	{ "sha256-ctr", ENGINE_SHA256CTR, ENGINE_SEEKABLE, 0,
+		ctr_init, ctr_transform, ctr_finalize, ctr_selftest,
+		ctr_implname },
+	{ "aes-256-gcm", ENGINE_AES256GCM, ENGINE_SEEKABLE | ENGINE_AEAD,
+		GCM_TAGSIZE, gcm_init, gcm_transform, gcm_finalize,
+		gcm_selftest, gcm_enginename },
+	{ "chacha20-poly1305", ENGINE_CHACHA20POLY1305,
+		ENGINE_SEEKABLE | ENGINE_AEAD, CHACHAPOLY_TAGSIZE, chacha_init,
+		chacha_transform, chacha_finalize, chachapoly_selftest,
+		chacha20_implname },
+	{ "legacy", ENGINE_LEGACY, ENGINE_NOWRITE, 0, legacy_init,
+		legacy_transform, legacy_finalize, legacy_selftest,
+		legacy_implname },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL, NULL, NULL }
+};
+
+const cryptengine *engine_byname(const char *name)
+{
+	/* "auto" picks the fastest engine that can encrypt. Returns NULL
+	 * for an unknown name. */
+	const cryptengine *e;
+	if (strcmp(name, "auto") == 0) return engine_fastest();
+	for (e = engines; e->name; e++) {
+		if (strcmp(e->name, name) == 0) return e;
+	}
+	return NULL;
+} // engine_byname()
+
+const cryptengine *engine_byid(int id)
+{
+	const cryptengine *e;
+	for (e = engines; e->name; e++) {
+		if (e->id == id) return e;
+	}
+	return NULL;
+} // engine_byid()
+
+int engine_setup(segjob *job, const cryptengine *e,
+					const cryptheader *hdr, const char *iv, size_t ivsize,
+					const char *pw, int flags)
+{
+	/* Fills in the segment sizes and the transform, keyed as hdr says
+	 * from pw. The file positions are left to the caller. hdr may be
+	 * NULL for the legacy format. Returns 0, or -1 as kdf_key() does,
+	 * when there is nothing to finish. */
+	size_t seg = PARALLEL_CHUNK;
+	char key[KDF_KEYSIZE];
+	unsigned char packed[CRYPT_HDRSIZE];
+	const char *k;
+
+	memset(job, 0, sizeof(segjob));
+	k = kdf_key(pw, hdr, iv, key);
+	if (!k) return -1;
+	if (e->props & ENGINE_AEAD) seg = (size_t)1 << hdr->segshift;
+	if (hdr) packheader(hdr, packed);
+	job->ctx = e->init((hdr) ? packed : NULL, iv, ivsize, k, seg, flags);
+	memset(key, 0, sizeof(key));
+	job->fn = e->transform;
+	job->inseg = job->outseg = seg;
+	if (flags & ENGINE_DECRYPT) {
+		job->inseg += e->overhead;
+	} else {
+		job->outseg += e->overhead;
+	}
+	return 0;
+} // engine_setup()
+
+void engine_finish(segjob *job, const cryptengine *e)
+{
+	e->finalize(job->ctx);
+	job->ctx = NULL;
+} // engine_finish()
+
+double engine_throughput(const cryptengine *e)
+{
+	/* Encrypts an 8 MiB buffer until a quarter second has gone and
+	 * returns MB/s. The legacy engine only decrypts, but its transform
+	 * is the same either way. */
+	const size_t len = 8 * 1024 * 1024;
+	char *in = calloc(1, len);
+	char *out = malloc(len + len / 1024 + 64);
+	char iv[CRYPT_IVSIZE];
+	cryptheader hdr;
+	segjob job;
+	struct timespec t0, t1;
+	double secs = 0, bytes = 0;
+	size_t outlen;
+
+	if (!in || !out) {
+		perror("malloc failure in engine_throughput()");
+		exit(EXIT_FAILURE);
+	}
+	initheader(&hdr);
+	memset(iv, 0x5a, sizeof(iv));
+	(void)engine_setup(&job, e, &hdr, iv, sizeof(iv), "benchmark", 0);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (secs < 0.25) {
+		uint64_t segno;
+		for (segno = 0; segno * job.inseg < len; segno++) {
+			size_t n = len - segno * job.inseg;
+			if (n > job.inseg) n = job.inseg;
+			(void)job.fn(job.ctx, segno, in + segno * job.inseg, n,
+						out + segno * job.outseg, &outlen, 0);
+		}
+		bytes += len;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	}
+	engine_finish(&job, e);
+	free(out);
+	free(in);
+	return bytes / secs / 1e6;
+} // engine_throughput()
+
+const cryptengine *engine_fastest(void)
+{
+	const cryptengine *e, *best = engines;
+	double bestrate = 0;
+	for (e = engines; e->name; e++) {
+		double rate;
+		if (e->props & ENGINE_NOWRITE) continue;
+		if (e->selftest()) continue;
+		rate = engine_throughput(e);
+		if (rate > bestrate) {
+			bestrate = rate;
+			best = e;
+		}
+	}
+	return best;
+} // engine_fastest()
+
+void engine_list(FILE *fp)
+{
+	const cryptengine *e;
+	fprintf(fp, "%-20s %-16s %-9s %10s\n", "engine", "impl", "selftest",
+			"MB/s");
+	for (e = engines; e->name; e++) {
+		int ok = (e->selftest() == 0);
+		fprintf(fp, "%-20s %-16s %-9s %10.1f%s\n", e->name,
+				e->implname(), ok ? "ok" : "FAILED",
+				ok ? engine_throughput(e) : 0.0,
+				(e->props & ENGINE_NOWRITE) ? "  (decrypt only)" : "");
+	}
+} // engine_list()
+
+void *ctr_init(const unsigned char *hdr, const char *iv,
+					size_t ivsize, const char *pw, size_t segsize, int flags)
+{
+	ctrctx *c = malloc(sizeof(ctrctx));
+	(void)hdr;
+	if (!c) {
+		perror("malloc failure in ctr_init()");
+		exit(EXIT_FAILURE);
+	}
+	ctr_setkey(&c->ck, iv, ivsize, pw);
+	c->chunk = segsize;
+	c->flags = flags;
+	return c;
+} // ctr_init()
+
+int ctr_transform(void *ctx, uint64_t segno, const char *in, size_t len,
+			char *out, size_t *outlen, int final)
+{
+	ctrctx *c = ctx;
+	uint64_t offset = segno * c->chunk;
+	(void)final;	// nothing marks the end of a counter mode stream.
+	if (c->flags & ENGINE_DEBUG) debugkeystream(&c->ck, offset, len);
+	ctr_crypt(&c->ck, offset, in, out, len);
+	*outlen = len;
+	return 0;
+} // ctr_transform()
+
+void ctr_finalize(void *ctx)
+{
+	memset(ctx, 0, sizeof(ctrctx));	// key material.
+	free(ctx);
+} // ctr_finalize()
+
+int ctr_selftest(void)
+{
+	/* sha256 of "abc" from FIPS 180-2, then the keystream produced in
+	 * one piece must match the same produced from an odd offset. */
+	static const unsigned char abc[32] = {
+		0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+		0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+		0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+		0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad
+	};
+	unsigned char sum[32];
+	char a[200], b[200];
+	ctrkey ck;
+
+	sha256_buffer("abc", 3, sum);
+	if (memcmp(sum, abc, 32)) return -1;
+	memset(a, 0, sizeof(a));
+	memset(b, 0, sizeof(b));
+	ctr_setkey(&ck, "0123456789abcdef0123456789abcdef", 32, "test");
+	ctr_crypt(&ck, 0, a, a, sizeof(a));
+	ctr_crypt(&ck, 45, b, b, sizeof(b) - 45);
+	return memcmp(a + 45, b, sizeof(b) - 45) ? -1 : 0;
+} // ctr_selftest()
+
+const char *ctr_implname(void)
+{
+	// the counter blocks are hashed side by side where possible.
+	return (sha256mb_lanes() > 1) ? sha256mb_implname()
+									: sha256_implname();
+} // ctr_implname()
+
+void *gcm_init(const unsigned char *hdr, const char *iv,
+					size_t ivsize, const char *pw, size_t segsize, int flags)
+{
+	gcmsegctx *c = aligned_alloc(16, sizeof(gcmsegctx));
+	ctrkey ck;
+	(void)segsize;
+	if (!c) {
+		perror("malloc failure in gcm_init()");
+		exit(EXIT_FAILURE);
+	}
+	ctr_setkey(&ck, iv, ivsize, pw);
+	gcm_setkey(&c->g, ck.key);
+	memset(&ck, 0, sizeof(ck));
+	c->flags = flags;
+	c->aadlen = bindaad(c->aad, hdr, iv, ivsize);
+	return c;
+} // gcm_init()
+
+int gcm_transform(void *ctx, uint64_t segno, const char *in, size_t len,
+			char *out, size_t *outlen, int final)
+{
+	/* Each segment is sealed separately with the segment number as
+	 * the nonce. The header, the IV and the flag for the last segment
+	 * are authenticated too, so that neither a header that has been
+	 * altered nor a file cut short at a segment boundary gets by.
+	*/
+	gcmsegctx *c = ctx;
+	unsigned char nonce[GCM_NONCESIZE];
+	unsigned char aad[sizeof(c->aad)];
+
+	segnonce(segno, nonce);
+	memcpy(aad, c->aad, c->aadlen);
+	aad[c->aadlen] = (final) ? 1 : 0;
+	if (!(c->flags & ENGINE_DECRYPT)) {
+		gcm_encrypt(&c->g, nonce, aad, c->aadlen + 1,
+					(const unsigned char *)in,
+					(unsigned char *)out, len,
+					(unsigned char *)out + len);
+		*outlen = len + GCM_TAGSIZE;
+		return 0;
+	}
+	if (len < GCM_TAGSIZE) return -1;
+	len -= GCM_TAGSIZE;
+	if (gcm_decrypt(&c->g, nonce, aad, c->aadlen + 1,
+					(const unsigned char *)in,
+					(unsigned char *)out, len,
+					(const unsigned char *)in + len)) return -1;
+	*outlen = len;
+	return 0;
+} // gcm_transform()
+
+void gcm_finalize(void *ctx)
+{
+	memset(ctx, 0, sizeof(gcmsegctx));
+	free(ctx);
+} // gcm_finalize()
+
+const char *gcm_enginename(void)
+{
+	// both halves matter, eg "aes-ni/pclmulqdq".
+	pthread_once(&gcmnameonce, gcm_makename);
+	return gcmname;
+} // gcm_enginename()
+
+void gcm_makename(void)
+{
+	snprintf(gcmname, sizeof(gcmname), "%s/%s", aes_implname(),
+			gcm_implname());
+} // gcm_makename()
+
+void *chacha_init(const unsigned char *hdr, const char *iv,
+					size_t ivsize, const char *pw, size_t segsize, int flags)
+{
+	chachactx *c = malloc(sizeof(chachactx));
+	ctrkey ck;
+	(void)segsize;
+	if (!c) {
+		perror("malloc failure in chacha_init()");
+		exit(EXIT_FAILURE);
+	}
+	ctr_setkey(&ck, iv, ivsize, pw);
+	memcpy(c->key, ck.key, 32);
+	memset(&ck, 0, sizeof(ck));
+	c->flags = flags;
+	c->aadlen = bindaad(c->aad, hdr, iv, ivsize);
+	return c;
+} // chacha_init()
+
+int chacha_transform(void *ctx, uint64_t segno, const char *in,
+			size_t len, char *out, size_t *outlen, int final)
+{
+	// Sealed exactly as gcm_transform() does it.
+	chachactx *c = ctx;
+	unsigned char nonce[CHACHAPOLY_NONCESIZE];
+	unsigned char aad[sizeof(c->aad)];
+
+	segnonce(segno, nonce);
+	memcpy(aad, c->aad, c->aadlen);
+	aad[c->aadlen] = (final) ? 1 : 0;
+	if (!(c->flags & ENGINE_DECRYPT)) {
+		chachapoly_encrypt(c->key, nonce, aad, c->aadlen + 1,
+					(const unsigned char *)in, (unsigned char *)out, len,
+					(unsigned char *)out + len);
+		*outlen = len + CHACHAPOLY_TAGSIZE;
+		return 0;
+	}
+	if (len < CHACHAPOLY_TAGSIZE) return -1;
+	len -= CHACHAPOLY_TAGSIZE;
+	if (chachapoly_decrypt(c->key, nonce, aad, c->aadlen + 1,
+					(const unsigned char *)in, (unsigned char *)out, len,
+					(const unsigned char *)in + len)) return -1;
+	*outlen = len;
+	return 0;
+} // chacha_transform()
+
+void chacha_finalize(void *ctx)
+{
+	memset(ctx, 0, sizeof(chachactx));
+	free(ctx);
+} // chacha_finalize()
+
+void *legacy_init(const unsigned char *hdr, const char *iv,
+					size_t ivsize, const char *pw, size_t segsize, int flags)
+{
+	legacyctx *c = malloc(sizeof(legacyctx));
+	(void)hdr;
+	(void)segsize;
+	if (!c) {
+		perror("malloc failure in legacy_init()");
+		exit(EXIT_FAILURE);
+	}
+	legacychain_start(&c->lc, iv, ivsize, pw);
+	legacychain_block(&c->lc, c->brp);
+	c->used = 0;
+	c->flags = flags;
+	c->slot = NULL;
+	c->slotused = 0;
+	c->threaded = !(flags & ENGINE_DEBUG);
+	if (c->threaded) {
+		int res;
+		ring_init(&c->r, LEGACY_SLOTS, LEGACY_SLOT);
+		res = pthread_create(&c->producer, NULL, legacy_producer, c);
+		if (res) {
+			errno = res;
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	return c;
+} // legacy_init()
+
+void *legacy_producer(void *arg)
+{
+	/* Fills slots with keystream until the ring is stopped. Only this
+	 * thread touches the chain once it has started. */
+	legacyctx *c = arg;
+	unsigned char *slot;
+	while ((slot = ring_produce(&c->r))) {
+		size_t off;
+		for (off = 0; off < LEGACY_SLOT; off += 32) {
+			legacychain_block(&c->lc, slot + off);
+			legacychain_next(&c->lc);
+		}
+		ring_commit(&c->r);
+	}
+	return NULL;
+} // legacy_producer()
+
+int legacy_transform(void *ctx, uint64_t segno, const char *in,
+			size_t len, char *out, size_t *outlen, int final)
+{
+	legacyctx *c = ctx;
+	size_t i;
+	(void)segno;	// the chain itself tracks the position.
+	(void)final;
+	*outlen = len;
+	if (c->threaded) {
+		while (len) {
+			size_t n;
+			if (!c->slot) {
+				c->slot = ring_consume(&c->r);
+				c->slotused = 0;
+			}
+			n = LEGACY_SLOT - c->slotused;
+			if (n > len) n = len;
+			xorbuf((unsigned char *)out, (const unsigned char *)in,
+					c->slot + c->slotused, n);
+			c->slotused += n;
+			if (c->slotused == LEGACY_SLOT) {
+				ring_release(&c->r);
+				c->slot = NULL;
+			}
+			in += n;
+			out += n;
+			len -= n;
+		}
+		return 0;
+	}
+	for (i = 0; i < len; i++) {
+		if (c->used == 32) {
+			legacychain_next(&c->lc);
+			legacychain_block(&c->lc, c->brp);
+			c->used = 0;
+		}
+		if (c->used == 0 && (c->flags & ENGINE_DEBUG)) {
+			// write the hex version of the sum to stderr
+			char hex[65];
+			legacychain_hex(&c->lc, hex);
+			fprintf(stderr, "%s\n", hex);
+		}
+		out[i] = in[i] ^ c->brp[c->used++];
+	}
+	return 0;
+} // legacy_transform()
+
+void legacy_finalize(void *ctx)
+{
+	legacyctx *c = ctx;
+	if (c->threaded) {
+		ring_stop(&c->r);
+		pthread_join(c->producer, NULL);
+		memset(c->r.buf, 0, c->r.nslots * c->r.slotsize);
+		ring_free(&c->r);
+	}
+	memset(c, 0, sizeof(legacyctx));
+	free(c);
+} // legacy_finalize()
+
+int legacy_selftest(void)
+{
+	/* sha256 of "abc", then a few links of the chain made the way the
+	 * original code made them, with calcsha256sum() in place. */
+	char sum[65], hex[65];
+	unsigned char bin[32], blk[32];
+	char pwbuf[65];
+	legacychain lc;
+	int i;
+
+	calcsha256sum("abc", 3, sum, bin);
+	if (strcmp(sum, "ba7816bf8f01cfea414140de5dae2223"
+					"b00361a396177a9cb410ff61f20015ad")) return -1;
+	memset(pwbuf, 0, sizeof(pwbuf));
+	memcpy(pwbuf, "0123456789abcdef0123456789abcdef", 32);
+	strcpy(pwbuf + 32, "test");
+	(void)calcsha256sum(pwbuf, 36, pwbuf, bin);
+	legacychain_start(&lc, "0123456789abcdef0123456789abcdef", 32, "test");
+	for (i = 0; i < 4; i++) {
+		legacychain_block(&lc, blk);
+		legacychain_hex(&lc, hex);
+		if (memcmp(blk, bin, 32) || strcmp(hex, pwbuf)) return -1;
+		(void)calcsha256sum(pwbuf, 64, pwbuf, bin);
+		legacychain_next(&lc);
+	}
+	return 0;
+} // legacy_selftest()
+
+const char *legacy_implname(void)
+{
+	return legacychain_implname();
+} // legacy_implname()
+
+void segnonce(uint64_t segno, unsigned char *nonce)
+{
+	// 96 bit nonce, the big endian segment number then zeroes.
+	int i;
+	memset(nonce, 0, 12);
+	for (i = 0; i < 8; i++) {
+		nonce[i] = (unsigned char)(segno >> (56 - 8 * i));
+	}
+} // segnonce()
+
+size_t bindaad(unsigned char *aad, const unsigned char *hdr,
+				const char *iv, size_t ivsize)
+{
+	/* The packed header and the IV, which every segment authenticates
+	 * ahead of its last segment flag. Returns their length. */
+	size_t len = 0;
+	if (hdr) {
+		memcpy(aad, hdr, CRYPT_HDRSIZE);
+		len = CRYPT_HDRSIZE;
+	}
+	if (ivsize > CRYPT_IVSIZE) ivsize = CRYPT_IVSIZE;
+	memcpy(aad + len, iv, ivsize);
+	return len + ivsize;
+} // bindaad()
+
+void debugkeystream(const ctrkey *ck, uint64_t offset, size_t len)
+{
+	/* Counter mode equivalent of the legacy debug output, the hex
+	 * representation of each keystream block touched, to stderr. */
+	if (!len) return;
+	uint64_t first = offset / CTR_BLOCKSIZE;
+	uint64_t last = (offset + len - 1) / CTR_BLOCKSIZE;
+	uint64_t counter;
+	for (counter = first; counter <= last; counter++) {
+		unsigned char ks[CTR_BLOCKSIZE];
+		int i;
+		ctr_block(ck, counter, ks);
+		for (i = 0; i < CTR_BLOCKSIZE; i++) {
+			fprintf(stderr, "%.2x", ks[i]);
+		}
+		fputc('\n', stderr);
+	}
+} // debugkeystream()
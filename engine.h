@@ -0,0 +1,77 @@
+/*
+ * engine.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _ENGINE_H
+# define _ENGINE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "cryptheader.h"
+#include "parallel.h"
+
+/* The cipher engines. Each one turns a passphrase and IV into a
+ * context and then transforms the stream a segment at a time through
+ * the segfunc interface that paralleltransform() drives. Engines that
+ * are not seekable, the legacy chain, must be given their segments in
+ * order on one thread.
+ * init is given the packed header, NULL for the legacy format, and the
+ * authenticated engines bind it and the IV into every segment. A
+ * header read from a file is packed again for it, so a field altered
+ * in the file fails to authenticate.
+*/
+enum {
+	ENGINE_DECRYPT	= 1 << 0,	// init flags
+	ENGINE_DEBUG	= 1 << 1
+};
+
+enum {
+	ENGINE_SEEKABLE	= 1 << 0,	// engine properties
+	ENGINE_AEAD		= 1 << 1,	// authenticated, always a final segment
+	ENGINE_NOWRITE	= 1 << 2	// decrypt only
+};
+
+#define ENGINE_LEGACY	(-1)	// the id of the headerless chained format
+
+typedef struct cryptengine {
+	const char *name;
+	int id;				// the engine byte in the header
+	int props;
+	size_t overhead;	// bytes added to each segment when encrypting
+	void *(*init)(const unsigned char *hdr, const char *iv,
+					size_t ivsize, const char *pw, size_t segsize, int flags);
+	segfunc transform;
+	void (*finalize)(void *ctx);
+	int (*selftest)(void);
+	const char *(*implname)(void);
+} cryptengine;
+
+extern const cryptengine engines[];
+
+const cryptengine *engine_byname(const char *name);
+const cryptengine *engine_byid(int id);
+int engine_setup(segjob *job, const cryptengine *e,
+					const cryptheader *hdr, const char *iv, size_t ivsize,
+					const char *pw, int flags);
+void engine_finish(segjob *job, const cryptengine *e);
+double engine_throughput(const cryptengine *e);
+const cryptengine *engine_fastest(void);
+void engine_list(FILE *fp);
+
+#endif
@@ -0,0 +1,460 @@
+/*      gcm.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "gcm.h"
+#include "cpufeatures.h"
+#ifdef CRYPT_X86
+#include <immintrin.h>
+#endif
+
+static void ghash(const gcmctx *g, unsigned char *x,
+					const unsigned char *data, size_t len);
+static void ghash_portable(const gcmctx *g, unsigned char *x,
+					const unsigned char *data, size_t nblocks);
+static void gcm_tag(const gcmctx *g, const unsigned char *nonce,
+					const unsigned char *aad, size_t aadlen,
+					const unsigned char *ct, size_t len,
+					unsigned char *tag);
+#ifdef CRYPT_X86
+static void clmul_powers(gcmctx *g);
+static void ghash_clmul(const gcmctx *g, unsigned char *x,
+					const unsigned char *data, size_t nblocks);
+static void ghash_vpclmul(const gcmctx *g, unsigned char *x,
+					const unsigned char *data, size_t nblocks);
+#endif
+
+static int useclmul(void)
+{
+	unsigned f = cpufeatures();
+	return (f & CPU_PCLMUL) && (f & CPU_SSSE3);
+} // useclmul()
+
+static int usevpclmul(void)
+{
+	unsigned f = cpufeatures();
+	return useclmul() && (f & CPU_VPCLMUL) && (f & CPU_AVX2);
+} // usevpclmul()
+
+static uint64_t getu64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+	for (i = 0; i < 8; i++) v = (v << 8) | p[i];
+	return v;
+} // getu64()
+
+static void putu64(unsigned char *p, uint64_t v)
+{
+	int i;
+	for (i = 7; i >= 0; i--) {
+		p[i] = (unsigned char)v;
+		v >>= 8;
+	}
+} // putu64()
+
+void gcm_setkey(gcmctx *g, const unsigned char *key)
+{
+	unsigned char h[16];
+	uint64_t vh, vl;
+	int i, j;
+
+	memset(g, 0, sizeof(gcmctx));
+	aes_setkey(&g->aes, key);
+	memset(h, 0, 16);
+	aes_encryptblock(&g->aes, h, h);
+
+	// 4 bit tables for the portable multiply.
+	vh = getu64(h);
+	vl = getu64(h + 8);
+	g->hl[8] = vl;
+	g->hh[8] = vh;
+	for (i = 4; i > 0; i >>= 1) {
+		uint64_t t = (vl & 1) ? 0xe100000000000000ULL : 0;
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ t;
+		g->hl[i] = vl;
+		g->hh[i] = vh;
+	}
+	for (i = 2; i <= 8; i *= 2) {
+		vh = g->hh[i];
+		vl = g->hl[i];
+		for (j = 1; j < i; j++) {
+			g->hh[i + j] = vh ^ g->hh[j];
+			g->hl[i + j] = vl ^ g->hl[j];
+		}
+	}
+	memcpy(g->hpow[0], h, 16);
+#ifdef CRYPT_X86
+	if (useclmul()) clmul_powers(g);
+#endif
+} // gcm_setkey()
+
+void gcm_encrypt(const gcmctx *g, const unsigned char *nonce,
+				const unsigned char *aad, size_t aadlen,
+				const unsigned char *in, unsigned char *out, size_t len,
+				unsigned char *tag)
+{
+	/* out may be the same as in. */
+	unsigned char ctr[16];
+	memcpy(ctr, nonce, GCM_NONCESIZE);
+	ctr[12] = ctr[13] = ctr[14] = 0;
+	ctr[15] = 2;	// counter 1 is kept for the tag.
+	aes_ctr32(&g->aes, ctr, in, out, len);
+	gcm_tag(g, nonce, aad, aadlen, out, len, tag);
+} // gcm_encrypt()
+
+int gcm_decrypt(const gcmctx *g, const unsigned char *nonce,
+				const unsigned char *aad, size_t aadlen,
+				const unsigned char *in, unsigned char *out, size_t len,
+				const unsigned char *tag)
+{
+	/* Returns 0 and the plaintext in out if the tag matches, -1 and
+	 * leaves out untouched if it does not. */
+	unsigned char ctr[16], calc[GCM_TAGSIZE];
+	unsigned char diff = 0;
+	int i;
+
+	gcm_tag(g, nonce, aad, aadlen, in, len, calc);
+	for (i = 0; i < GCM_TAGSIZE; i++) {
+		diff |= calc[i] ^ tag[i];
+	}
+	if (diff) return -1;
+	memcpy(ctr, nonce, GCM_NONCESIZE);
+	ctr[12] = ctr[13] = ctr[14] = 0;
+	ctr[15] = 2;
+	aes_ctr32(&g->aes, ctr, in, out, len);
+	return 0;
+} // gcm_decrypt()
+
+void gcm_tag(const gcmctx *g, const unsigned char *nonce,
+					const unsigned char *aad, size_t aadlen,
+					const unsigned char *ct, size_t len,
+					unsigned char *tag)
+{
+	unsigned char x[16], lens[16], j0[16];
+	int i;
+
+	memset(x, 0, 16);
+	ghash(g, x, aad, aadlen);
+	ghash(g, x, ct, len);
+	putu64(lens, (uint64_t)aadlen * 8);
+	putu64(lens + 8, (uint64_t)len * 8);
+	ghash(g, x, lens, 16);
+	memcpy(j0, nonce, GCM_NONCESIZE);
+	j0[12] = j0[13] = j0[14] = 0;
+	j0[15] = 1;
+	aes_encryptblock(&g->aes, j0, j0);
+	for (i = 0; i < 16; i++) {
+		tag[i] = x[i] ^ j0[i];
+	}
+} // gcm_tag()
+
+void ghash(const gcmctx *g, unsigned char *x,
+					const unsigned char *data, size_t len)
+{
+	/* Absorb len bytes, the last partial block zero padded. */
+	size_t nblocks = len / 16;
+	void (*fn)(const gcmctx *, unsigned char *, const unsigned char *,
+				size_t) = ghash_portable;
+#ifdef CRYPT_X86
+	if (usevpclmul()) {
+		fn = ghash_vpclmul;
+	} else if (useclmul()) {
+		fn = ghash_clmul;
+	}
+#endif
+	if (nblocks) fn(g, x, data, nblocks);
+	if (len % 16) {
+		unsigned char last[16];
+		memset(last, 0, 16);
+		memcpy(last, data + 16 * nblocks, len % 16);
+		fn(g, x, last, 1);
+	}
+} // ghash()
+
+const char *gcm_implname(void)
+{
+	if (usevpclmul()) return "vpclmulqdq";
+	if (useclmul()) return "pclmulqdq";
+	return "portable";
+} // gcm_implname()
+
+void ghash_portable(const gcmctx *g, unsigned char *x,
+					const unsigned char *data, size_t nblocks)
+{
+	static const uint64_t last4[16] = {
+		0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+		0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+	};
+	while (nblocks--) {
+		uint64_t zh, zl;
+		unsigned char lo, hi, rem;
+		int i;
+		for (i = 0; i < 16; i++) x[i] ^= data[i];
+		lo = x[15] & 0xf;
+		zh = g->hh[lo];
+		zl = g->hl[lo];
+		for (i = 15; i >= 0; i--) {
+			lo = x[i] & 0xf;
+			hi = (x[i] >> 4) & 0xf;
+			if (i != 15) {
+				rem = zl & 0xf;
+				zl = (zh << 60) | (zl >> 4);
+				zh = (zh >> 4) ^ (last4[rem] << 48);
+				zh ^= g->hh[lo];
+				zl ^= g->hl[lo];
+			}
+			rem = zl & 0xf;
+			zl = (zh << 60) | (zl >> 4);
+			zh = (zh >> 4) ^ (last4[rem] << 48);
+			zh ^= g->hh[hi];
+			zl ^= g->hl[hi];
+		}
+		putu64(x, zh);
+		putu64(x + 8, zl);
+		data += 16;
+	}
+} // ghash_portable()
+
+#ifdef CRYPT_X86
+/* The carry-less multiply works on byte reversed blocks. mul() gives
+ * the unreduced 256 bit product, reduce() shifts it left one bit for
+ * the reflected representation and reduces modulo the GCM polynomial.
+ * Products of several blocks are summed before a single reduce().
+*/
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i bswap128(__m128i a)
+{
+	const __m128i m = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+								8, 9, 10, 11, 12, 13, 14, 15);
+	return _mm_shuffle_epi8(a, m);
+} // bswap128()
+
+__attribute__((target("pclmul,ssse3")))
+static inline void mul(__m128i a, __m128i b, __m128i *lo, __m128i *mid,
+						__m128i *hi)
+{
+	*lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+	*hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+} // mul()
+
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i reduce(__m128i lo, __m128i mid, __m128i hi)
+{
+	__m128i t2, t3, t4, t5, t6, t7, t8, t9;
+	t3 = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	t6 = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+	// shift the 256 bit value left by one.
+	t7 = _mm_srli_epi32(t3, 31);
+	t8 = _mm_srli_epi32(t6, 31);
+	t3 = _mm_slli_epi32(t3, 1);
+	t6 = _mm_slli_epi32(t6, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	t3 = _mm_or_si128(t3, t7);
+	t6 = _mm_or_si128(t6, t8);
+	t6 = _mm_or_si128(t6, t9);
+	// reduce.
+	t7 = _mm_slli_epi32(t3, 31);
+	t8 = _mm_slli_epi32(t3, 30);
+	t9 = _mm_slli_epi32(t3, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	t3 = _mm_xor_si128(t3, t7);
+	t2 = _mm_srli_epi32(t3, 1);
+	t4 = _mm_srli_epi32(t3, 2);
+	t5 = _mm_srli_epi32(t3, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	t3 = _mm_xor_si128(t3, t2);
+	return _mm_xor_si128(t6, t3);
+} // reduce()
+
+__attribute__((target("pclmul,ssse3")))
+void clmul_powers(gcmctx *g)
+{
+	/* hpow[i] holds H^(i+1) in byte reversed form. */
+	__m128i h = bswap128(_mm_loadu_si128((const __m128i *)g->hpow[0]));
+	__m128i p = h;
+	int i;
+	_mm_store_si128((__m128i *)g->hpow[0], h);
+	for (i = 1; i < 8; i++) {
+		__m128i lo = _mm_setzero_si128();
+		__m128i mid = lo, hi = lo;
+		mul(p, h, &lo, &mid, &hi);
+		p = reduce(lo, mid, hi);
+		_mm_store_si128((__m128i *)g->hpow[i], p);
+	}
+} // clmul_powers()
+
+__attribute__((target("pclmul,ssse3")))
+void ghash_clmul(const gcmctx *g, unsigned char *x,
+					const unsigned char *data, size_t nblocks)
+{
+	const __m128i *hp = (const __m128i *)g->hpow;
+	__m128i h1 = _mm_load_si128(hp), h2 = _mm_load_si128(hp + 1);
+	__m128i h3 = _mm_load_si128(hp + 2), h4 = _mm_load_si128(hp + 3);
+	__m128i acc = bswap128(_mm_loadu_si128((const __m128i *)x));
+	const __m128i *d = (const __m128i *)data;
+
+	while (nblocks >= 4) {
+		__m128i lo = _mm_setzero_si128();
+		__m128i mid = lo, hi = lo;
+		__m128i b0 = _mm_xor_si128(acc, bswap128(_mm_loadu_si128(d)));
+		mul(b0, h4, &lo, &mid, &hi);
+		mul(bswap128(_mm_loadu_si128(d + 1)), h3, &lo, &mid, &hi);
+		mul(bswap128(_mm_loadu_si128(d + 2)), h2, &lo, &mid, &hi);
+		mul(bswap128(_mm_loadu_si128(d + 3)), h1, &lo, &mid, &hi);
+		acc = reduce(lo, mid, hi);
+		d += 4;
+		nblocks -= 4;
+	}
+	while (nblocks--) {
+		__m128i lo = _mm_setzero_si128();
+		__m128i mid = lo, hi = lo;
+		acc = _mm_xor_si128(acc, bswap128(_mm_loadu_si128(d)));
+		mul(acc, h1, &lo, &mid, &hi);
+		acc = reduce(lo, mid, hi);
+		d++;
+	}
+	_mm_storeu_si128((__m128i *)x, bswap128(acc));
+} // ghash_clmul()
+
+__attribute__((target("vpclmulqdq,pclmul,avx2,ssse3")))
+void ghash_vpclmul(const gcmctx *g, unsigned char *x,
+					const unsigned char *data, size_t nblocks)
+{
+	/* Eight blocks per pass, two in each ymm register multiplied by
+	 * the matching pair of powers of H. The two lanes of the sums are
+	 * folded together before the one reduction. */
+	const __m256i m = _mm256_broadcastsi128_si256(
+						_mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+									8, 9, 10, 11, 12, 13, 14, 15));
+	const __m128i *hp = (const __m128i *)g->hpow;
+	__m256i p01 = _mm256_set_m128i(_mm_load_si128(hp + 6),
+								_mm_load_si128(hp + 7));
+	__m256i p23 = _mm256_set_m128i(_mm_load_si128(hp + 4),
+								_mm_load_si128(hp + 5));
+	__m256i p45 = _mm256_set_m128i(_mm_load_si128(hp + 2),
+								_mm_load_si128(hp + 3));
+	__m256i p67 = _mm256_set_m128i(_mm_load_si128(hp),
+								_mm_load_si128(hp + 1));
+	__m128i acc = bswap128(_mm_loadu_si128((const __m128i *)x));
+	const __m256i *d = (const __m256i *)data;
+
+	while (nblocks >= 8) {
+		__m256i b[4], p[4], lo, mid, hi;
+		int i;
+		p[0] = p01; p[1] = p23; p[2] = p45; p[3] = p67;
+		for (i = 0; i < 4; i++) {
+			b[i] = _mm256_shuffle_epi8(_mm256_loadu_si256(d + i), m);
+		}
+		b[0] = _mm256_xor_si256(b[0],
+				_mm256_set_m128i(_mm_setzero_si128(), acc));
+		lo = mid = hi = _mm256_setzero_si256();
+		for (i = 0; i < 4; i++) {
+			lo = _mm256_xor_si256(lo,
+					_mm256_clmulepi64_epi128(b[i], p[i], 0x00));
+			mid = _mm256_xor_si256(mid,
+					_mm256_clmulepi64_epi128(b[i], p[i], 0x10));
+			mid = _mm256_xor_si256(mid,
+					_mm256_clmulepi64_epi128(b[i], p[i], 0x01));
+			hi = _mm256_xor_si256(hi,
+					_mm256_clmulepi64_epi128(b[i], p[i], 0x11));
+		}
+		acc = reduce(
+			_mm_xor_si128(_mm256_castsi256_si128(lo),
+						_mm256_extracti128_si256(lo, 1)),
+			_mm_xor_si128(_mm256_castsi256_si128(mid),
+						_mm256_extracti128_si256(mid, 1)),
+			_mm_xor_si128(_mm256_castsi256_si128(hi),
+						_mm256_extracti128_si256(hi, 1)));
+		d += 4;
+		nblocks -= 8;
+	}
+	_mm_storeu_si128((__m128i *)x, bswap128(acc));
+	if (nblocks) ghash_clmul(g, x, (const unsigned char *)d, nblocks);
+} // ghash_vpclmul()
+#endif
+
+static int unhex(unsigned char *out, const char *hex)
+{
+	int n = 0;
+	while (hex[0] && hex[1]) {
+		unsigned v;
+		sscanf(hex, "%2x", &v);
+		out[n++] = (unsigned char)v;
+		hex += 2;
+	}
+	return n;
+} // unhex()
+
+int gcm_selftest(void)
+{
+	/* Test cases 14 and 16 of the GCM specification, the AES-256 ones
+	 * with and without associated data. Returns 0 on success. */
+	static const char *vec[2][6] = {
+		{ "0000000000000000000000000000000000000000000000000000000000000000",
+		"000000000000000000000000", "",
+		"00000000000000000000000000000000",
+		"cea7403d4d606b6e074ec5d3baf39d18",
+		"d0d1c8a799996bf0265b98b5d48ab919" },
+		{ "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308",
+		"cafebabefacedbaddecaf888",
+		"feedfacedeadbeeffeedfacedeadbeefabaddad2",
+		"d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d"
+		"8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657"
+		"ba637b39",
+		"522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd"
+		"2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0a"
+		"bcc9f662",
+		"76fc6ece0f4e1768cddf8853bb2d551b" }
+	};
+	int v;
+	for (v = 0; v < 2; v++) {
+		gcmctx g;
+		unsigned char key[32], nonce[12], aad[32], pt[64], ct[64];
+		unsigned char out[64], tag[16], wanttag[16];
+		int aadlen, len;
+		unhex(key, vec[v][0]);
+		unhex(nonce, vec[v][1]);
+		aadlen = unhex(aad, vec[v][2]);
+		len = unhex(pt, vec[v][3]);
+		unhex(ct, vec[v][4]);
+		unhex(wanttag, vec[v][5]);
+		gcm_setkey(&g, key);
+		gcm_encrypt(&g, nonce, aad, aadlen, pt, out, len, tag);
+		if (memcmp(out, ct, len) || memcmp(tag, wanttag, 16)) return -1;
+		if (gcm_decrypt(&g, nonce, aad, aadlen, ct, out, len, tag)
+			|| memcmp(out, pt, len)) return -1;
+		tag[0] ^= 1;
+		if (!gcm_decrypt(&g, nonce, aad, aadlen, ct, out, len, tag))
+			return -1;
+	}
+	return 0;
+} // gcm_selftest()
@@ -0,0 +1,53 @@
+/*
+ * gcm.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _GCM_H
+# define _GCM_H
+#include <stdint.h>
+#include <stddef.h>
+#include "aes.h"
+
+/* AES-256-GCM with a 96 bit nonce and a 128 bit tag. GHASH uses
+ * PCLMULQDQ four blocks at a time, VPCLMULQDQ eight at a time, or a
+ * 4 bit table when neither is available.
+*/
+#define GCM_NONCESIZE	12
+#define GCM_TAGSIZE		16
+
+typedef struct gcmctx {
+	aeskey aes;
+	unsigned char hpow[8][16] __attribute__((aligned(16)));
+	uint64_t hl[16];
+	uint64_t hh[16];
+} gcmctx;
+
+void gcm_setkey(gcmctx *g, const unsigned char *key);
+void gcm_encrypt(const gcmctx *g, const unsigned char *nonce,
+				const unsigned char *aad, size_t aadlen,
+				const unsigned char *in, unsigned char *out, size_t len,
+				unsigned char *tag);
+int gcm_decrypt(const gcmctx *g, const unsigned char *nonce,
+				const unsigned char *aad, size_t aadlen,
+				const unsigned char *in, unsigned char *out, size_t len,
+				const unsigned char *tag);
+int gcm_selftest(void);
+const char *gcm_implname(void);
+
+#endif
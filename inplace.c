@@ -0,0 +1,425 @@
+/*      inplace.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "inplace.h"
+#include "sha256.h"
+#include "calc_nonce.h"
+#include "kdf.h"
+
+/* The journal is a JOURNAL_HDRSIZE block followed by the before image
+ * of the region being rewritten, if any. The block:
+ *   0..7    magic "CRYPTJNL"
+ *   8       'e' or 'd', the transform being applied
+ *   9       'r' if that is the rollback of the opposite one, else 0
+ *   16..63  the header and IV, as they go in the trailer
+ *   64..71  length of the data, without the trailer
+ *   72..79  bytes from the start of the file to transform
+ *   80..87  bytes transformed and on disk
+ *   88..95  length of the before image, 0 if none
+ *   96..127 sha256 of the before image
+ *   128..159 sha256 of the pass phrase and IV
+ *   160..167 when rolling back, the range of the run being undone
+ * integers are little endian.
+ * A region is copied to the journal, with its length and digest, and
+ * that is synced before the region itself is overwritten. If the
+ * machine goes down during the overwrite the copy is put back on
+ * recovery. If it goes down while the copy is being written the
+ * digest does not match and the file was not touched yet.
+*/
+#define JOURNAL_MAGIC	"CRYPTJNL"
+#define JOURNAL_HDRSIZE	4096
+
+typedef struct journal {
+	int fd;
+	char op;
+	char rollback;
+	unsigned char trailer[CRYPT_HDRSIZE + CRYPT_IVSIZE];
+	uint64_t datalen;
+	uint64_t range;
+	uint64_t done;
+	uint64_t pending;
+	unsigned char imgsum[32];
+	unsigned char check[32];
+	uint64_t undoing;
+} journal;
+
+static void newjournal(journal *j, const char *jname, int fd,
+						const char *fn, const char *pw,
+						const cryptengine *e, int decrypt);
+static void readjournal(journal *j, const char *jname, const char *pw);
+static void writejournal(journal *j);
+static void recover(journal *j, int fd);
+static void finish(journal *j, int fd);
+static void passcheck(const char *pw, const unsigned char *iv,
+						unsigned char *sum);
+static void syncdir(const char *fn);
+static void put64(unsigned char *p, uint64_t v);
+static uint64_t get64(const unsigned char *p);
+static void readall(int fd, void *buf, size_t len, off_t off);
+static void writeall(int fd, const void *buf, size_t len, off_t off);
+
+void inplace(const char *fn, const char *pw, const cryptengine *e,
+				int flags, int rollback, size_t bufsize)
+{
+	/* Encrypts or decrypts fn in place with e, as flags has
+	 * ENGINE_DECRYPT, resuming or rolling back an earlier run if its
+	 * journal is there. Errors are fatal, the journal is left for
+	 * another go. */
+	char *jname = malloc(strlen(fn) + strlen(JOURNAL_SUFFIX) + 1);
+	cryptheader hdr;
+	segjob job;
+	journal j;
+	char *in, *out;
+	size_t region;
+	int fd;
+
+	if (!jname) {
+		perror("malloc failure in inplace()");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(jname, fn);
+	strcat(jname, JOURNAL_SUFFIX);
+	fd = open(fn, O_RDWR);
+	if (fd == -1) {
+		perror(fn);
+		exit(EXIT_FAILURE);
+	}
+	if (access(jname, F_OK) == 0) {
+		readjournal(&j, jname, pw);
+		if (!rollback && j.rollback) {
+			fprintf(stderr, "%s: an unfinished rollback is in the journal, "
+					"run --rollback again to finish it\n", fn);
+			exit(EXIT_FAILURE);
+		}
+		if (!rollback && j.op != ((flags & ENGINE_DECRYPT) ? 'd' : 'e')) {
+			fprintf(stderr, "%s: an unfinished %s is in the journal, "
+					"finish it or roll it back first\n", fn,
+					(j.op == 'e') ? "encryption" : "decryption");
+			exit(EXIT_FAILURE);
+		}
+	} else if (rollback) {
+		fprintf(stderr, "%s: no journal, nothing to roll back\n", fn);
+		exit(EXIT_FAILURE);
+	} else {
+		newjournal(&j, jname, fd, fn, pw, e, flags & ENGINE_DECRYPT);
+	}
+	recover(&j, fd);
+	if (rollback && !j.rollback) {
+		/* The counter mode transform is its own inverse, so going
+		 * back is the opposite transform over what was done. That is
+		 * recorded, so that a rollback cut short is resumed rather
+		 * than turned round again. */
+		j.op = (j.op == 'e') ? 'd' : 'e';
+		j.rollback = 'r';
+		j.undoing = j.range;
+		j.range = j.done;
+		j.done = 0;
+		writejournal(&j);
+	}
+
+	flags = (flags & ~ENGINE_DECRYPT) | ((j.op == 'd') ? ENGINE_DECRYPT : 0);
+	if (unpackheader(j.trailer, CRYPT_HDRSIZE, &hdr) <= 0
+		|| !(e = engine_byid(hdr.engine))
+		|| engine_setup(&job, e, &hdr, (char *)j.trailer + CRYPT_HDRSIZE,
+						CRYPT_IVSIZE, pw, flags)) {
+		fprintf(stderr, "%s: the journal is inconsistent\n", jname);
+		exit(EXIT_FAILURE);
+	}
+	region = (bufsize / job.inseg) * job.inseg;
+	if (!region) region = job.inseg;
+	in = malloc(region);
+	out = malloc(region);
+	if (!in || !out) {
+		perror("malloc failure in inplace()");
+		exit(EXIT_FAILURE);
+	}
+	while (j.done < j.range) {
+		size_t n = (j.range - j.done < region) ? j.range - j.done
+												: region;
+		uint64_t segno = j.done / job.inseg;
+		size_t off, got;
+		readall(fd, in, n, j.done);
+		// the before image first,
+		writeall(j.fd, in, n, JOURNAL_HDRSIZE);
+		j.pending = n;
+		sha256_buffer(in, n, j.imgsum);
+		writejournal(&j);
+		for (off = 0; off < n; off += job.inseg, segno++) {
+			size_t len = (n - off < job.inseg) ? n - off : job.inseg;
+			job.fn(job.ctx, segno, in + off, len, out + off, &got,
+					j.done + off + len == j.range);
+		}
+		// then the region,
+		writeall(fd, out, n, j.done);
+		if (fdatasync(fd) == -1) {
+			perror(fn);
+			exit(EXIT_FAILURE);
+		}
+		// then the progress.
+		j.done += n;
+		j.pending = 0;
+		writejournal(&j);
+	}
+	engine_finish(&job, e);
+	free(in);
+	free(out);
+	finish(&j, fd);
+	close(fd);
+	close(j.fd);
+	if (unlink(jname) == -1) {
+		perror(jname);
+		exit(EXIT_FAILURE);
+	}
+	syncdir(jname);
+	free(jname);
+} // inplace()
+
+void newjournal(journal *j, const char *jname, int fd, const char *fn,
+				const char *pw, const cryptengine *e, int decrypt)
+{
+	/* Works out the trailer and the range from fn as it is now and
+	 * makes the journal for them. */
+	struct stat sb;
+	cryptheader hdr;
+
+	memset(j, 0, sizeof(journal));
+	if (fstat(fd, &sb) == -1) {
+		perror(fn);
+		exit(EXIT_FAILURE);
+	}
+	if (decrypt) {
+		int res = readtrailer(fd, sb.st_size, &hdr,
+								(char *)j->trailer + CRYPT_HDRSIZE);
+		if (res <= 0) {
+			fprintf(stderr, "%s: %s\n", fn, (res) ? headerwhy(errno)
+							: "not a file encrypted in place");
+			exit(EXIT_FAILURE);
+		}
+		e = engine_byid(hdr.engine);
+		j->datalen = sb.st_size - sizeof(j->trailer);
+	} else {
+		initheader(&hdr);
+		hdr.engine = e->id;
+		hdr.flags = CRYPT_TRAILER;
+		calc_nonce((char *)j->trailer + CRYPT_HDRSIZE);
+		kdf_prepare(pw, &hdr, (char *)j->trailer + CRYPT_HDRSIZE);
+		j->datalen = sb.st_size;
+	}
+	if (!e || e->overhead || !(e->props & ENGINE_SEEKABLE)) {
+		fprintf(stderr, "In place needs a cipher that keeps the "
+				"length, eg sha256-ctr\n");
+		exit(EXIT_FAILURE);
+	}
+	packheader(&hdr, j->trailer);
+	j->op = (decrypt) ? 'd' : 'e';
+	j->range = j->datalen;
+	passcheck(pw, j->trailer + CRYPT_HDRSIZE, j->check);
+	j->fd = open(jname, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (j->fd == -1) {
+		perror(jname);
+		exit(EXIT_FAILURE);
+	}
+	writejournal(j);
+	syncdir(jname);
+} // newjournal()
+
+void readjournal(journal *j, const char *jname, const char *pw)
+{
+	unsigned char buf[JOURNAL_HDRSIZE];
+	unsigned char check[32];
+
+	memset(j, 0, sizeof(journal));
+	j->fd = open(jname, O_RDWR);
+	if (j->fd == -1) {
+		perror(jname);
+		exit(EXIT_FAILURE);
+	}
+	readall(j->fd, buf, sizeof(buf), 0);
+	if (memcmp(buf, JOURNAL_MAGIC, 8) != 0
+		|| (buf[8] != 'e' && buf[8] != 'd')
+		|| (buf[9] != 0 && buf[9] != 'r')) {
+		fprintf(stderr, "%s: not a crypt journal\n", jname);
+		exit(EXIT_FAILURE);
+	}
+	j->op = buf[8];
+	j->rollback = buf[9];
+	memcpy(j->trailer, buf + 16, sizeof(j->trailer));
+	j->datalen = get64(buf + 64);
+	j->range = get64(buf + 72);
+	j->done = get64(buf + 80);
+	j->pending = get64(buf + 88);
+	memcpy(j->imgsum, buf + 96, 32);
+	memcpy(j->check, buf + 128, 32);
+	j->undoing = get64(buf + 160);
+	if (j->range > j->datalen || j->done > j->range
+		|| (j->rollback && j->range > j->undoing)) {
+		fprintf(stderr, "%s: the journal is inconsistent\n", jname);
+		exit(EXIT_FAILURE);
+	}
+	passcheck(pw, j->trailer + CRYPT_HDRSIZE, check);
+	if (memcmp(check, j->check, 32) != 0) {
+		fprintf(stderr, "%s: the pass phrase is not the one this "
+				"journal was started with\n", jname);
+		exit(EXIT_FAILURE);
+	}
+} // readjournal()
+
+void writejournal(journal *j)
+{
+	// The whole block in one write, it fits in the first page.
+	unsigned char buf[168];
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, JOURNAL_MAGIC, 8);
+	buf[8] = j->op;
+	buf[9] = j->rollback;
+	memcpy(buf + 16, j->trailer, sizeof(j->trailer));
+	put64(buf + 64, j->datalen);
+	put64(buf + 72, j->range);
+	put64(buf + 80, j->done);
+	put64(buf + 88, j->pending);
+	memcpy(buf + 96, j->imgsum, 32);
+	memcpy(buf + 128, j->check, 32);
+	put64(buf + 160, j->undoing);
+	writeall(j->fd, buf, sizeof(buf), 0);
+	if (fdatasync(j->fd) == -1) {
+		perror("journal");
+		exit(EXIT_FAILURE);
+	}
+} // writejournal()
+
+void recover(journal *j, int fd)
+{
+	/* Puts back the region that was being rewritten when the last run
+	 * stopped, if its copy in the journal is whole. */
+	unsigned char sum[32];
+	char *img;
+
+	if (!j->pending) return;
+	img = malloc(j->pending);
+	if (!img) {
+		perror("malloc failure in recover()");
+		exit(EXIT_FAILURE);
+	}
+	readall(j->fd, img, j->pending, JOURNAL_HDRSIZE);
+	sha256_buffer(img, j->pending, sum);
+	if (memcmp(sum, j->imgsum, 32) == 0) {
+		writeall(fd, img, j->pending, j->done);
+		if (fdatasync(fd) == -1) {
+			perror("recover");
+			exit(EXIT_FAILURE);
+		}
+	}
+	free(img);
+	j->pending = 0;
+	writejournal(j);
+} // recover()
+
+void finish(journal *j, int fd)
+{
+	/* Adds or removes the trailer. Either can be repeated, so a crash
+	 * before the journal is gone does no harm. */
+	off_t size = j->datalen;
+	if (j->op == 'e') {
+		writeall(fd, j->trailer, sizeof(j->trailer), j->datalen);
+		size += sizeof(j->trailer);
+	}
+	if (ftruncate(fd, size) == -1 || fsync(fd) == -1) {
+		perror("finish");
+		exit(EXIT_FAILURE);
+	}
+} // finish()
+
+void passcheck(const char *pw, const unsigned char *iv,
+				unsigned char *sum)
+{
+	/* So that a run is not resumed with a different pass phrase,
+	 * which would leave the file in two keys. */
+	struct sha256_ctx ctx;
+	sha256_init_ctx(&ctx);
+	sha256_process_bytes(pw, strlen(pw), &ctx);
+	sha256_process_bytes(iv, CRYPT_IVSIZE, &ctx);
+	sha256_finish_ctx(&ctx, sum);
+} // passcheck()
+
+void syncdir(const char *fn)
+{
+	// Makes the creation or removal of fn durable.
+	char *copy = strdup(fn);
+	int dfd;
+	if (!copy) return;
+	dfd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+	if (dfd != -1) {
+		(void)fsync(dfd);
+		close(dfd);
+	}
+	free(copy);
+} // syncdir()
+
+void put64(unsigned char *p, uint64_t v)
+{
+	int i;
+	for (i = 0; i < 8; i++) p[i] = v >> (8 * i);
+} // put64()
+
+uint64_t get64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+	for (i = 7; i >= 0; i--) v = (v << 8) | p[i];
+	return v;
+} // get64()
+
+void readall(int fd, void *buf, size_t len, off_t off)
+{
+	size_t got = 0;
+	while (got < len) {
+		ssize_t n = pread(fd, (char *)buf + got, len - got, off + got);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) {
+			if (n) perror("read");
+			else fputs("Unexpected end of file\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		got += n;
+	}
+} // readall()
+
+void writeall(int fd, const void *buf, size_t len, off_t off)
+{
+	size_t put = 0;
+	while (put < len) {
+		ssize_t n = pwrite(fd, (const char *)buf + put, len - put,
+							off + put);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) {
+			perror("write");
+			exit(EXIT_FAILURE);
+		}
+		put += n;
+	}
+} // writeall()
@@ -0,0 +1,43 @@
+/*
+ * inplace.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _INPLACE_H
+# define _INPLACE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "engine.h"
+#include "cryptheader.h"
+
+/* crypt -i. The file is transformed region by region through its own
+ * descriptor, so only a cipher that keeps the length can be used, and
+ * the header and IV are written after the data instead of before it.
+ * Progress is kept in a journal beside the file, fn.cjournal, which
+ * also holds a copy of the region being rewritten. A run that is cut
+ * short is resumed by running the same command again, or undone back
+ * to the file as it was with rollback set.
+*/
+#define JOURNAL_SUFFIX	".cjournal"
+
+void inplace(const char *fn, const char *pw, const cryptengine *e,
+				int flags, int rollback, size_t bufsize);
+
+#endif
@@ -0,0 +1,54 @@
+#!/bin/sh
+# inplacecheck.sh, run by make check.
+# An in place run and then its rollback are both killed part way, and
+# the rollback is run again to the end. The file must be as it was.
+# Exits 77, skipped, if a run finishes before it can be killed.
+
+CRYPT=${CRYPT:-./crypt}
+T=${TMPDIR:-/tmp}/inplacecheck.$$
+trap 'rm -rf "$T"' EXIT
+mkdir "$T" || exit 1
+
+progress()
+{
+	# at least $1 16M units done by the journal, which is little
+	# endian, and if $2 its range cut to what the first run did, as
+	# a rollback has it.
+	[ -f "$T/f.cjournal" ] || return 1
+	[ "$(od -An -tu1 -j83 -N1 "$T/f.cjournal" | tr -d ' ')" -ge "$1" ] \
+		2>/dev/null || return 1
+	[ -z "$2" ] \
+		|| [ "$(od -An -tu1 -j75 -N1 "$T/f.cjournal" | tr -d ' ')" -lt 8 ]
+}
+
+killpart()
+{
+	# runs crypt with the arguments after $1 and $2 and kills it once
+	# progress $1 $2 is true.
+	min=$1; want=$2; shift 2
+	"$CRYPT" "$@" -b 64K "$T/f" pw >/dev/null 2>&1 &
+	pid=$!
+	while ! progress "$min" "$want"; do
+		kill -0 $pid 2>/dev/null || { wait $pid; exit 77; }
+	done
+	kill -9 $pid
+	wait $pid 2>/dev/null
+	return 0
+}
+
+check()
+{
+	# $1 the transform to interrupt, -i or -i -d.
+	cp "$T/f" "$T/ref"
+	killpart 6 "" --kdf-time=0 $1
+	killpart 1 y --rollback
+	"$CRYPT" --rollback "$T/f" pw || { echo "$1: rollback failed"; exit 1; }
+	[ ! -f "$T/f.cjournal" ] || { echo "$1: journal left"; exit 1; }
+	cmp "$T/f" "$T/ref" || { echo "$1: not rolled back"; exit 1; }
+}
+
+head -c 134217728 /dev/urandom > "$T/f"
+check "-i"
+"$CRYPT" --kdf-time=0 -i "$T/f" pw || exit 1
+check "-i -d"
+exit 0
@@ -0,0 +1,310 @@
+/*      kdf.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "kdf.h"
+#include "sha256.h"
+
+static kdfentry *lookup(const unsigned char *pwsum,
+						const unsigned char *salt, uint32_t iterations);
+static kdfentry *derive(const char *pw, const unsigned char *pwsum,
+						const unsigned char *salt, uint32_t iterations);
+
+static kdfentry cache[KDF_CACHE];
+static int ncached, nextslot;
+static unsigned kdfmsecs = KDF_MSECS;
+static uint32_t runcost;	// this run's calibrated count, 0 until used.
+static pthread_mutex_t kdflock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kdfdone = PTHREAD_COND_INITIALIZER;
+
+void pbkdf2_sha256(const char *pw, size_t pwlen,
+					const unsigned char *salt, size_t saltlen,
+					uint32_t iterations, unsigned char *out,
+					size_t outlen)
+{
+	/* RFC 8018 with HMAC-SHA256 as the PRF. The two pads are hashed
+	 * once, after which every iteration is a single block compressed
+	 * from a copy of each, the 32 byte message already padded out as
+	 * sha256 would pad it. The blocks are words for the portable
+	 * sha256_process_block(). */
+	uint32_t kw[16], padw[16], blockw[16];
+	unsigned char *k = (unsigned char *)kw, *pad = (unsigned char *)padw;
+	unsigned char *block = (unsigned char *)blockw;
+	unsigned char u[32], t[32], be[4];
+	struct sha256_ctx inner, outer, c;
+	uint32_t blockno, i;
+	size_t n;
+
+	memset(k, 0, 64);
+	if (pwlen > 64) {
+		sha256_buffer(pw, pwlen, k);
+	} else {
+		memcpy(k, pw, pwlen);
+	}
+	for (i = 0; i < 64; i++) pad[i] = k[i] ^ 0x36;
+	sha256_init_ctx(&inner);
+	sha256_process_block(pad, 64, &inner);
+	for (i = 0; i < 64; i++) pad[i] = k[i] ^ 0x5c;
+	sha256_init_ctx(&outer);
+	sha256_process_block(pad, 64, &outer);
+	memset(block, 0, 64);
+	block[32] = 0x80;
+	block[62] = 0x03;	// 768 bits, the pad block and the message.
+
+	for (blockno = 1; outlen; blockno++) {
+		for (i = 0; i < 4; i++) {
+			be[i] = (unsigned char)(blockno >> (24 - 8 * i));
+		}
+		c = inner;
+		sha256_process_bytes(salt, saltlen, &c);
+		sha256_process_bytes(be, 4, &c);
+		sha256_finish_ctx(&c, u);
+		c = outer;
+		sha256_process_bytes(u, 32, &c);
+		sha256_finish_ctx(&c, u);
+		memcpy(t, u, 32);
+		for (i = 1; i < iterations; i++) {
+			int j;
+			memcpy(block, u, 32);
+			c = inner;
+			sha256_process_block(block, 64, &c);
+			sha256_read_ctx(&c, block);
+			c = outer;
+			sha256_process_block(block, 64, &c);
+			sha256_read_ctx(&c, u);
+			for (j = 0; j < 32; j++) t[j] ^= u[j];
+		}
+		n = (outlen < 32) ? outlen : 32;
+		memcpy(out, t, n);
+		out += n;
+		outlen -= n;
+	}
+	// all of it is key material.
+	memset(kw, 0, sizeof(kw));
+	memset(padw, 0, sizeof(padw));
+	memset(blockw, 0, sizeof(blockw));
+	memset(u, 0, sizeof(u));
+	memset(t, 0, sizeof(t));
+	memset(&inner, 0, sizeof(inner));
+	memset(&outer, 0, sizeof(outer));
+	memset(&c, 0, sizeof(c));
+} // pbkdf2_sha256()
+
+void kdf_settime(unsigned msecs)
+{
+	/* The time that the derivation for new files should take, 0 for
+	 * none at all, the version 2 key. */
+	pthread_mutex_lock(&kdflock);
+	kdfmsecs = msecs;
+	runcost = 0;
+	pthread_mutex_unlock(&kdflock);
+} // kdf_settime()
+
+unsigned kdf_gettime(void)
+{
+	// what kdf_settime() was last given, KDF_MSECS if nothing.
+	unsigned msecs;
+	pthread_mutex_lock(&kdflock);
+	msecs = kdfmsecs;
+	pthread_mutex_unlock(&kdflock);
+	return msecs;
+} // kdf_gettime()
+
+uint32_t kdf_calibrate(unsigned msecs)
+{
+	/* The iteration count that takes about msecs here. Doubles a trial
+	 * count until it takes long enough to time and scales from that.
+	 * A derivation that gets the wrong answer would write files that
+	 * can't be read, so it is checked first. */
+	struct timespec t0, t1;
+	unsigned char out[32];
+	uint32_t n = 1000;
+	double secs, want;
+
+	if (kdf_selftest()) {
+		fprintf(stderr, "pbkdf2-sha256 failed its self test\n");
+		exit(EXIT_FAILURE);
+	}
+	while (1) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		pbkdf2_sha256("calibrate", 9, (const unsigned char *)"salt", 4,
+						n, out, sizeof(out));
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+		if (secs >= 0.02 || n >= UINT32_MAX / 2) break;
+		n *= 2;
+	}
+	want = n * (msecs / 1000.0) / secs;
+	if (want < 1) want = 1;
+	if (want > KDF_MAXCOST) want = KDF_MAXCOST;
+	return (uint32_t)want;
+} // kdf_calibrate()
+
+void kdf_prepare(const char *pw, cryptheader *hdr, char *iv)
+{
+	/* For a new file, hdr and the CRYPT_IVSIZE bytes of iv already
+	 * made. Sets the derivation in hdr, and when this pass phrase has
+	 * already been used for a file in this run, gives iv that file's
+	 * salt. */
+	unsigned char pwsum[32];
+	kdfentry *ke;
+
+	pthread_mutex_lock(&kdflock);
+	if (!kdfmsecs) {
+		hdr->kdf = KDF_NONE;
+		hdr->kdfcost = 0;
+		pthread_mutex_unlock(&kdflock);
+		return;
+	}
+	if (!runcost) runcost = kdf_calibrate(kdfmsecs);
+	hdr->kdf = KDF_PBKDF2;
+	hdr->kdfcost = runcost;
+	sha256_buffer(pw, strlen(pw), pwsum);
+	for (ke = cache; ke < cache + ncached; ke++) {
+		if (memcmp(ke->pwsum, pwsum, 32) == 0
+			&& ke->iterations == runcost) break;
+	}
+	if (ke < cache + ncached) {
+		memcpy(iv, ke->salt, KDF_SALTSIZE);
+	} else {
+		(void)derive(pw, pwsum, (const unsigned char *)iv, runcost);
+	}
+	pthread_mutex_unlock(&kdflock);
+	memset(pwsum, 0, sizeof(pwsum));
+} // kdf_prepare()
+
+const char *kdf_key(const char *pw, const cryptheader *hdr,
+					const char *iv, char *key)
+{
+	/* What the engines should be keyed with for a file with hdr and
+	 * iv, pw itself unless hdr names a derivation, when it is put in
+	 * key, which must hold KDF_KEYSIZE bytes. hdr may be NULL for the
+	 * legacy format. Returns NULL, errno EINVAL, for a derivation not
+	 * known here or a cost over KDF_MAXCOST, which unpackheader() has
+	 * already refused. */
+	const unsigned char *salt = (const unsigned char *)iv;
+	unsigned char pwsum[32];
+	kdfentry *ke;
+
+	if (!hdr || hdr->kdf == KDF_NONE) return pw;
+	if (hdr->kdf != KDF_PBKDF2 || !hdr->kdfcost
+		|| hdr->kdfcost > KDF_MAXCOST) {
+		errno = EINVAL;
+		return NULL;
+	}
+	sha256_buffer(pw, strlen(pw), pwsum);
+	pthread_mutex_lock(&kdflock);
+	while ((ke = lookup(pwsum, salt, hdr->kdfcost)) && !ke->ready) {
+		pthread_cond_wait(&kdfdone, &kdflock);
+	}
+	if (!ke) ke = derive(pw, pwsum, salt, hdr->kdfcost);
+	memcpy(key, ke->key, KDF_KEYSIZE);
+	pthread_mutex_unlock(&kdflock);
+	memset(pwsum, 0, sizeof(pwsum));
+	return key;
+} // kdf_key()
+
+void kdf_forget(void)
+{
+	// wipes the cache, eg at exit.
+	pthread_mutex_lock(&kdflock);
+	memset(cache, 0, sizeof(cache));
+	ncached = nextslot = 0;
+	pthread_mutex_unlock(&kdflock);
+} // kdf_forget()
+
+int kdf_selftest(void)
+{
+	/* RFC 7914 section 11, which gives PBKDF2-HMAC-SHA256 vectors for
+	 * use by scrypt. 64 bytes, so two blocks. */
+	static const unsigned char want[64] = {
+		0x55, 0xac, 0x04, 0x6e, 0x56, 0xe3, 0x08, 0x9f,
+		0xec, 0x16, 0x91, 0xc2, 0x25, 0x44, 0xb6, 0x05,
+		0xf9, 0x41, 0x85, 0x21, 0x6d, 0xde, 0x04, 0x65,
+		0xe6, 0x8b, 0x9d, 0x57, 0xc2, 0x0d, 0xac, 0xbc,
+		0x49, 0xca, 0x9c, 0xcc, 0xf1, 0x79, 0xb6, 0x45,
+		0x99, 0x16, 0x64, 0xb3, 0x9d, 0x77, 0xef, 0x31,
+		0x7c, 0x71, 0xb8, 0x45, 0xb1, 0xe3, 0x0b, 0xd5,
+		0x09, 0x11, 0x20, 0x41, 0xd3, 0xa1, 0x97, 0x83
+	};
+	unsigned char out[64];
+	pbkdf2_sha256("passwd", 6, (const unsigned char *)"salt", 4, 1, out,
+					sizeof(out));
+	return memcmp(out, want, sizeof(out)) ? -1 : 0;
+} // kdf_selftest()
+
+kdfentry *lookup(const unsigned char *pwsum, const unsigned char *salt,
+					uint32_t iterations)
+{
+	// called with kdflock held.
+	int i;
+	for (i = 0; i < ncached; i++) {
+		if (memcmp(cache[i].pwsum, pwsum, 32) == 0
+			&& memcmp(cache[i].salt, salt, KDF_SALTSIZE) == 0
+			&& cache[i].iterations == iterations) return &cache[i];
+	}
+	return NULL;
+} // lookup()
+
+kdfentry *derive(const char *pw, const unsigned char *pwsum,
+					const unsigned char *salt, uint32_t iterations)
+{
+	/* Called with kdflock held and returns with it held and the
+	 * entry ready. The entry is made first, so that other threads
+	 * wanting the same key find it and wait, and the lock is dropped
+	 * while the key is derived. The oldest ready entry goes when the
+	 * cache is full. */
+	static const char digits[] = "0123456789abcdef";
+	unsigned char dk[32];
+	kdfentry *ke = NULL;
+	int i;
+
+	while (!ke) {
+		if (ncached < KDF_CACHE) {
+			ke = &cache[ncached++];
+			break;
+		}
+		for (i = 0; i < KDF_CACHE && !ke; i++) {
+			if (cache[nextslot].ready) ke = &cache[nextslot];
+			nextslot = (nextslot + 1) % KDF_CACHE;
+		}
+		if (!ke) pthread_cond_wait(&kdfdone, &kdflock);
+	}
+	memcpy(ke->pwsum, pwsum, 32);
+	memcpy(ke->salt, salt, KDF_SALTSIZE);
+	ke->iterations = iterations;
+	ke->ready = 0;
+	pthread_mutex_unlock(&kdflock);
+	pbkdf2_sha256(pw, strlen(pw), salt, KDF_SALTSIZE, iterations, dk,
+					sizeof(dk));
+	pthread_mutex_lock(&kdflock);
+	for (i = 0; i < 32; i++) {
+		ke->key[2 * i] = digits[dk[i] >> 4];
+		ke->key[2 * i + 1] = digits[dk[i] & 15];
+	}
+	ke->key[64] = '\0';
+	ke->ready = 1;
+	pthread_cond_broadcast(&kdfdone);
+	memset(dk, 0, sizeof(dk));
+	return ke;
+} // derive()
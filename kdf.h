@@ -0,0 +1,73 @@
+/*
+ * kdf.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _KDF_H
+# define _KDF_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "cryptheader.h"
+
+/* Pass phrase stretching. From format version 3 the pass phrase is
+ * first put through PBKDF2-HMAC-SHA256, with an iteration count
+ * calibrated to take about kdf_settime() milliseconds on the machine
+ * that encrypts, and the result in hex takes its place in the key set
+ * up of the engines. The count is in the header and the salt is the
+ * first KDF_SALTSIZE bytes of the IV. The count is at most
+ * KDF_MAXCOST, some seconds to a few minutes of work, and a header
+ * asking for more is refused rather than tying up whoever opens it.
+ * Derived keys are kept for the life of the process, found by a hash
+ * of the pass phrase, the salt and the count. A run that encrypts a
+ * number of files with one pass phrase gives them all the same salt,
+ * so decrypting them, or doing anything else with them in one run,
+ * costs one derivation. The rest of the IV still makes every file's
+ * key its own. Threads wanting different keys derive them at the same
+ * time, those wanting one that is being derived wait for it.
+*/
+#define KDF_NONE		0	// the header kdf byte, the version 2 key.
+#define KDF_PBKDF2		1
+#define KDF_SALTSIZE	16
+#define KDF_KEYSIZE		65	// 64 hex digits and '\0'
+#define KDF_MSECS		250	// default time to take.
+#define KDF_MAXCOST		(1u << 28)	// iterations.
+#define KDF_CACHE		16
+
+typedef struct kdfentry {
+	unsigned char pwsum[32];	// sha256 of the pass phrase.
+	unsigned char salt[KDF_SALTSIZE];
+	uint32_t iterations;
+	char key[KDF_KEYSIZE];
+	int ready;		// 0 while a thread is deriving key.
+} kdfentry;
+
+void pbkdf2_sha256(const char *pw, size_t pwlen,
+					const unsigned char *salt, size_t saltlen,
+					uint32_t iterations, unsigned char *out,
+					size_t outlen);
+void kdf_settime(unsigned msecs);
+unsigned kdf_gettime(void);
+uint32_t kdf_calibrate(unsigned msecs);
+void kdf_prepare(const char *pw, cryptheader *hdr, char *iv);
+const char *kdf_key(const char *pw, const cryptheader *hdr,
+					const char *iv, char *key);
+void kdf_forget(void);
+int kdf_selftest(void);
+
+#endif
@@ -0,0 +1,305 @@
+/*      legacychain.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "legacychain.h"
+#include "sha256.h"
+#include "cpufeatures.h"
+#ifdef CRYPT_X86
+#include <immintrin.h>
+#endif
+
+/* What the chain hashes is not quite the hex of the last sum.
+ * calcsha256sum() has always been called with its input and output
+ * the same buffer and it clears the first byte of the output before
+ * hashing, so the first hex digit is hashed as '\0'. The same goes for
+ * the iv at the start. */
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t kc[64] __attribute__((aligned(16))) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t iv0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static uint32_t padwk[64] __attribute__((aligned(16)));
+static uint16_t hexpair[256];	// two ascii digits, big endian.
+static pthread_once_t tablesonce = PTHREAD_ONCE_INIT;
+
+static void maketables(void);
+static void compress(uint32_t *st, const uint32_t *w);
+static void rounds(uint32_t *st, const uint32_t *wk);
+static void step_c(uint32_t *st);
+#ifdef CRYPT_X86
+static void step_shani(uint32_t *st);
+#endif
+
+void maketables(void)
+{
+	/* The padding block of a 64 byte message is 0x80, zeroes and the
+	 * length in bits, 512. Its schedule, with the round constants
+	 * added, never changes. */
+	static const char digits[] = "0123456789abcdef";
+	uint32_t w[64];
+	int t;
+	memset(w, 0, sizeof(w));
+	w[0] = 0x80000000;
+	w[15] = 512;
+	for (t = 16; t < 64; t++) {
+		uint32_t s0 = ROR32(w[t - 15], 7) ^ ROR32(w[t - 15], 18)
+					^ (w[t - 15] >> 3);
+		uint32_t s1 = ROR32(w[t - 2], 17) ^ ROR32(w[t - 2], 19)
+					^ (w[t - 2] >> 10);
+		w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+	}
+	for (t = 0; t < 64; t++) padwk[t] = w[t] + kc[t];
+	for (t = 0; t < 256; t++) {
+		hexpair[t] = (uint16_t)((digits[t >> 4] << 8) | digits[t & 15]);
+	}
+} // maketables()
+
+void legacychain_start(legacychain *lc, const char *iv, size_t ivsize,
+						const char *pw)
+{
+	/* The first block, sha256(iv || pw), the first byte cleared. */
+	size_t pwlen = strlen(pw);
+	char *wrk = malloc(ivsize + pwlen);
+	unsigned char sum[32];
+	int i;
+
+	pthread_once(&tablesonce, maketables);
+	if (!wrk) {
+		perror("malloc failure in legacychain_start()");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(wrk, iv, ivsize);	// iv may have embedded '\0'
+	memcpy(wrk + ivsize, pw, pwlen);
+	wrk[0] = '\0';
+	sha256_buffer(wrk, ivsize + pwlen, sum);
+	memset(wrk, 0, ivsize + pwlen);
+	free(wrk);
+	for (i = 0; i < 8; i++) {
+		lc->st[i] = ((uint32_t)sum[4 * i] << 24)
+					| ((uint32_t)sum[4 * i + 1] << 16)
+					| ((uint32_t)sum[4 * i + 2] << 8) | sum[4 * i + 3];
+	}
+} // legacychain_start()
+
+void legacychain_next(legacychain *lc)
+{
+#ifdef CRYPT_X86
+	unsigned f = cpufeatures();
+	if ((f & CPU_SHANI) && (f & CPU_SSE41)) {
+		step_shani(lc->st);
+		return;
+	}
+#endif
+	step_c(lc->st);
+} // legacychain_next()
+
+void legacychain_block(const legacychain *lc, unsigned char *out)
+{
+	// the 32 bytes of keystream.
+	int i;
+	for (i = 0; i < 8; i++) {
+		out[4 * i] = (unsigned char)(lc->st[i] >> 24);
+		out[4 * i + 1] = (unsigned char)(lc->st[i] >> 16);
+		out[4 * i + 2] = (unsigned char)(lc->st[i] >> 8);
+		out[4 * i + 3] = (unsigned char)lc->st[i];
+	}
+} // legacychain_block()
+
+void legacychain_hex(const legacychain *lc, char *hex)
+{
+	/* The 64 hex digits and a '\0', what calcsha256sum() would have
+	 * left in its sum. */
+	int i;
+	for (i = 0; i < 8; i++) {
+		int j;
+		for (j = 0; j < 4; j++) {
+			uint16_t p = hexpair[(lc->st[i] >> (24 - 8 * j)) & 0xff];
+			hex[8 * i + 2 * j] = (char)(p >> 8);
+			hex[8 * i + 2 * j + 1] = (char)p;
+		}
+	}
+	hex[64] = '\0';
+} // legacychain_hex()
+
+const char *legacychain_implname(void)
+{
+#ifdef CRYPT_X86
+	unsigned f = cpufeatures();
+	if ((f & CPU_SHANI) && (f & CPU_SSE41)) return "sha-ni";
+#endif
+	return "portable";
+} // legacychain_implname()
+
+static inline void hexwords(const uint32_t *st, uint32_t *w)
+{
+	/* The message words of the hex of st, each state word gives two,
+	 * and the first digit cleared. */
+	int i;
+	for (i = 0; i < 8; i++) {
+		w[2 * i] = ((uint32_t)hexpair[st[i] >> 24] << 16)
+					| hexpair[(st[i] >> 16) & 0xff];
+		w[2 * i + 1] = ((uint32_t)hexpair[(st[i] >> 8) & 0xff] << 16)
+					| hexpair[st[i] & 0xff];
+	}
+	w[0] &= 0x00ffffff;
+} // hexwords()
+
+void rounds(uint32_t *st, const uint32_t *wk)
+{
+	// 64 rounds with the schedule and constants already added.
+	uint32_t a = st[0], b = st[1], c = st[2], d = st[3];
+	uint32_t e = st[4], f = st[5], g = st[6], h = st[7];
+	int t;
+	for (t = 0; t < 64; t++) {
+		uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25))
+					+ (g ^ (e & (f ^ g))) + wk[t];
+		uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22))
+					+ ((a & b) | (c & (a | b)));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	st[0] += a;
+	st[1] += b;
+	st[2] += c;
+	st[3] += d;
+	st[4] += e;
+	st[5] += f;
+	st[6] += g;
+	st[7] += h;
+} // rounds()
+
+void compress(uint32_t *st, const uint32_t *w)
+{
+	uint32_t wk[64];
+	uint32_t x[64];
+	int t;
+	memcpy(x, w, 16 * sizeof(uint32_t));
+	for (t = 16; t < 64; t++) {
+		uint32_t s0 = ROR32(x[t - 15], 7) ^ ROR32(x[t - 15], 18)
+					^ (x[t - 15] >> 3);
+		uint32_t s1 = ROR32(x[t - 2], 17) ^ ROR32(x[t - 2], 19)
+					^ (x[t - 2] >> 10);
+		x[t] = x[t - 16] + s0 + x[t - 7] + s1;
+	}
+	for (t = 0; t < 64; t++) wk[t] = x[t] + kc[t];
+	rounds(st, wk);
+} // compress()
+
+void step_c(uint32_t *st)
+{
+	uint32_t w[16];
+	hexwords(st, w);
+	memcpy(st, iv0, sizeof(iv0));
+	compress(st, w);
+	rounds(st, padwk);
+} // step_c()
+
+#ifdef CRYPT_X86
+__attribute__((target("sha,sse4.1")))
+void step_shani(uint32_t *st)
+{
+	/* Both blocks in the SHA extensions. The message words come
+	 * straight from the hex table, no byte swapping, and the padding
+	 * block needs no MSG1/MSG2 at all. */
+	uint32_t w[16] __attribute__((aligned(16)));
+	__m128i st0, st1, tmp, msg, m[4], save0, save1;
+	int g;
+
+	hexwords(st, w);
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)iv0), 0xb1);
+	st1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(iv0 + 4)),
+							0x1b);
+	st0 = _mm_alignr_epi8(tmp, st1, 8);			// ABEF
+	st1 = _mm_blend_epi16(st1, tmp, 0xf0);		// CDGH
+	save0 = st0;
+	save1 = st1;
+#pragma GCC unroll 16
+	for (g = 0; g < 16; g++) {
+		if (g < 4) m[g] = _mm_load_si128((const __m128i *)(w + 4 * g));
+		msg = _mm_add_epi32(m[g & 3],
+					_mm_load_si128((const __m128i *)(kc + 4 * g)));
+		st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+		if (g >= 3 && g <= 14) {
+			tmp = _mm_alignr_epi8(m[g & 3], m[(g - 1) & 3], 4);
+			m[(g + 1) & 3] = _mm_add_epi32(m[(g + 1) & 3], tmp);
+			m[(g + 1) & 3] = _mm_sha256msg2_epu32(m[(g + 1) & 3],
+												m[g & 3]);
+		}
+		msg = _mm_shuffle_epi32(msg, 0x0e);
+		st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+		if (g >= 1 && g <= 12) {
+			m[(g - 1) & 3] = _mm_sha256msg1_epu32(m[(g - 1) & 3],
+												m[g & 3]);
+		}
+	}
+	st0 = _mm_add_epi32(st0, save0);
+	st1 = _mm_add_epi32(st1, save1);
+	save0 = st0;
+	save1 = st1;
+#pragma GCC unroll 16
+	for (g = 0; g < 16; g++) {
+		msg = _mm_load_si128((const __m128i *)(padwk + 4 * g));
+		st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+		msg = _mm_shuffle_epi32(msg, 0x0e);
+		st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+	}
+	st0 = _mm_add_epi32(st0, save0);
+	st1 = _mm_add_epi32(st1, save1);
+
+	tmp = _mm_shuffle_epi32(st0, 0x1b);			// FEBA
+	st1 = _mm_shuffle_epi32(st1, 0xb1);			// DCHG
+	st0 = _mm_blend_epi16(tmp, st1, 0xf0);		// DCBA
+	st1 = _mm_alignr_epi8(st1, tmp, 8);			// HGFE
+	_mm_storeu_si128((__m128i *)st, st0);
+	_mm_storeu_si128((__m128i *)(st + 4), st1);
+} // step_shani()
+#endif
@@ -0,0 +1,45 @@
+/*
+ * legacychain.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _LEGACYCHAIN_H
+# define _LEGACYCHAIN_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* The keystream of the legacy chained format, one step at a time.
+ * Every step hashes exactly 64 bytes of hex, so the second compression
+ * block is always the same padding and its schedule is worked out
+ * once, and the hex is made from the state words with a table rather
+ * than going through bytes and sprintf(). The chain is kept as the
+ * eight state words; the bytes and the hex are only produced when
+ * asked for.
+*/
+typedef struct legacychain {
+	uint32_t st[8];
+} legacychain;
+
+void legacychain_start(legacychain *lc, const char *iv, size_t ivsize,
+						const char *pw);
+void legacychain_next(legacychain *lc);
+void legacychain_block(const legacychain *lc, unsigned char *out);
+void legacychain_hex(const legacychain *lc, char *hex);
+const char *legacychain_implname(void);
+
+#endif
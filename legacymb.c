@@ -0,0 +1,203 @@
+/*      legacymb.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "legacymb.h"
+#include "cryptheader.h"
+#include "legacychain.h"
+#include "sha256mb.h"
+
+typedef struct lane {
+	legacyjob *job;
+	FILE *fpi, *fpo;
+	char pwbuf[65];			// hex format of the last sum.
+	unsigned char brp[32];	// the next block of keystream.
+	unsigned char *buf;
+	size_t have;
+} lane;
+
+static int startlane(lane *l, legacyjob *job, size_t ivsize);
+static void endlane(lane *l, int res, legacydone done);
+static void advance(lane **ls, int n);
+
+int islegacyfile(const char *fn)
+{
+	/* 1 if fn can be read and has no version 2 header, at the front
+	 * or as the trailer of a file encrypted in place. */
+	unsigned char hbuf[CRYPT_HDRSIZE];
+	char iv[CRYPT_IVSIZE];
+	cryptheader hdr;
+	struct stat sb;
+	size_t x;
+	int res;
+	FILE *fp = fopen(fn, "r");
+	if (!fp) return 0;
+	x = fread(hbuf, 1, CRYPT_HDRSIZE, fp);
+	res = !unpackheader(hbuf, x, &hdr);
+	if (res && fstat(fileno(fp), &sb) == 0
+		&& readtrailer(fileno(fp), sb.st_size, &hdr, iv)) res = 0;
+	fclose(fp);
+	return res;
+} // islegacyfile()
+
+void legacy_batch(legacyjob *jobs, size_t n, size_t ivsize,
+					legacydone done)
+{
+	/* Every round reads a chunk of each file in progress, then works
+	 * through the chunks one keystream block at a time, advancing all
+	 * the chains that still need one in a single sha256mb call. A
+	 * file that comes up short is finished and its lane goes to the
+	 * next job. Each job's res is set and done, if not NULL, called
+	 * with it as it finishes or fails. */
+	int nlanes = sha256mb_lanes();
+	lane lanes[SHA256MB_MAXLANES];
+	size_t next = 0;
+	int i;
+
+	memset(lanes, 0, sizeof(lanes));
+	for (i = 0; i < nlanes; i++) {
+		lanes[i].buf = malloc(LEGACYMB_CHUNK);
+		if (!lanes[i].buf) {
+			perror("malloc failure in legacy_batch()");
+			exit(EXIT_FAILURE);
+		}
+	}
+	while (1) {
+		lane *active[SHA256MB_MAXLANES];
+		int nactive = 0;
+		size_t maxhave = 0, off;
+		for (i = 0; i < nlanes; i++) {
+			lane *l = &lanes[i];
+			while (!l->job && next < n) {
+				legacyjob *job = &jobs[next++];
+				if (startlane(l, job, ivsize)) {
+					job->res = -1;
+					if (done) done(job);
+				}
+			}
+			if (!l->job) continue;
+			l->have = fread(l->buf, 1, LEGACYMB_CHUNK, l->fpi);
+			if (ferror(l->fpi)) {
+				perror(l->job->in);
+				endlane(l, -1, done);
+				continue;
+			}
+			if (l->have > maxhave) maxhave = l->have;
+			active[nactive++] = l;
+		}
+		if (!nactive) break;
+		for (off = 0; off < maxhave; off += 32) {
+			lane *step[SHA256MB_MAXLANES];
+			int nstep = 0;
+			for (i = 0; i < nactive; i++) {
+				lane *l = active[i];
+				size_t j, m;
+				if (off >= l->have) continue;
+				m = (l->have - off < 32) ? l->have - off : 32;
+				for (j = 0; j < m; j++) l->buf[off + j] ^= l->brp[j];
+				step[nstep++] = l;
+			}
+			advance(step, nstep);
+		}
+		for (i = 0; i < nactive; i++) {
+			lane *l = active[i];
+			if (fwrite(l->buf, 1, l->have, l->fpo) != l->have) {
+				perror(l->job->out);
+				endlane(l, -1, done);
+			} else if (l->have < LEGACYMB_CHUNK) {
+				endlane(l, 0, done);
+			}
+		}
+	}
+	for (i = 0; i < nlanes; i++) free(lanes[i].buf);
+} // legacy_batch()
+
+int startlane(lane *l, legacyjob *job, size_t ivsize)
+{
+	/* Opens the files, reads the iv and makes the first block of
+	 * keystream from it and the passphrase. Returns 0, or -1 having
+	 * said why and left nothing behind. */
+	char iv[ivsize];
+	legacychain lc;
+
+	l->fpi = fopen(job->in, "r");
+	if (!l->fpi) {
+		perror(job->in);
+		return -1;
+	}
+	if (fread(iv, 1, ivsize, l->fpi) != ivsize) {
+		fprintf(stderr, "%s: truncated header\n", job->in);
+		fclose(l->fpi);
+		return -1;
+	}
+	l->fpo = fopen(job->out, "w");
+	if (!l->fpo) {
+		perror(job->out);
+		fclose(l->fpi);
+		return -1;
+	}
+	legacychain_start(&lc, iv, ivsize, job->pw);
+	legacychain_block(&lc, l->brp);
+	legacychain_hex(&lc, l->pwbuf);
+	l->job = job;
+	return 0;
+} // startlane()
+
+void endlane(lane *l, int res, legacydone done)
+{
+	// Closes the lane's files, the output removed if res says it failed.
+	fclose(l->fpi);
+	if (fclose(l->fpo) == EOF && !res) {
+		perror(l->job->out);
+		res = -1;
+	}
+	if (res) unlink(l->job->out);
+	l->job->res = res;
+	if (done) done(l->job);
+	l->job = NULL;
+} // endlane()
+
+void advance(lane **ls, int n)
+{
+	/* The next link of each chain, the sha256sum of the hex form of
+	 * the last one. calcsha256sum() has always been called with its
+	 * input and output the same buffer, and it clears the first byte
+	 * of its output before hashing, so what the chain really hashes
+	 * has a '\0' in place of the first hex digit. */
+	static const char hex[] = "0123456789abcdef";
+	const unsigned char *mp[SHA256MB_MAXLANES];
+	unsigned char *dp[SHA256MB_MAXLANES];
+	int i, j;
+	for (i = 0; i < n; i++) {
+		ls[i]->pwbuf[0] = '\0';
+		mp[i] = (const unsigned char *)ls[i]->pwbuf;
+		dp[i] = ls[i]->brp;
+	}
+	sha256mb_buffers(mp, 64, dp, n);
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 32; j++) {
+			ls[i]->pwbuf[2 * j] = hex[ls[i]->brp[j] >> 4];
+			ls[i]->pwbuf[2 * j + 1] = hex[ls[i]->brp[j] & 15];
+		}
+	}
+} // advance()
@@ -0,0 +1,50 @@
+/*
+ * legacymb.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _LEGACYMB_H
+# define _LEGACYMB_H
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Decrypts a number of files in the legacy chained format together.
+ * Each file's keystream is a serial chain of sha256sums, but the
+ * chains of different files are independent, so as many files as
+ * sha256mb has lanes are advanced in lockstep, a chunk of each at a
+ * time. A file that fails is reported and left out, the others carry
+ * on.
+*/
+#define LEGACYMB_CHUNK	(64 * 1024)
+
+typedef struct legacyjob {
+	char *in;
+	char *pw;
+	char *out;
+	off_t size;		// for the caller to order them by.
+	int res;		// 0 when done, -1 if it failed.
+} legacyjob;
+
+typedef void (*legacydone)(const legacyjob *job);
+
+int islegacyfile(const char *fn);
+void legacy_batch(legacyjob *jobs, size_t n, size_t ivsize,
+					legacydone done);
+
+#endif
@@ -0,0 +1,389 @@
+/*      liststate.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "liststate.h"
+#include "readfile.h"
+#include "sha256.h"
+#include "calc_nonce.h"
+#include "cryptctx.h"
+#include "kdf.h"
+
+static const staterec *find(const liststate *ls, const char *in,
+							const char *out);
+static int byname(const void *a, const void *b);
+static int hashfile(const char *fn, unsigned char *sum);
+static int64_t mtimens(const struct stat *sb);
+static void put16(unsigned char *p, unsigned v);
+static unsigned get16(const unsigned char *p);
+static void put64(unsigned char *p, uint64_t v);
+static uint64_t get64(const unsigned char *p);
+
+void liststate_load(liststate *ls, const char *fn, const char *pw)
+{
+	/* ls is empty if fn doesn't exist or can't be read with pw. */
+	fdata fdat = readfile(fn, 0, 0);
+	unsigned char *p, *end;
+	cryptheader hdr;
+	const cryptengine *e;
+	cryptctx c;
+	char *plain;
+	size_t len, got, last;
+	uint64_t i, n;
+
+	memset(ls, 0, sizeof(liststate));
+	if (!fdat.from) return;
+	p = (unsigned char *)fdat.from;
+	len = fdat.to - fdat.from;
+	if (unpackheader(p, len, &hdr) <= 0
+		|| len < CRYPT_HDRSIZE + CRYPT_IVSIZE
+		|| !(e = engine_byid(hdr.engine))
+		|| !(e->props & ENGINE_AEAD)
+		|| ctx_init(&c, e, &hdr, pw, (char *)p + CRYPT_HDRSIZE,
+					CRYPT_IVSIZE, ENGINE_DECRYPT)) goto ignore;
+	p += CRYPT_HDRSIZE + CRYPT_IVSIZE;
+	len -= CRYPT_HDRSIZE + CRYPT_IVSIZE;
+	plain = malloc(ctx_outsize(&c, len));
+	if (!plain) {
+		perror("malloc failure in liststate_load()");
+		exit(EXIT_FAILURE);
+	}
+	if (ctx_update(&c, (char *)p, len, plain, &got)) {
+		(void)ctx_final(&c, plain + got, &last);
+		free(plain);
+		goto ignore;
+	}
+	if (ctx_final(&c, plain + got, &last)) {
+		free(plain);
+		goto ignore;
+	}
+	free(fdat.from);
+	fdat.from = plain;
+	p = (unsigned char *)plain;
+	end = p + got + last;
+
+	if (end - p < 16 || memcmp(p, LISTSTATE_MAGIC, 8) != 0) goto ignore;
+	n = get64(p + 8);
+	p += 16;
+	for (i = 0; i < n; i++) {
+		staterec r;
+		unsigned inlen, outlen;
+		if (end - p < LISTSTATE_RECSIZE) goto ignore;
+		inlen = get16(p);
+		outlen = get16(p + 2);
+		if ((size_t)(end - p) < LISTSTATE_RECSIZE + inlen + outlen)
+			goto ignore;
+		r.mode = p[4];
+		r.engine = p[5];
+		r.size = get64(p + 6);
+		r.mtime = get64(p + 14);
+		memcpy(r.sum, p + 22, 32);
+		r.outsize = get64(p + 54);
+		r.outmtime = get64(p + 62);
+		memcpy(r.pwsum, p + 70, 32);
+		r.codec = p[102];
+		r.level = p[103];
+		r.kdfmsecs = get64(p + 104);
+		p += LISTSTATE_RECSIZE;
+		r.in = strndup((char *)p, inlen);
+		r.out = strndup((char *)p + inlen, outlen);
+		p += inlen + outlen;
+		liststate_add(ls, &r);
+		free(r.in);
+		free(r.out);
+	}
+	free(fdat.from);
+	qsort(ls->rec, ls->n, sizeof(staterec), byname);
+	return;
+
+ignore:
+	fprintf(stderr, "%s: can't be read, all entries will be run\n", fn);
+	free(fdat.from);
+	liststate_free(ls);
+} // liststate_load()
+
+int liststate_unchanged(const liststate *ls, const char *in,
+						const char *out, char mode, int engine,
+						int level, unsigned kdfmsecs, const char *pw,
+						staterec *now)
+{
+	/* Returns 1 if the entry from in to out, made with mode, engine,
+	 * compression level, kdf time and pw, needn't be run again, with
+	 * now set to what the state should say of it from here on. Hashes
+	 * the source only if its mtime has changed but not its size. */
+	const staterec *r = find(ls, in, out);
+	unsigned char pwsum[32];
+	struct stat sb;
+
+	if (!r || r->mode != mode) return 0;
+	if (mode == 'e' && (r->engine != engine || r->level != level
+		|| r->codec != ((level) ? CRYPT_CODEC_LZ : CRYPT_CODEC_NONE)
+		|| r->kdfmsecs != kdfmsecs)) return 0;
+	sha256_buffer(pw, strlen(pw), pwsum);
+	if (memcmp(pwsum, r->pwsum, 32) != 0) return 0;
+	if (stat(out, &sb) == -1 || (uint64_t)sb.st_size != r->outsize
+		|| mtimens(&sb) != r->outmtime) return 0;
+	if (stat(in, &sb) == -1 || (uint64_t)sb.st_size != r->size)
+		return 0;
+	*now = *r;
+	if (mtimens(&sb) == r->mtime) return 1;
+	// touched, or changed without the size changing.
+	if (hashfile(in, now->sum) || memcmp(now->sum, r->sum, 32) != 0)
+		return 0;
+	now->mtime = mtimens(&sb);
+	if (stat(in, &sb) == -1 || mtimens(&sb) != now->mtime) return 0;
+	return 1;
+} // liststate_unchanged()
+
+int liststate_begin(const char *in, staterec *now)
+{
+	/* Notes the source before the entry is run, so that one that
+	 * changes while it is being read isn't recorded as done. */
+	struct stat sb;
+	memset(now, 0, sizeof(staterec));
+	if (stat(in, &sb) == -1) return -1;
+	now->size = sb.st_size;
+	now->mtime = mtimens(&sb);
+	return 0;
+} // liststate_begin()
+
+int liststate_record(const char *in, const char *out, char mode,
+						int engine, int level, unsigned kdfmsecs,
+						const char *pw, staterec *now)
+{
+	/* Completes now, from liststate_begin(), after the entry has run.
+	 * Returns 0, or -1 if the source changed meanwhile and the entry
+	 * is not to be recorded. */
+	struct stat sb;
+
+	if (stat(in, &sb) == -1 || (uint64_t)sb.st_size != now->size
+		|| mtimens(&sb) != now->mtime) return -1;
+	if (hashfile(in, now->sum)) return -1;
+	if (stat(in, &sb) == -1 || mtimens(&sb) != now->mtime) return -1;
+	if (stat(out, &sb) == -1) return -1;
+	now->outsize = sb.st_size;
+	now->outmtime = mtimens(&sb);
+	now->mode = mode;
+	if (mode == 'e') {
+		now->engine = engine;
+		now->codec = (level) ? CRYPT_CODEC_LZ : CRYPT_CODEC_NONE;
+		now->level = level;
+		now->kdfmsecs = kdfmsecs;
+	}
+	sha256_buffer(pw, strlen(pw), now->pwsum);
+	return 0;
+} // liststate_record()
+
+void liststate_add(liststate *ls, const staterec *r)
+{
+	// a copy of r, its names too.
+	if (ls->n == ls->max) {
+		ls->max = (ls->max) ? 2 * ls->max : 64;
+		ls->rec = realloc(ls->rec, ls->max * sizeof(staterec));
+		if (!ls->rec) {
+			perror("malloc failure in liststate_add()");
+			exit(EXIT_FAILURE);
+		}
+	}
+	ls->rec[ls->n] = *r;
+	ls->rec[ls->n].in = strdup(r->in);
+	ls->rec[ls->n].out = strdup(r->out);
+	ls->n++;
+} // liststate_add()
+
+void liststate_save(const liststate *ls, const char *fn, const char *pw,
+					const cryptheader *hdr, const char *iv)
+{
+	/* Replaces fn with ls, through a temporary file and rename() so
+	 * that a crash leaves one or the other. hdr and iv, those of the
+	 * list file, may be NULL. When they aren't the state takes their
+	 * key derivation, so that its key is the one already derived for
+	 * the list. If the state can't be encrypted fn is removed instead,
+	 * so that the next run runs every entry. */
+	const cryptengine *e = engine_byid(ENGINE_AES256GCM);
+	unsigned char hbuf[CRYPT_HDRSIZE];
+	char niv[CRYPT_IVSIZE];
+	cryptheader shdr;
+	cryptctx c;
+	unsigned char *plain, *p;
+	char *enc, *tmp;
+	size_t i, len = 16, got = 0, last;
+	int fd, res;
+
+	for (i = 0; i < ls->n; i++) {
+		len += LISTSTATE_RECSIZE + strlen(ls->rec[i].in)
+				+ strlen(ls->rec[i].out);
+	}
+	plain = malloc(len);
+	if (!plain) {
+		perror("malloc failure in liststate_save()");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(plain, LISTSTATE_MAGIC, 8);
+	put64(plain + 8, ls->n);
+	p = plain + 16;
+	for (i = 0; i < ls->n; i++) {
+		const staterec *r = &ls->rec[i];
+		size_t inlen = strlen(r->in), outlen = strlen(r->out);
+		put16(p, inlen);
+		put16(p + 2, outlen);
+		p[4] = r->mode;
+		p[5] = r->engine;
+		put64(p + 6, r->size);
+		put64(p + 14, r->mtime);
+		memcpy(p + 22, r->sum, 32);
+		put64(p + 54, r->outsize);
+		put64(p + 62, r->outmtime);
+		memcpy(p + 70, r->pwsum, 32);
+		p[102] = r->codec;
+		p[103] = r->level;
+		put64(p + 104, r->kdfmsecs);
+		p += LISTSTATE_RECSIZE;
+		memcpy(p, r->in, inlen);
+		memcpy(p + inlen, r->out, outlen);
+		p += inlen + outlen;
+	}
+
+	initheader(&shdr);
+	shdr.engine = e->id;
+	calc_nonce(niv);
+	if (hdr && hdr->kdf != KDF_NONE) {
+		shdr.kdf = hdr->kdf;
+		shdr.kdfcost = hdr->kdfcost;
+		memcpy(niv, iv, KDF_SALTSIZE);
+	} else {
+		kdf_prepare(pw, &shdr, niv);
+	}
+	packheader(&shdr, hbuf);
+	if (ctx_init(&c, e, &shdr, pw, niv, CRYPT_IVSIZE, 0)) {
+		memset(plain, 0, len);
+		free(plain);
+		goto unsaved;
+	}
+	enc = malloc(ctx_outsize(&c, len));
+	tmp = malloc(strlen(fn) + 5);
+	if (!enc || !tmp) {
+		perror("malloc failure in liststate_save()");
+		exit(EXIT_FAILURE);
+	}
+	res = ctx_update(&c, (char *)plain, len, enc, &got);
+	if (ctx_final(&c, enc + got, &last)) res = -1;
+	memset(plain, 0, len);
+	free(plain);
+	if (res) {
+		free(tmp);
+		free(enc);
+		goto unsaved;
+	}
+
+	sprintf(tmp, "%s.tmp", fn);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1
+		|| write(fd, hbuf, CRYPT_HDRSIZE) != CRYPT_HDRSIZE
+		|| write(fd, niv, CRYPT_IVSIZE) != CRYPT_IVSIZE
+		|| write(fd, enc, got + last) != (ssize_t)(got + last)
+		|| fsync(fd) == -1 || close(fd) == -1
+		|| rename(tmp, fn) == -1) {
+		perror(tmp);
+		exit(EXIT_FAILURE);
+	}
+	free(tmp);
+	free(enc);
+	return;
+
+unsaved:
+	// one left from before would skip what this run has changed.
+	fprintf(stderr, "%s: not saved, all entries will be run next time\n",
+			fn);
+	unlink(fn);
+} // liststate_save()
+
+void liststate_free(liststate *ls)
+{
+	size_t i;
+	for (i = 0; i < ls->n; i++) {
+		free(ls->rec[i].in);
+		free(ls->rec[i].out);
+	}
+	free(ls->rec);
+	memset(ls, 0, sizeof(liststate));
+} // liststate_free()
+
+const staterec *find(const liststate *ls, const char *in,
+						const char *out)
+{
+	staterec key;
+	key.in = (char *)in;
+	key.out = (char *)out;
+	if (!ls->n) return NULL;
+	return bsearch(&key, ls->rec, ls->n, sizeof(staterec), byname);
+} // find()
+
+int byname(const void *a, const void *b)
+{
+	// for qsort() and bsearch(), by in then out.
+	const staterec *x = a, *y = b;
+	int res = strcmp(x->in, y->in);
+	return (res) ? res : strcmp(x->out, y->out);
+} // byname()
+
+int hashfile(const char *fn, unsigned char *sum)
+{
+	FILE *fp = fopen(fn, "r");
+	int res;
+	if (!fp) return -1;
+	res = sha256_stream(fp, sum);
+	fclose(fp);
+	return res;
+} // hashfile()
+
+int64_t mtimens(const struct stat *sb)
+{
+	return (int64_t)sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+} // mtimens()
+
+void put16(unsigned char *p, unsigned v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+} // put16()
+
+unsigned get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+} // get16()
+
+void put64(unsigned char *p, uint64_t v)
+{
+	int i;
+	for (i = 0; i < 8; i++) p[i] = v >> (8 * i);
+} // put64()
+
+uint64_t get64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+	for (i = 7; i >= 0; i--) v = (v << 8) | p[i];
+	return v;
+} // get64()
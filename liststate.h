@@ -0,0 +1,101 @@
+/*
+ * liststate.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _LISTSTATE_H
+# define _LISTSTATE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "cryptheader.h"
+
+/* What a list run did, kept beside the list file in list.cstate so
+ * that the next run can skip the entries whose source hasn't changed.
+ * For each entry that succeeded there is the source's size, mtime and
+ * sha256, the size and mtime of the output it made, and what it was
+ * made with, the engine, compression and key derivation time for one
+ * that was encrypted, so that changing any of them runs it again. An
+ * entry is skipped when its output is still as it was left and its
+ * source has the same size and either the same mtime or, failing that,
+ * the same content.
+ * The file is encrypted with the list pass phrase, with an
+ * authenticated engine so that it can't be edited to have a changed
+ * entry skipped. One that can't be read is ignored and every entry
+ * is run.
+ * Layout of the plain text, integers little endian:
+ *   0..7   magic "CSTATE02"
+ *   8..15  number of records
+ *   then each record, a fixed part of LISTSTATE_RECSIZE bytes and
+ *   the input and output names that it gives the lengths of:
+ *     0..1    length of the input name
+ *     2..3    length of the output name
+ *     4       mode
+ *     5       engine
+ *     6..13   size of the source
+ *     14..21  its mtime
+ *     22..53  its sha256
+ *     54..61  size of the output
+ *     62..69  its mtime
+ *     70..101 sha256 of the pass phrase
+ *     102     codec
+ *     103     level
+ *     104..111 kdf time, kdfmsecs widened to 8 bytes
+*/
+#define LISTSTATE_SUFFIX	".cstate"
+#define LISTSTATE_MAGIC		"CSTATE02"
+#define LISTSTATE_RECSIZE	112
+
+typedef struct staterec {
+	char *in;
+	char *out;
+	char mode;				// 'e' or 'd'
+	unsigned char engine;	// what it was encrypted with,
+	unsigned char codec;
+	unsigned char level;	// --compress, 0 if not.
+	uint32_t kdfmsecs;		// --kdf-time.
+	uint64_t size;			// the source,
+	int64_t mtime;			// nanoseconds
+	unsigned char sum[32];	// sha256 of its content.
+	uint64_t outsize;		// and the output.
+	int64_t outmtime;
+	unsigned char pwsum[32];	// sha256 of the pass phrase.
+} staterec;
+
+typedef struct liststate {
+	staterec *rec;			// sorted by in, then out.
+	size_t n;
+	size_t max;
+} liststate;
+
+void liststate_load(liststate *ls, const char *fn, const char *pw);
+int liststate_unchanged(const liststate *ls, const char *in,
+						const char *out, char mode, int engine,
+						int level, unsigned kdfmsecs, const char *pw,
+						staterec *now);
+int liststate_begin(const char *in, staterec *now);
+int liststate_record(const char *in, const char *out, char mode,
+						int engine, int level, unsigned kdfmsecs,
+						const char *pw, staterec *now);
+void liststate_add(liststate *ls, const staterec *r);
+void liststate_save(const liststate *ls, const char *fn, const char *pw,
+					const cryptheader *hdr, const char *iv);
+void liststate_free(liststate *ls);
+
+#endif
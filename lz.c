@@ -0,0 +1,347 @@
+/*      lz.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include "lz.h"
+
+static size_t compress(lzstate *z, const unsigned char *in, size_t len,
+						unsigned char *out);
+static size_t longest(lzstate *z, const unsigned char *in, size_t len,
+						size_t p, size_t *off);
+static void insert(lzstate *z, const unsigned char *in, size_t p);
+static int decompress(const unsigned char *in, size_t len,
+						unsigned char *out, size_t outlen);
+static size_t matchlen(const unsigned char *a, const unsigned char *b,
+						const unsigned char *end);
+static unsigned char *putlength(unsigned char *op, size_t n);
+static uint32_t hash4(const unsigned char *p);
+static void put32(char *p, uint32_t v);
+static uint32_t get32(const char *p);
+
+void lz_init(lzstate *z, int level)
+{
+	// level from 1, fastest, to LZ_MAXLEVEL.
+	z->level = (level < 1) ? 1 : (level > LZ_MAXLEVEL) ? LZ_MAXLEVEL
+				: level;
+	z->head = malloc(sizeof(uint32_t) << LZ_HASHBITS);
+	z->chain = malloc(sizeof(uint32_t) * LZ_WINDOW);
+	if (!z->head || !z->chain) {
+		perror("malloc failure in lz_init()");
+		exit(EXIT_FAILURE);
+	}
+} // lz_init()
+
+void lz_free(lzstate *z)
+{
+	free(z->head);
+	free(z->chain);
+} // lz_free()
+
+size_t lz_bound(size_t len)
+{
+	// The most that a frame of a block of len bytes can take.
+	return LZ_FRAMEHDR + len;
+} // lz_bound()
+
+size_t lz_frame(lzstate *z, const char *in, size_t len, char *out)
+{
+	/* Makes the frame of the block of len bytes, no more than LZ_BLOCK,
+	 * at out, which has room for lz_bound(len), and returns its
+	 * length. A block that compression would not make smaller is
+	 * stored. */
+	size_t clen = compress(z, (const unsigned char *)in, len,
+							(unsigned char *)out + LZ_FRAMEHDR);
+	if (!clen) {
+		memcpy(out + LZ_FRAMEHDR, in, len);
+		put32(out, len | LZ_STORED);
+		clen = len;
+	} else {
+		put32(out, clen);
+	}
+	put32(out + 4, len);
+	return LZ_FRAMEHDR + clen;
+} // lz_frame()
+
+ssize_t lz_framelen(const char *hdr)
+{
+	/* The length of the whole frame whose LZ_FRAMEHDR bytes of header
+	 * are at hdr, or -1 if they can't be one. */
+	uint32_t clen = get32(hdr) & ~LZ_STORED, len = get32(hdr + 4);
+	if (len > LZ_BLOCK || clen > len
+		|| ((get32(hdr) & LZ_STORED) && clen != len)) return -1;
+	return LZ_FRAMEHDR + clen;
+} // lz_framelen()
+
+int lz_unframe(const char *frame, char *out, size_t *outlen)
+{
+	/* Decodes a frame that lz_framelen() has passed into out, which
+	 * has room for LZ_BLOCK. Returns 0, or -1 if it is corrupt. */
+	uint32_t clen = get32(frame) & ~LZ_STORED, len = get32(frame + 4);
+	*outlen = len;
+	if (get32(frame) & LZ_STORED) {
+		memcpy(out, frame + LZ_FRAMEHDR, len);
+		return 0;
+	}
+	return decompress((const unsigned char *)frame + LZ_FRAMEHDR, clen,
+						(unsigned char *)out, len);
+} // lz_unframe()
+
+char *lz_expand(const char *in, size_t len, size_t *outlen)
+{
+	/* The frames in the len bytes at in decoded into a buffer of
+	 * their own, with a byte to spare after them, or NULL if they are
+	 * corrupt or cut short. */
+	size_t max = 0, n = 0, got;
+	char *out = NULL;
+
+	while (len) {
+		ssize_t flen = (len < LZ_FRAMEHDR) ? -1 : lz_framelen(in);
+		if (flen == -1 || (size_t)flen > len) {
+			free(out);
+			return NULL;
+		}
+		if (max - n < LZ_BLOCK + 1) {
+			max = (max) ? 2 * max : 4 * LZ_BLOCK;
+			out = realloc(out, max);
+			if (!out) {
+				perror("malloc failure in lz_expand()");
+				exit(EXIT_FAILURE);
+			}
+		}
+		if (lz_unframe(in, out + n, &got)) {
+			free(out);
+			return NULL;
+		}
+		n += got;
+		in += flen;
+		len -= flen;
+	}
+	if (!out) out = malloc(1);
+	*outlen = n;
+	return out;
+} // lz_expand()
+
+size_t compress(lzstate *z, const unsigned char *in, size_t len,
+					unsigned char *out)
+{
+	/* The sequences for in, or 0 if they would be no shorter than
+	 * len. */
+	unsigned char *op = out, *oend = out + len;
+	size_t p = 0, anchor = 0, misses = 0, next = 0, nextoff = 0;
+
+	memset(z->head, 0, sizeof(uint32_t) << LZ_HASHBITS);
+	while (p + LZ_MINMATCH <= len) {
+		size_t off = nextoff, lit;
+		size_t mlen = (next) ? next : longest(z, in, len, p, &off);
+		next = 0;
+		insert(z, in, p);
+		if (mlen < LZ_MINMATCH) {
+			/* the more tries without a match the bigger the steps, so
+			 * that what won't compress is passed over quickly. */
+			p += 1 + (misses++ >> ((z->level < 3) ? 6 : 10));
+			continue;
+		}
+		misses = 0;
+		if (z->level >= 3 && p + 1 + LZ_MINMATCH <= len) {
+			next = longest(z, in, len, p + 1, &nextoff);
+			if (next > mlen) {	// this byte is better as a literal.
+				p++;
+				continue;
+			}
+			next = 0;
+		}
+		lit = p - anchor;
+		// token, lengths, literals and offset, and the last sequence.
+		if ((size_t)(oend - op) < lit + lit / 255 + mlen / 255 + 16)
+			return 0;
+		*op = ((lit < 15) ? lit : 15) << 4;
+		*op |= (mlen - LZ_MINMATCH < 15) ? mlen - LZ_MINMATCH : 15;
+		op++;
+		if (lit >= 15) op = putlength(op, lit - 15);
+		memcpy(op, in + anchor, lit);
+		op += lit;
+		*op++ = off;
+		*op++ = off >> 8;
+		if (mlen - LZ_MINMATCH >= 15) {
+			op = putlength(op, mlen - LZ_MINMATCH - 15);
+		}
+		if (z->level > 1) {
+			size_t q;
+			for (q = p + 1; q < p + mlen && q + LZ_MINMATCH <= len; q++)
+				insert(z, in, q);
+		}
+		p += mlen;
+		anchor = p;
+	}
+	{
+		size_t lit = len - anchor;
+		if ((size_t)(oend - op) <= lit + lit / 255 + 1) return 0;
+		*op++ = ((lit < 15) ? lit : 15) << 4;
+		if (lit >= 15) op = putlength(op, lit - 15);
+		memcpy(op, in + anchor, lit);
+		op += lit;
+	}
+	return op - out;
+} // compress()
+
+size_t longest(lzstate *z, const unsigned char *in, size_t len, size_t p,
+				size_t *off)
+{
+	/* The longest match for p that the level looks for, and its
+	 * offset in *off. */
+	uint32_t cand = z->head[hash4(in + p)];
+	int depth = (z->level == 1) ? 1 : 2 << z->level;
+	size_t best = 0;
+
+	while (cand && depth--) {
+		size_t c = cand - 1, n;
+		if (p - c >= LZ_WINDOW) break;
+		if (in[c + best] == in[p + best]	// can it be longer?
+			&& memcmp(in + c, in + p, LZ_MINMATCH) == 0) {
+			n = LZ_MINMATCH + matchlen(in + c + LZ_MINMATCH,
+									in + p + LZ_MINMATCH, in + len);
+			if (n > best) {
+				best = n;
+				*off = p - c;
+				if (p + n == len) break;
+			}
+		}
+		cand = z->chain[c % LZ_WINDOW];
+	}
+	return best;
+} // longest()
+
+void insert(lzstate *z, const unsigned char *in, size_t p)
+{
+	uint32_t h = hash4(in + p);
+	if (z->level > 1) z->chain[p % LZ_WINDOW] = z->head[h];
+	z->head[h] = p + 1;
+} // insert()
+
+int decompress(const unsigned char *in, size_t len, unsigned char *out,
+				size_t outlen)
+{
+	/* Exactly outlen bytes from the sequences, or -1. Nothing is read
+	 * or written outside the buffers whatever in holds. */
+	const unsigned char *ip = in, *iend = in + len;
+	unsigned char *op = out, *oend = out + outlen;
+
+	while (1) {
+		size_t lit, mlen, off;
+		unsigned b;
+		if (ip == iend) return -1;
+		lit = *ip >> 4;
+		mlen = *ip++ & 15;
+		if (lit == 15) {
+			do {
+				if (ip == iend) return -1;
+				b = *ip++;
+				lit += b;
+			} while (b == 255);
+		}
+		if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+			return -1;
+		if (lit <= 16 && iend - ip >= 16 && oend - op >= 16) {
+			memcpy(op, ip, 16);	// a fixed size, done inline.
+		} else {
+			memcpy(op, ip, lit);
+		}
+		ip += lit;
+		op += lit;
+		if (ip == iend) break;	// the last sequence.
+		if (iend - ip < 2) return -1;
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (mlen == 15) {
+			do {
+				if (ip == iend) return -1;
+				b = *ip++;
+				mlen += b;
+			} while (b == 255);
+		}
+		mlen += LZ_MINMATCH;
+		if (!off || off > (size_t)(op - out)
+			|| mlen > (size_t)(oend - op)) return -1;
+		if (off >= 16 && mlen <= 16 && oend - op >= 16) {
+			memcpy(op, op - off, 16);
+			op += mlen;
+		} else if (off >= mlen) {
+			memcpy(op, op - off, mlen);
+			op += mlen;
+		} else {
+			while (mlen--) {	// overlapping, a run.
+				*op = *(op - off);
+				op++;
+			}
+		}
+	}
+	return (op == oend) ? 0 : -1;
+} // decompress()
+
+size_t matchlen(const unsigned char *a, const unsigned char *b,
+				const unsigned char *end)
+{
+	// How many bytes from a and b are the same, up to b reaching end.
+	const unsigned char *start = b;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (end - b >= 8) {
+		uint64_t x, y;
+		memcpy(&x, a, 8);
+		memcpy(&y, b, 8);
+		if (x != y) return b - start + (__builtin_ctzll(x ^ y) >> 3);
+		a += 8;
+		b += 8;
+	}
+#endif
+	while (b < end && *a == *b) {
+		a++;
+		b++;
+	}
+	return b - start;
+} // matchlen()
+
+unsigned char *putlength(unsigned char *op, size_t n)
+{
+	// the extension of a length of 15 or more, n being the rest of it.
+	while (n >= 255) {
+		*op++ = 255;
+		n -= 255;
+	}
+	*op++ = n;
+	return op;
+} // putlength()
+
+uint32_t hash4(const unsigned char *p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	return (v * 2654435761u) >> (32 - LZ_HASHBITS);
+} // hash4()
+
+void put32(char *p, uint32_t v)
+{
+	int i;
+	for (i = 0; i < 4; i++) p[i] = v >> (8 * i);
+} // put32()
+
+uint32_t get32(const char *p)
+{
+	const unsigned char *u = (const unsigned char *)p;
+	return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+} // get32()
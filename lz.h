@@ -0,0 +1,67 @@
+/*
+ * lz.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _LZ_H
+# define _LZ_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* --compress. A byte oriented LZ77 codec of the LZ4 kind, quick to
+ * decode at any level, done ahead of the cipher. The plain text is cut
+ * into blocks of LZ_BLOCK and each becomes one frame, an LZ_FRAMEHDR
+ * byte header, little endian,
+ *   0..3  the length of the data after the header, with LZ_STORED set
+ *         if the block is there as it was, not having got smaller.
+ *   4..7  the length of the block.
+ * and then the block, stored or as sequences. A sequence is a token
+ * byte, whose high four bits are the number of literals and low four
+ * the match length less LZ_MINMATCH, either extended by bytes that
+ * are added on while they are 255 when it is 15, then the literals and
+ * a two byte offset back into what has been decoded of the block.
+ * The last sequence is only literals, and ends the block.
+ * Level 1 takes the first match a hash of the next four bytes finds,
+ * the higher levels search chains of earlier positions, deeper the
+ * higher the level, and from 3 look one byte ahead for a longer match.
+*/
+#define LZ_BLOCK		(256 * 1024)
+#define LZ_FRAMEHDR		8
+#define LZ_STORED		0x80000000u
+#define LZ_MINMATCH		4
+#define LZ_HASHBITS		16
+#define LZ_WINDOW		65536
+#define LZ_MAXLEVEL		9
+
+typedef struct lzstate {
+	int level;
+	uint32_t *head;		// by hash, the last position + 1 or 0.
+	uint32_t *chain;	// by position in the window, the one before.
+} lzstate;
+
+void lz_init(lzstate *z, int level);
+void lz_free(lzstate *z);
+size_t lz_bound(size_t len);
+size_t lz_frame(lzstate *z, const char *in, size_t len, char *out);
+ssize_t lz_framelen(const char *hdr);
+int lz_unframe(const char *frame, char *out, size_t *outlen);
+char *lz_expand(const char *in, size_t len, size_t *outlen);
+
+#endif
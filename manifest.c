@@ -0,0 +1,105 @@
+/*      manifest.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include "manifest.h"
+
+static char *dirvalue(const char *v);
+static void addentry(manifest *m, const mfentry *me);
+
+void manifest_parse(manifest *m, char *from, char *to)
+{
+	/* from..to is the whole of the plain text and is changed, *to
+	 * too, which ends the last value if there is no newline after it.
+	*/
+	mfentry me = { NULL, NULL, NULL };
+	char *bol, *eol, *v, *end, *cp;
+
+	memset(m, 0, sizeof(manifest));
+	bol = memchr(from, '\n', to - from);
+	if (!bol) return;
+	for (bol++; bol < to; bol = eol + 1) {
+		eol = memchr(bol, '\n', to - bol);
+		if (!eol) eol = to;	// no newline at the end of the file.
+		end = memchr(bol, '#', eol - bol);
+		if (!end) end = eol;
+		v = memchr(bol, '=', end - bol);
+		if (!v) continue;
+		*v++ = '\0';
+		for (cp = v; (cp = memchr(cp, '\t', end - cp)); cp++) *cp = ' ';
+		while (end > v && end[-1] == ' ') end--;
+		*end = '\0';	// overwrites the '\n', '#' or a space.
+
+		if (!me.pt && strcmp(bol, "PT") == 0) {
+			me.pt = v;
+		} else if (me.pt && !me.et && strcmp(bol, "ET") == 0) {
+			me.et = v;
+		} else if (me.et && strcmp(bol, "PP") == 0) {
+			me.pp = v;
+			addentry(m, &me);
+			me.pt = me.et = NULL;
+		} else if (!m->ptpath && strcmp(bol, "PTPATH") == 0) {
+			m->ptpath = dirvalue(v);
+		} else if (!m->etpath && strcmp(bol, "ETPATH") == 0) {
+			m->etpath = dirvalue(v);
+		}
+	}
+	if (me.pt) {
+		fprintf(stderr, "Fatal error, could not find: %s\n",
+				(me.et) ? "PP=" : "ET=");
+		exit(EXIT_FAILURE);
+	}
+} // manifest_parse()
+
+void manifest_free(manifest *m)
+{
+	free(m->ptpath);
+	free(m->etpath);
+	free(m->ent);
+	memset(m, 0, sizeof(manifest));
+} // manifest_free()
+
+char *dirvalue(const char *v)
+{
+	// a copy of v, with a '/' appended if it's not there.
+	size_t len = strlen(v);
+	char *dir = malloc(len + 2);
+	if (!dir) {
+		perror("malloc failure in dirvalue()");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(dir, v, len);
+	if (!len || v[len - 1] != '/') dir[len++] = '/';
+	dir[len] = '\0';
+	return dir;
+} // dirvalue()
+
+void addentry(manifest *m, const mfentry *me)
+{
+	if (m->n == m->max) {
+		m->max = (m->max) ? 2 * m->max : 64;
+		m->ent = realloc(m->ent, m->max * sizeof(mfentry));
+		if (!m->ent) {
+			perror("malloc failure in addentry()");
+			exit(EXIT_FAILURE);
+		}
+	}
+	m->ent[m->n++] = *me;
+} // addentry()
@@ -0,0 +1,56 @@
+/*
+ * manifest.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _MANIFEST_H
+# define _MANIFEST_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+/* The decrypted list file, parsed in one pass over it. Lines are
+ * KEY=value, a '#' starts a comment that runs to the end of the line,
+ * tabs count as spaces and trailing spaces are not part of a value.
+ * The first line is not read, so it can say what the file is.
+ *   PTPATH=dir  ETPATH=dir  optional, anywhere, the first one counts.
+ *   PT=name  ET=name  PP=pass-phrase  one entry, in that order, with
+ *   anything else between them passed over.
+ * A PT with no ET and PP after it is fatal. The values are ended in
+ * place, so the entries point into the buffer that was parsed, and
+ * nothing limits the length of a line or the number of entries. The
+ * byte after the buffer must be writable.
+*/
+typedef struct mfentry {
+	char *pt;
+	char *et;
+	char *pp;
+} mfentry;
+
+typedef struct manifest {
+	char *ptpath;		// NULL or with a trailing '/'
+	char *etpath;
+	mfentry *ent;
+	size_t n;
+	size_t max;
+} manifest;
+
+void manifest_parse(manifest *m, char *from, char *to);
+void manifest_free(manifest *m);
+
+#endif
@@ -0,0 +1,149 @@
+/*      parallel.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include <errno.h>
+#include "parallel.h"
+
+typedef struct ptask {
+	const segjob *job;
+	uint64_t next;		// next segment to be claimed, shared.
+	int failed;			// set by any thread that gets a rejection.
+} ptask;
+
+static void *worker(void *arg);
+static void readall(int fd, char *buf, size_t len, off_t off);
+static void writeall(int fd, const char *buf, size_t len, off_t off);
+
+int numthreads(int requested)
+{
+	/* 0 means one thread per online cpu. */
+	if (requested > 0) return requested;
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (int)n : 1;
+} // numthreads()
+
+int paralleltransform(const segjob *job, int nthreads)
+{
+	/* Run job on nthreads threads. The segments are claimed in order,
+	 * so the output is the same as a single threaded run and the
+	 * writes proceed more or less sequentially through the file.
+	 * pread()/pwrite() mean the threads share no file position.
+	 * Returns 0, or -1 if any segment was rejected.
+	*/
+	ptask task;
+	pthread_t *tids;
+	int i;
+
+	task.job = job;
+	task.next = 0;
+	task.failed = 0;
+	if ((uint64_t)nthreads > job->nsegs) nthreads = (int)job->nsegs;
+	if (nthreads < 1) return 0;	// nothing to do.
+
+	tids = malloc(nthreads * sizeof(pthread_t));
+	if (!tids) {
+		perror("malloc failure in paralleltransform()");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < nthreads; i++) {
+		int res = pthread_create(&tids[i], NULL, worker, &task);
+		if (res) {
+			errno = res;
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+	return task.failed ? -1 : 0;
+} // paralleltransform()
+
+void *worker(void *arg)
+{
+	ptask *task = arg;
+	const segjob *job = task->job;
+	char *buf = (job->inmap) ? NULL : malloc(job->inseg);
+	char *out = (job->inmap) ? NULL : malloc(job->outseg);
+	if (!job->inmap && (!buf || !out)) {
+		perror("malloc failure in worker()");
+		exit(EXIT_FAILURE);
+	}
+	while (1) {
+		uint64_t k = __atomic_fetch_add(&task->next, 1, __ATOMIC_RELAXED);
+		if (k >= job->nsegs) break;
+		if (__atomic_load_n(&task->failed, __ATOMIC_RELAXED)) break;
+		uint64_t offset = k * job->inseg;
+		size_t n = job->inseg, outlen;
+		if (offset + n > job->len) n = job->len - offset;
+		if (job->inmap) {
+			if (job->fn(job->ctx, k, job->inmap + job->inoff + offset, n,
+						job->outmap + job->outoff + k * job->outseg,
+						&outlen, k == job->nsegs - 1)) {
+				__atomic_store_n(&task->failed, 1, __ATOMIC_RELAXED);
+				break;
+			}
+			continue;
+		}
+		readall(job->fdi, buf, n, job->inoff + offset);
+		if (job->fn(job->ctx, k, buf, n, out, &outlen,
+					k == job->nsegs - 1)) {
+			__atomic_store_n(&task->failed, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		writeall(job->fdo, out, outlen, job->outoff + k * job->outseg);
+	}
+	free(out);
+	free(buf);
+	return NULL;
+} // worker()
+
+void readall(int fd, char *buf, size_t len, off_t off)
+{
+	while (len) {
+		ssize_t res = pread(fd, buf, len, off);
+		if (res == -1 && errno == EINTR) continue;
+		if (res <= 0) {
+			if (res == 0) errno = EIO;	// file shrank under us.
+			perror("pread");
+			exit(EXIT_FAILURE);
+		}
+		buf += res;
+		len -= res;
+		off += res;
+	}
+} // readall()
+
+void writeall(int fd, const char *buf, size_t len, off_t off)
+{
+	while (len) {
+		ssize_t res = pwrite(fd, buf, len, off);
+		if (res == -1 && errno == EINTR) continue;
+		if (res <= 0) {
+			perror("pwrite");
+			exit(EXIT_FAILURE);
+		}
+		buf += res;
+		len -= res;
+		off += res;
+	}
+} // writeall()
@@ -0,0 +1,63 @@
+/*
+ * parallel.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _PARALLEL_H
+# define _PARALLEL_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define PARALLEL_CHUNK	(1024 * 1024)
+
+/* Transforms segment segno, len bytes at in, into out and sets
+ * *outlen. final is set for the last segment of the stream. Returns 0,
+ * or -1 if the segment is rejected, eg it fails to authenticate.
+*/
+typedef int (*segfunc)(void *ctx, uint64_t segno, const char *in,
+						size_t len, char *out, size_t *outlen, int final);
+
+/* The input is len bytes from inoff on, cut into nsegs segments of
+ * inseg bytes, the last maybe shorter. Segment k is written at
+ * outoff + k * outseg.
+ * If inmap is set the files are mapped and the offsets are from the
+ * start of inmap and outmap, the segments are transformed from one
+ * mapping straight into the other with no reads or writes.
+*/
+typedef struct segjob {
+	int fdi;
+	off_t inoff;
+	int fdo;
+	off_t outoff;
+	uint64_t len;
+	uint64_t nsegs;
+	size_t inseg;
+	size_t outseg;
+	segfunc fn;
+	void *ctx;
+	const char *inmap;
+	char *outmap;
+} segjob;
+
+int numthreads(int requested);
+int paralleltransform(const segjob *job, int nthreads);
+
+#endif
@@ -0,0 +1,130 @@
+/*      ring.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+#include "cpufeatures.h"
+
+#define RING_SPINS	1000
+
+static int ready(ring *r, int producer);
+static void waitfor(ring *r, int producer);
+static void wakeup(ring *r);
+
+void ring_init(ring *r, unsigned nslots, size_t slotsize)
+{
+	memset(r, 0, sizeof(ring));
+	r->buf = aligned_alloc(64, nslots * slotsize);
+	if (!r->buf) {
+		perror("malloc failure in ring_init()");
+		exit(EXIT_FAILURE);
+	}
+	r->slotsize = slotsize;
+	r->nslots = nslots;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+} // ring_init()
+
+unsigned char *ring_produce(ring *r)
+{
+	/* The next free slot, waiting for one if need be. NULL once the
+	 * ring is stopped. */
+	waitfor(r, 1);
+	if (__atomic_load_n(&r->stopped, __ATOMIC_ACQUIRE)) return NULL;
+	return r->buf + (r->produced % r->nslots) * r->slotsize;
+} // ring_produce()
+
+void ring_commit(ring *r)
+{
+	// the slot from ring_produce() is full.
+	__atomic_store_n(&r->produced, r->produced + 1, __ATOMIC_SEQ_CST);
+	wakeup(r);
+} // ring_commit()
+
+const unsigned char *ring_consume(ring *r)
+{
+	/* The oldest full slot, waiting for it if need be. NULL if the
+	 * ring is stopped. */
+	waitfor(r, 0);
+	if (__atomic_load_n(&r->stopped, __ATOMIC_ACQUIRE)) return NULL;
+	return r->buf + (r->consumed % r->nslots) * r->slotsize;
+} // ring_consume()
+
+void ring_release(ring *r)
+{
+	// the slot from ring_consume() may be reused.
+	__atomic_store_n(&r->consumed, r->consumed + 1, __ATOMIC_SEQ_CST);
+	wakeup(r);
+} // ring_release()
+
+void ring_stop(ring *r)
+{
+	// both sides return NULL from now on.
+	pthread_mutex_lock(&r->lock);
+	__atomic_store_n(&r->stopped, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+} // ring_stop()
+
+void ring_free(ring *r)
+{
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->lock);
+	free(r->buf);
+	r->buf = NULL;
+} // ring_free()
+
+int ready(ring *r, int producer)
+{
+	uint64_t p = __atomic_load_n(&r->produced, __ATOMIC_ACQUIRE);
+	uint64_t c = __atomic_load_n(&r->consumed, __ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&r->stopped, __ATOMIC_ACQUIRE)) return 1;
+	return (producer) ? p - c < r->nslots : p != c;
+} // ready()
+
+void waitfor(ring *r, int producer)
+{
+	/* A sleeper registers itself under the lock before its last look
+	 * at the counts, and the other side checks for sleepers after
+	 * moving its count, so a wakeup cannot be lost. */
+	int i;
+	for (i = 0; i < RING_SPINS; i++) {
+		if (ready(r, producer)) return;
+#ifdef CRYPT_X86
+		__builtin_ia32_pause();
+#endif
+	}
+	pthread_mutex_lock(&r->lock);
+	__atomic_add_fetch(&r->sleepers, 1, __ATOMIC_SEQ_CST);
+	while (!ready(r, producer)) pthread_cond_wait(&r->cond, &r->lock);
+	__atomic_sub_fetch(&r->sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&r->lock);
+} // waitfor()
+
+void wakeup(ring *r)
+{
+	if (__atomic_load_n(&r->sleepers, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&r->lock);
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+} // wakeup()
@@ -0,0 +1,53 @@
+/*
+ * ring.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _RING_H
+# define _RING_H
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* A single producer, single consumer ring of fixed size slots. The
+ * two sides only touch the produced and consumed counts, so while
+ * there is work on both sides no lock is taken. A side that finds the
+ * ring full or empty spins briefly and then sleeps on the condition
+ * variable until the other side moves.
+*/
+typedef struct ring {
+	unsigned char *buf;
+	size_t slotsize;
+	unsigned nslots;
+	uint64_t produced;	// slots committed, written by the producer.
+	uint64_t consumed;	// slots released, written by the consumer.
+	int sleepers;
+	int stopped;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} ring;
+
+void ring_init(ring *r, unsigned nslots, size_t slotsize);
+unsigned char *ring_produce(ring *r);
+void ring_commit(ring *r);
+const unsigned char *ring_consume(ring *r);
+void ring_release(ring *r);
+void ring_stop(ring *r);
+void ring_free(ring *r);
+
+#endif
@@ -26,6 +26,7 @@
 # define GL_OPENSSL_INLINE _GL_EXTERN_INLINE
 #endif
 #include "sha256.h"
+#include "sha256accel.h"
 
 #include <stdalign.h>
 #include <stdint.h>
@@ -441,12 +442,36 @@ static const uint32_t sha256_round_constants[64] = {
 #define F2(A,B,C) ( ( A & B ) | ( C & ( A | B ) ) )
 #define F1(E,F,G) ( G ^ ( E & ( F ^ G ) ) )
 
+static void sha256_process_block_c (const void *buffer, size_t len,
+                                    struct sha256_ctx *ctx);
+
 /* Process LEN bytes of BUFFER, accumulating context into CTX.
    It is assumed that LEN % 64 == 0.
-   Most of this code comes from GnuPG's cipher/sha1.c.  */
+   The SHA extensions or AVX2 are used where the cpu has them, the
+   portable code below otherwise.  */
 
 void
 sha256_process_block (const void *buffer, size_t len, struct sha256_ctx *ctx)
+{
+  sha256blocks accel = sha256_accelerated (len / 64);
+  uint32_t lolen = len;
+
+  if (!accel)
+    {
+      sha256_process_block_c (buffer, len, ctx);
+      return;
+    }
+  ctx->total[0] += lolen;
+  ctx->total[1] += (len >> 31 >> 1) + (ctx->total[0] < lolen);
+  accel (ctx->state, buffer, len / 64);
+}
+
+/* The portable form of the above.
+   Most of this code comes from GnuPG's cipher/sha1.c.  */
+
+static void
+sha256_process_block_c (const void *buffer, size_t len,
+                        struct sha256_ctx *ctx)
 {
   const uint32_t *words = buffer;
   size_t nwords = len / sizeof (uint32_t);
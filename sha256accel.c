@@ -0,0 +1,231 @@
+/*      sha256accel.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include "sha256accel.h"
+#include "cpufeatures.h"
+#ifdef CRYPT_X86
+#include <immintrin.h>
+#endif
+
+#ifdef CRYPT_X86
+static void blocks_shani(uint32_t *state, const unsigned char *data,
+							size_t nblocks);
+static void blocks_avx2(uint32_t *state, const unsigned char *data,
+							size_t nblocks);
+
+static const uint32_t kc[64] __attribute__((aligned(32))) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+#endif
+
+sha256blocks sha256_accelerated(size_t nblocks)
+{
+	/* The best form this cpu can run for nblocks, or NULL when that is
+	 * the portable code in sha256.c. The AVX2 schedule only pays for
+	 * itself when there are blocks to pair up, a hash of one block,
+	 * which is what the keystreams mostly do, is faster without it.
+	*/
+#ifdef CRYPT_X86
+	unsigned f = cpufeatures();
+	if ((f & CPU_SHANI) && (f & CPU_SSE41)) return blocks_shani;
+	if ((f & CPU_AVX2) && nblocks > 1) return blocks_avx2;
+#else
+	(void)nblocks;
+#endif
+	return NULL;
+} // sha256_accelerated()
+
+const char *sha256_implname(void)
+{
+#ifdef CRYPT_X86
+	unsigned f = cpufeatures();
+	if ((f & CPU_SHANI) && (f & CPU_SSE41)) return "sha-ni";
+	if (f & CPU_AVX2) return "avx2";
+#endif
+	return "portable";
+} // sha256_implname()
+
+#ifdef CRYPT_X86
+__attribute__((target("sha,sse4.1")))
+void blocks_shani(uint32_t *state, const unsigned char *data,
+					size_t nblocks)
+{
+	/* SHA256RNDS2 does two rounds and wants the state as ABEF and CDGH
+	 * rather than ABCD and EFGH. MSG1 and MSG2 between them compute
+	 * the next four schedule words. */
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+										0x0405060700010203ULL);
+	__m128i st0, st1, tmp, msg, m[4];
+	int g;
+
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state),
+							0xb1);		// CDAB
+	st1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state + 4)),
+							0x1b);		// EFGH
+	st0 = _mm_alignr_epi8(tmp, st1, 8);			// ABEF
+	st1 = _mm_blend_epi16(st1, tmp, 0xf0);		// CDGH
+
+	while (nblocks--) {
+		__m128i save0 = st0, save1 = st1;
+#pragma GCC unroll 16
+		for (g = 0; g < 16; g++) {
+			if (g < 4) {
+				m[g] = _mm_shuffle_epi8(_mm_loadu_si128(
+						(const __m128i *)(data + 16 * g)), bswap);
+			}
+			msg = _mm_add_epi32(m[g & 3],
+						_mm_load_si128((const __m128i *)(kc + 4 * g)));
+			st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+			if (g >= 3 && g <= 14) {
+				tmp = _mm_alignr_epi8(m[g & 3], m[(g - 1) & 3], 4);
+				m[(g + 1) & 3] = _mm_add_epi32(m[(g + 1) & 3], tmp);
+				m[(g + 1) & 3] = _mm_sha256msg2_epu32(m[(g + 1) & 3],
+													m[g & 3]);
+			}
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+			if (g >= 1 && g <= 12) {
+				m[(g - 1) & 3] = _mm_sha256msg1_epu32(m[(g - 1) & 3],
+													m[g & 3]);
+			}
+		}
+		st0 = _mm_add_epi32(st0, save0);
+		st1 = _mm_add_epi32(st1, save1);
+		data += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(st0, 0x1b);			// FEBA
+	st1 = _mm_shuffle_epi32(st1, 0xb1);			// DCHG
+	st0 = _mm_blend_epi16(tmp, st1, 0xf0);		// DCBA
+	st1 = _mm_alignr_epi8(st1, tmp, 8);			// HGFE
+	_mm_storeu_si128((__m128i *)state, st0);
+	_mm_storeu_si128((__m128i *)(state + 4), st1);
+} // blocks_shani()
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define VROR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), \
+							_mm256_slli_epi32(x, 32 - (n)))
+#define SIG0(x) _mm256_xor_si256(_mm256_xor_si256(VROR(x, 7), \
+							VROR(x, 18)), _mm256_srli_epi32(x, 3))
+#define SIG1(x) _mm256_xor_si256(_mm256_xor_si256(VROR(x, 17), \
+							VROR(x, 19)), _mm256_srli_epi32(x, 10))
+
+__attribute__((target("avx2")))
+static void rounds(uint32_t *state, const uint32_t *wk)
+{
+	/* The 64 rounds, wk holds W+K for this block at wk[8 * (t / 4) +
+	 * t % 4], the layout that storing the schedule vectors leaves. */
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	int t;
+#pragma GCC unroll 64
+	for (t = 0; t < 64; t++) {
+		uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25))
+					+ (g ^ (e & (f ^ g))) + wk[8 * (t >> 2) + (t & 3)];
+		uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22))
+					+ ((a & b) | (c & (a | b)));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+} // rounds()
+
+__attribute__((target("avx2")))
+void blocks_avx2(uint32_t *state, const unsigned char *data,
+					size_t nblocks)
+{
+	/* Two blocks go through the schedule together, one in each 128
+	 * bit lane, so each vector holds four consecutive words of both.
+	 * An odd last block is paired with itself. */
+	const __m256i bswap = _mm256_broadcastsi128_si256(_mm_set_epi64x(
+					0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL));
+	uint32_t wk[128] __attribute__((aligned(32)));
+	__m256i x[4];
+
+	while (nblocks) {
+		const unsigned char *second = (nblocks > 1) ? data + 64 : data;
+		int i, t;
+		for (i = 0; i < 4; i++) {
+			x[i] = _mm256_shuffle_epi8(_mm256_inserti128_si256(
+					_mm256_castsi128_si256(_mm_loadu_si128(
+						(const __m128i *)(data + 16 * i))),
+					_mm_loadu_si128((const __m128i *)(second + 16 * i)),
+					1), bswap);
+			_mm256_store_si256((__m256i *)(wk + 8 * i),
+					_mm256_add_epi32(x[i], _mm256_broadcastsi128_si256(
+						_mm_load_si128((const __m128i *)(kc + 4 * i)))));
+		}
+#pragma GCC unroll 12
+		for (t = 4; t < 16; t++) {
+			// x[0..3] are W[4t-16 .. 4t-1], x[0] becomes W[4t .. 4t+3]
+			__m256i w15 = _mm256_alignr_epi8(x[1], x[0], 4);
+			__m256i w7 = _mm256_alignr_epi8(x[3], x[2], 4);
+			__m256i n = _mm256_add_epi32(_mm256_add_epi32(x[0], w7),
+										SIG0(w15));
+			__m256i s = SIG1(_mm256_shuffle_epi32(x[3], 0xfe));
+			n = _mm256_add_epi32(n, _mm256_blend_epi32(
+								_mm256_setzero_si256(), s, 0x33));
+			s = SIG1(_mm256_shuffle_epi32(n, 0x40));
+			n = _mm256_add_epi32(n, _mm256_blend_epi32(
+								_mm256_setzero_si256(), s, 0xcc));
+			x[0] = x[1];
+			x[1] = x[2];
+			x[2] = x[3];
+			x[3] = n;
+			_mm256_store_si256((__m256i *)(wk + 8 * t),
+					_mm256_add_epi32(n, _mm256_broadcastsi128_si256(
+						_mm_load_si128((const __m128i *)(kc + 4 * t)))));
+		}
+		rounds(state, wk);
+		if (nblocks == 1) break;
+		rounds(state, wk + 4);
+		data += 128;
+		nblocks -= 2;
+	}
+} // blocks_avx2()
+#endif
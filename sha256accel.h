@@ -0,0 +1,38 @@
+/*
+ * sha256accel.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _SHA256ACCEL_H
+# define _SHA256ACCEL_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* Accelerated forms of the sha256 compression function for
+ * sha256_process_block(). state is the eight working words, data is
+ * nblocks whole 64 byte blocks. The SHA extensions do the rounds in
+ * hardware, the AVX2 form computes the message schedule of two blocks
+ * at once and leaves only the rounds as scalar code.
+*/
+typedef void (*sha256blocks)(uint32_t *state, const unsigned char *data,
+								size_t nblocks);
+
+sha256blocks sha256_accelerated(size_t nblocks);
+const char *sha256_implname(void);
+
+#endif
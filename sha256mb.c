@@ -0,0 +1,274 @@
+/*      sha256mb.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include "sha256mb.h"
+#include "sha256.h"
+#include "cpufeatures.h"
+#ifdef CRYPT_X86
+#include <immintrin.h>
+#endif
+
+#ifdef CRYPT_X86
+static const uint32_t kc[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+// compress8() uses only the first 8 lanes of each row.
+static void compress8(uint32_t st[8][16], const uint32_t w[16][16]);
+static void compress16(uint32_t st[8][16], const uint32_t w[16][16]);
+static void group(const unsigned char *const *msg, size_t len,
+					unsigned char *const *digest, int lanes);
+#endif
+
+int sha256mb_lanes(void)
+{
+#ifdef CRYPT_X86
+	unsigned f = cpufeatures();
+	if (f & CPU_AVX512) return 16;
+	if (f & CPU_AVX2) return 8;
+#endif
+	return 1;
+} // sha256mb_lanes()
+
+const char *sha256mb_implname(void)
+{
+	switch (sha256mb_lanes()) {
+		case 16: return "avx512x16";
+		case 8: return "avx2x8";
+	}
+	return "portable";
+} // sha256mb_implname()
+
+void sha256mb_buffers(const unsigned char *const *msg, size_t len,
+						unsigned char *const *digest, int n)
+{
+	/* digest[i] receives the 32 byte sha256sum of the len bytes at
+	 * msg[i], for i < n. */
+	int lanes = sha256mb_lanes();
+	int i;
+#ifdef CRYPT_X86
+	while (lanes > 1 && n > 1) {
+		const unsigned char *m[SHA256MB_MAXLANES];
+		unsigned char *d[SHA256MB_MAXLANES];
+		unsigned char spare[SHA256MB_MAXLANES][32];
+		int k = (n < lanes) ? n : lanes;
+		// a short group is filled out with copies of its first message.
+		for (i = 0; i < lanes; i++) {
+			m[i] = (i < k) ? msg[i] : msg[0];
+			d[i] = (i < k) ? digest[i] : spare[i];
+		}
+		group(m, len, d, lanes);
+		msg += k;
+		digest += k;
+		n -= k;
+	}
+#endif
+	for (i = 0; i < n; i++) {
+		sha256_buffer((const char *)msg[i], len, digest[i]);
+	}
+} // sha256mb_buffers()
+
+#ifdef CRYPT_X86
+void group(const unsigned char *const *msg, size_t len,
+			unsigned char *const *digest, int lanes)
+{
+	/* One message per lane. The blocks are padded and transposed
+	 * here so that word t of every lane's block sits together in
+	 * w[t]. */
+	uint32_t st[8][16] __attribute__((aligned(64)));
+	uint32_t w[16][16] __attribute__((aligned(64)));
+	size_t nblocks = (len + 9 + 63) / 64;
+	uint64_t bits = (uint64_t)len * 8;
+	size_t b;
+	int i, j;
+
+	for (j = 0; j < 8; j++) {
+		for (i = 0; i < lanes; i++) st[j][i] = iv[j];
+	}
+	for (b = 0; b < nblocks; b++) {
+		for (i = 0; i < lanes; i++) {
+			unsigned char blk[64];
+			size_t off = b * 64, n = 0;
+			if (off < len) {
+				n = (len - off < 64) ? len - off : 64;
+				memcpy(blk, msg[i] + off, n);
+			}
+			memset(blk + n, 0, 64 - n);
+			if (len >= off && len - off < 64) blk[len - off] = 0x80;
+			if (b == nblocks - 1) {
+				for (j = 0; j < 8; j++) {
+					blk[56 + j] = (unsigned char)(bits >> (56 - 8 * j));
+				}
+			}
+			for (j = 0; j < 16; j++) {
+				w[j][i] = ((uint32_t)blk[4 * j] << 24)
+						| ((uint32_t)blk[4 * j + 1] << 16)
+						| ((uint32_t)blk[4 * j + 2] << 8)
+						| (uint32_t)blk[4 * j + 3];
+			}
+		}
+		if (lanes == 16) {
+			compress16(st, w);
+		} else {
+			compress8(st, w);
+		}
+	}
+	for (i = 0; i < lanes; i++) {
+		for (j = 0; j < 8; j++) {
+			digest[i][4 * j] = (unsigned char)(st[j][i] >> 24);
+			digest[i][4 * j + 1] = (unsigned char)(st[j][i] >> 16);
+			digest[i][4 * j + 2] = (unsigned char)(st[j][i] >> 8);
+			digest[i][4 * j + 3] = (unsigned char)st[j][i];
+		}
+	}
+} // group()
+
+#define ROR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), \
+						_mm256_slli_epi32(x, 32 - (n)))
+#define ADD8(a, b) _mm256_add_epi32(a, b)
+#define XOR8(a, b) _mm256_xor_si256(a, b)
+
+__attribute__((target("avx2")))
+void compress8(uint32_t st[8][16], const uint32_t w[16][16])
+{
+	__m256i s[8], x[16];
+	int t;
+
+	for (t = 0; t < 8; t++) s[t] = _mm256_loadu_si256((const __m256i *)st[t]);
+	for (t = 0; t < 16; t++) x[t] = _mm256_loadu_si256((const __m256i *)w[t]);
+	__m256i a = s[0], b = s[1], c = s[2], d = s[3];
+	__m256i e = s[4], f = s[5], g = s[6], h = s[7];
+#pragma GCC unroll 64
+	for (t = 0; t < 64; t++) {
+		__m256i wt;
+		if (t < 16) {
+			wt = x[t];
+		} else {
+			__m256i w15 = x[(t - 15) & 15], w2 = x[(t - 2) & 15];
+			__m256i s0 = XOR8(XOR8(ROR8(w15, 7), ROR8(w15, 18)),
+							_mm256_srli_epi32(w15, 3));
+			__m256i s1 = XOR8(XOR8(ROR8(w2, 17), ROR8(w2, 19)),
+							_mm256_srli_epi32(w2, 10));
+			wt = ADD8(ADD8(x[t & 15], s0), ADD8(x[(t - 7) & 15], s1));
+			x[t & 15] = wt;
+		}
+		__m256i t1 = ADD8(ADD8(h, XOR8(XOR8(ROR8(e, 6), ROR8(e, 11)),
+									ROR8(e, 25))),
+					ADD8(XOR8(g, _mm256_and_si256(e, XOR8(f, g))),
+						ADD8(wt, _mm256_set1_epi32((int)kc[t]))));
+		__m256i t2 = ADD8(XOR8(XOR8(ROR8(a, 2), ROR8(a, 13)), ROR8(a, 22)),
+					_mm256_or_si256(_mm256_and_si256(a, b),
+						_mm256_and_si256(c, _mm256_or_si256(a, b))));
+		h = g;
+		g = f;
+		f = e;
+		e = ADD8(d, t1);
+		d = c;
+		c = b;
+		b = a;
+		a = ADD8(t1, t2);
+	}
+	s[0] = ADD8(s[0], a);
+	s[1] = ADD8(s[1], b);
+	s[2] = ADD8(s[2], c);
+	s[3] = ADD8(s[3], d);
+	s[4] = ADD8(s[4], e);
+	s[5] = ADD8(s[5], f);
+	s[6] = ADD8(s[6], g);
+	s[7] = ADD8(s[7], h);
+	for (t = 0; t < 8; t++) _mm256_storeu_si256((__m256i *)st[t], s[t]);
+} // compress8()
+
+#define ROR16(x, n) _mm512_ror_epi32(x, n)
+#define ADD16(a, b) _mm512_add_epi32(a, b)
+// ternary logic immediates: 0x96 a^b^c, 0xca a?b:c, 0xe8 majority.
+#define XOR3(a, b, c) _mm512_ternarylogic_epi32(a, b, c, 0x96)
+
+__attribute__((target("avx512f")))
+void compress16(uint32_t st[8][16], const uint32_t w[16][16])
+{
+	__m512i s[8], x[16];
+	int t;
+
+	for (t = 0; t < 8; t++) s[t] = _mm512_load_si512(st[t]);
+	for (t = 0; t < 16; t++) x[t] = _mm512_load_si512(w[t]);
+	__m512i a = s[0], b = s[1], c = s[2], d = s[3];
+	__m512i e = s[4], f = s[5], g = s[6], h = s[7];
+#pragma GCC unroll 64
+	for (t = 0; t < 64; t++) {
+		__m512i wt;
+		if (t < 16) {
+			wt = x[t];
+		} else {
+			__m512i w15 = x[(t - 15) & 15], w2 = x[(t - 2) & 15];
+			__m512i s0 = XOR3(ROR16(w15, 7), ROR16(w15, 18),
+							_mm512_srli_epi32(w15, 3));
+			__m512i s1 = XOR3(ROR16(w2, 17), ROR16(w2, 19),
+							_mm512_srli_epi32(w2, 10));
+			wt = ADD16(ADD16(x[t & 15], s0), ADD16(x[(t - 7) & 15], s1));
+			x[t & 15] = wt;
+		}
+		__m512i t1 = ADD16(ADD16(h, XOR3(ROR16(e, 6), ROR16(e, 11),
+										ROR16(e, 25))),
+					ADD16(_mm512_ternarylogic_epi32(e, f, g, 0xca),
+						ADD16(wt, _mm512_set1_epi32((int)kc[t]))));
+		__m512i t2 = ADD16(XOR3(ROR16(a, 2), ROR16(a, 13), ROR16(a, 22)),
+					_mm512_ternarylogic_epi32(a, b, c, 0xe8));
+		h = g;
+		g = f;
+		f = e;
+		e = ADD16(d, t1);
+		d = c;
+		c = b;
+		b = a;
+		a = ADD16(t1, t2);
+	}
+	s[0] = ADD16(s[0], a);
+	s[1] = ADD16(s[1], b);
+	s[2] = ADD16(s[2], c);
+	s[3] = ADD16(s[3], d);
+	s[4] = ADD16(s[4], e);
+	s[5] = ADD16(s[5], f);
+	s[6] = ADD16(s[6], g);
+	s[7] = ADD16(s[7], h);
+	for (t = 0; t < 8; t++) _mm512_store_si512(st[t], s[t]);
+} // compress16()
+#endif
@@ -0,0 +1,38 @@
+/*
+ * sha256mb.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _SHA256MB_H
+# define _SHA256MB_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* Multi-buffer sha256. Independent messages of the same length are
+ * hashed side by side, one per lane of a vector register, 16 lanes
+ * with AVX-512, 8 with AVX2. Without either it is sha256_buffer() on
+ * each message in turn.
+*/
+#define SHA256MB_MAXLANES	16
+
+int sha256mb_lanes(void);
+void sha256mb_buffers(const unsigned char *const *msg, size_t len,
+						unsigned char *const *digest, int n);
+const char *sha256mb_implname(void);
+
+#endif
@@ -0,0 +1,595 @@
+/*      store.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "store.h"
+#include "cryptheader.h"
+#include "cryptctx.h"
+#include "calc_nonce.h"
+
+static size_t cutpoint(const chunkstore *s, const unsigned char *p,
+						size_t len);
+static void putchunk(chunkstore *s, const char *p, size_t len,
+						unsigned char *id);
+static int getchunk(chunkstore *s, const unsigned char *id, size_t len,
+					char *out);
+static void recipeout(cryptctx *c, const void *p, size_t len, FILE *fp,
+						char **buf, size_t *bufsize);
+static char *grow(char *buf, size_t *size, size_t need);
+static void chunkpath(const unsigned char *id, char *path);
+static void writeall(int fd, const void *buf, size_t len,
+						const char *fn);
+static void hmacinit(hmackey *k, const void *key, size_t len);
+static void hmac(const hmackey *k, const void *msg, size_t len,
+					unsigned char *out);
+static void put32(unsigned char *p, uint32_t v);
+static uint32_t get32(const unsigned char *p);
+static void put64(unsigned char *p, uint64_t v);
+static uint64_t get64(const unsigned char *p);
+
+void store_open(chunkstore *s, const char *dir, const char *pw,
+				const cryptengine *e, int level)
+{
+	/* Opens the store at dir, making it if it isn't there, in which
+	 * case the pass phrase gets this run's key derivation. A wrong
+	 * pass phrase is fatal. e and level are for the chunks that are
+	 * new, those already there are read whatever they were made
+	 * with. */
+	unsigned char conf[CRYPT_HDRSIZE + CRYPT_IVSIZE + 8 + 32];
+	unsigned char *check = conf + CRYPT_HDRSIZE + CRYPT_IVSIZE + 8;
+	unsigned char sum[32], label[5];
+	char *iv = (char *)conf + CRYPT_HDRSIZE, key[KDF_KEYSIZE];
+	const char *master;
+	cryptheader hdr;
+	hmackey mk;
+	int fd, i, made = 0;
+
+	memset(s, 0, sizeof(chunkstore));
+	s->e = e;
+	s->level = level;
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		perror(dir);
+		exit(EXIT_FAILURE);
+	}
+	s->dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (s->dirfd == -1) {
+		perror(dir);
+		exit(EXIT_FAILURE);
+	}
+	fd = openat(s->dirfd, "config", O_RDONLY);
+	if (fd != -1) {
+		if (read(fd, conf, sizeof(conf)) != sizeof(conf)
+			|| unpackheader(conf, CRYPT_HDRSIZE, &hdr) <= 0
+			|| memcmp(check - 8, STORE_MAGIC, 8) != 0) {
+			fprintf(stderr, "%s: not a chunk store\n", dir);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+	} else if (errno == ENOENT) {
+		initheader(&hdr);
+		calc_nonce(iv);
+		kdf_prepare(pw, &hdr, iv);
+		packheader(&hdr, conf);
+		memcpy(check - 8, STORE_MAGIC, 8);
+		made = 1;
+	} else {
+		perror(dir);
+		exit(EXIT_FAILURE);
+	}
+
+	master = kdf_key(pw, &hdr, iv, key);
+	if (!master) {
+		fprintf(stderr, "%s: not a chunk store\n", dir);
+		exit(EXIT_FAILURE);
+	}
+	hmacinit(&mk, master, strlen(master));
+	hmac(&mk, "store check", 11, sum);
+	if (made) {
+		memcpy(check, sum, 32);
+		fd = openat(s->dirfd, "config.tmp", O_WRONLY | O_CREAT | O_TRUNC,
+					0600);
+		if (fd == -1) {
+			perror("config.tmp");
+			exit(EXIT_FAILURE);
+		}
+		writeall(fd, conf, sizeof(conf), "config.tmp");
+		if (fsync(fd) == -1 || close(fd) == -1
+			|| renameat(s->dirfd, "config.tmp", s->dirfd, "config")
+				== -1) {
+			perror("config");
+			exit(EXIT_FAILURE);
+		}
+	} else if (memcmp(check, sum, 32) != 0) {
+		fprintf(stderr, "%s: wrong pass phrase for this store\n", dir);
+		exit(EXIT_FAILURE);
+	}
+	hmac(&mk, "chunk id", 8, sum);
+	hmacinit(&s->id, sum, 32);
+	hmac(&mk, "chunk key", 9, sum);
+	for (i = 0; i < 32; i++) sprintf(s->key + 2 * i, "%02x", sum[i]);
+	memcpy(label, "gear", 4);
+	for (i = 0; i < 256; i++) {
+		label[4] = i;
+		hmac(&s->id, label, 5, sum);
+		s->gear[i] = get64(sum);
+	}
+	memset(&mk, 0, sizeof(mk));
+	memset(sum, 0, sizeof(sum));
+	memset(key, 0, sizeof(key));
+
+	lz_init(&s->z, level);
+	s->frame = malloc(lz_bound(STORE_MAXCHUNK));
+	if (!s->frame) {
+		perror("malloc failure in store_open()");
+		exit(EXIT_FAILURE);
+	}
+} // store_open()
+
+int store_backup(chunkstore *s, FILE *fpi, const char *recipe,
+					size_t bufsize)
+{
+	/* Cuts fpi into chunks, stores those that are new and writes the
+	 * recipe, through a temporary file that is renamed once the
+	 * chunks and it are on disk, so that a recipe never names a chunk
+	 * that isn't. Returns 0, having said what it did in s. */
+	unsigned char hbuf[CRYPT_HDRSIZE], ent[STORE_ENTSIZE];
+	unsigned char foot[STORE_FOOTSIZE];
+	char iv[CRYPT_IVSIZE], *buf, *tmp, *rbuf = NULL;
+	size_t avail = 0, pos, rbufsize = 0, got, last;
+	cryptheader hdr;
+	cryptctx c;
+	FILE *rp;
+	int eof = 0;
+
+	if (bufsize < 2 * STORE_MAXCHUNK) bufsize = 2 * STORE_MAXCHUNK;
+	buf = malloc(bufsize);
+	tmp = malloc(strlen(recipe) + 5);
+	if (!buf || !tmp) {
+		perror("malloc failure in store_backup()");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(tmp, "%s.tmp", recipe);
+	rp = fopen(tmp, "w");
+	if (!rp) {
+		perror(tmp);
+		exit(EXIT_FAILURE);
+	}
+	initheader(&hdr);
+	hdr.engine = s->e->id;
+	calc_nonce(iv);
+	packheader(&hdr, hbuf);
+	if (fwrite(hbuf, 1, CRYPT_HDRSIZE, rp) != CRYPT_HDRSIZE
+		|| fwrite(iv, 1, CRYPT_IVSIZE, rp) != CRYPT_IVSIZE) {
+		perror(tmp);
+		exit(EXIT_FAILURE);
+	}
+	ctx_init(&c, s->e, &hdr, s->key, iv, CRYPT_IVSIZE, 0);
+	recipeout(&c, STORE_RECIPEMAGIC, 8, rp, &rbuf, &rbufsize);
+
+	while (!eof) {
+		while (avail < bufsize && !eof) {
+			size_t n = fread(buf + avail, 1, bufsize - avail, fpi);
+			if (!n) {
+				if (ferror(fpi)) {
+					perror("fread");
+					exit(EXIT_FAILURE);
+				}
+				eof = 1;
+			}
+			avail += n;
+		}
+		// a chunk can only be cut short at the end of the input.
+		for (pos = 0; avail - pos >= STORE_MAXCHUNK
+						|| (eof && pos < avail); pos += got) {
+			got = cutpoint(s, (unsigned char *)buf + pos, avail - pos);
+			putchunk(s, buf + pos, got, ent);
+			put32(ent + STORE_IDSIZE, got);
+			recipeout(&c, ent, STORE_ENTSIZE, rp, &rbuf, &rbufsize);
+			s->bytes += got;
+		}
+		memmove(buf, buf + pos, avail - pos);
+		avail -= pos;
+	}
+	put64(foot, s->chunks);
+	put64(foot + 8, s->bytes);
+	recipeout(&c, foot, STORE_FOOTSIZE, rp, &rbuf, &rbufsize);
+	(void)ctx_final(&c, rbuf, &last);
+	if (fwrite(rbuf, 1, last, rp) != last || fflush(rp) == EOF
+		|| fsync(fileno(rp)) == -1 || syncfs(s->dirfd) == -1
+		|| fclose(rp) == EOF || rename(tmp, recipe) == -1) {
+		perror(recipe);
+		unlink(tmp);
+		exit(EXIT_FAILURE);
+	}
+	free(rbuf);
+	free(tmp);
+	free(buf);
+	return 0;
+} // store_backup()
+
+int store_restore(chunkstore *s, const char *recipe, FILE *fpo)
+{
+	/* Writes out the chunks that recipe names, checking each against
+	 * its name. Returns 0, or -1 having said what is wrong. */
+	unsigned char hbuf[CRYPT_HDRSIZE], *p;
+	char iv[CRYPT_IVSIZE], in[64 * 1024], *plain, *chunk;
+	size_t np = 0, pos = 8, got, n, psize;
+	uint64_t count = 0, total = 0;
+	const cryptengine *e;
+	cryptheader hdr;
+	cryptctx c;
+	int res = 0, last = 0;
+	FILE *rp = fopen(recipe, "r");
+
+	if (!rp) {
+		perror(recipe);
+		return -1;
+	}
+	if (fread(hbuf, 1, CRYPT_HDRSIZE, rp) != CRYPT_HDRSIZE
+		|| unpackheader(hbuf, CRYPT_HDRSIZE, &hdr) <= 0
+		|| !(e = engine_byid(hdr.engine))
+		|| fread(iv, 1, CRYPT_IVSIZE, rp) != CRYPT_IVSIZE) {
+		fprintf(stderr, "%s: not a recipe\n", recipe);
+		fclose(rp);
+		return -1;
+	}
+	if (ctx_init(&c, e, &hdr, s->key, iv, CRYPT_IVSIZE, ENGINE_DECRYPT)) {
+		fprintf(stderr, "%s: not a recipe\n", recipe);
+		fclose(rp);
+		return -1;
+	}
+	// what is left of an entry and what one update can add.
+	psize = STORE_ENTSIZE + STORE_FOOTSIZE + 8 + ctx_outsize(&c, sizeof(in))
+			+ c.job.outseg;
+	plain = malloc(psize);
+	chunk = malloc(STORE_MAXCHUNK);
+	if (!plain || !chunk) {
+		perror("malloc failure in store_restore()");
+		exit(EXIT_FAILURE);
+	}
+	while (!last && !res) {
+		n = fread(in, 1, sizeof(in), rp);
+		last = n < sizeof(in);
+		res = ctx_update(&c, in, n, plain + np, &got);
+		if (res || last) {
+			size_t fin;
+			if (ctx_final(&c, plain + np + got, &fin)) res = -1;
+			got += fin;
+			last = 1;
+		}
+		np += got;
+		if (res) {
+			fprintf(stderr, "%s: authentication failed\n", recipe);
+			break;
+		}
+		if (pos == 8) {
+			if (np < 8) continue;
+			if (memcmp(plain, STORE_RECIPEMAGIC, 8) != 0) {
+				fprintf(stderr, "%s: not a recipe\n", recipe);
+				res = -1;
+				break;
+			}
+		}
+		// the footer is only known to be one at the end.
+		for (p = (unsigned char *)plain + pos;
+				np - pos >= STORE_ENTSIZE + STORE_FOOTSIZE;
+				p += STORE_ENTSIZE, pos += STORE_ENTSIZE) {
+			size_t len = get32(p + STORE_IDSIZE);
+			if (len > STORE_MAXCHUNK
+				|| getchunk(s, p, len, chunk)) {
+				res = -1;
+				break;
+			}
+			if (fwrite(chunk, 1, len, fpo) != len) {
+				perror("fwrite");
+				exit(EXIT_FAILURE);
+			}
+			count++;
+			total += len;
+		}
+		memmove(plain, plain + pos, np - pos);
+		np -= pos;
+		pos = 0;
+	}
+	if (!res && (np != STORE_FOOTSIZE || get64((unsigned char *)plain)
+					!= count || get64((unsigned char *)plain + 8) != total)) {
+		fprintf(stderr, "%s: cut short or corrupt\n", recipe);
+		res = -1;
+	}
+	if (!last) (void)ctx_final(&c, plain, &got);
+	s->chunks = count;
+	s->bytes = total;
+	free(chunk);
+	free(plain);
+	fclose(rp);
+	return res;
+} // store_restore()
+
+void store_close(chunkstore *s)
+{
+	close(s->dirfd);
+	lz_free(&s->z);
+	free(s->frame);
+	free(s->cbuf);
+	free(s->pbuf);
+	memset(s, 0, sizeof(chunkstore));	// the keys.
+} // store_close()
+
+size_t cutpoint(const chunkstore *s, const unsigned char *p, size_t len)
+{
+	/* The length of the chunk at p, from STORE_MINCHUNK to
+	 * STORE_MAXCHUNK or len. It ends where the gear hash, in effect of
+	 * the last 64 bytes, has its top bits 0, more of them before the
+	 * average length than after it so that most chunks are near it. */
+	const uint64_t small = ~(uint64_t)0 << (64 - STORE_AVGBITS - 2);
+	const uint64_t large = ~(uint64_t)0 << (64 - STORE_AVGBITS + 2);
+	size_t i, avg = (size_t)1 << STORE_AVGBITS, max = STORE_MAXCHUNK;
+	uint64_t h = 0;
+
+	if (len <= STORE_MINCHUNK) return len;
+	if (max > len) max = len;
+	if (avg > max) avg = max;
+	for (i = STORE_MINCHUNK; i < avg; i++) {
+		h = (h << 1) + s->gear[p[i]];
+		if (!(h & small)) return i + 1;
+	}
+	for (; i < max; i++) {
+		h = (h << 1) + s->gear[p[i]];
+		if (!(h & large)) return i + 1;
+	}
+	return max;
+} // cutpoint()
+
+void putchunk(chunkstore *s, const char *p, size_t len,
+				unsigned char *id)
+{
+	/* Names the chunk in id and stores it if it isn't already, through
+	 * a temporary file, synced before it is renamed, so that one found
+	 * is always whole; a later run takes one that is there as stored.
+	 * Its IV is a fresh nonce, as for any other file, so that the key
+	 * is never used twice with one, whatever the chunk is written
+	 * with. */
+	char path[2 * STORE_IDSIZE + 2], tmp[2 * STORE_IDSIZE + 32];
+	char iv[CRYPT_IVSIZE];
+	unsigned char hbuf[CRYPT_HDRSIZE];
+	const char *plain = p;
+	size_t plen = len, got, last;
+	cryptheader hdr;
+	cryptctx c;
+	struct stat sb;
+	int fd;
+
+	hmac(&s->id, p, len, id);
+	chunkpath(id, path);
+	s->chunks++;
+	if (fstatat(s->dirfd, path, &sb, 0) == 0) return;	// have it.
+
+	initheader(&hdr);
+	hdr.engine = s->e->id;
+	if (s->level) {
+		hdr.codec = CRYPT_CODEC_LZ;
+		plen = lz_frame(&s->z, p, len, s->frame);
+		plain = s->frame;
+	}
+	packheader(&hdr, hbuf);
+	calc_nonce(iv);
+	ctx_init(&c, s->e, &hdr, s->key, iv, CRYPT_IVSIZE, 0);
+	s->cbuf = grow(s->cbuf, &s->cbufsize, ctx_outsize(&c, plen));
+	(void)ctx_update(&c, plain, plen, s->cbuf, &got);
+	(void)ctx_final(&c, s->cbuf + got, &last);
+
+	path[2] = '\0';
+	if (mkdirat(s->dirfd, path, 0700) == -1 && errno != EEXIST) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	path[2] = '/';
+	sprintf(tmp, "%s.%d.tmp", path, (int)getpid());
+	fd = openat(s->dirfd, tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		perror(tmp);
+		exit(EXIT_FAILURE);
+	}
+	writeall(fd, hbuf, CRYPT_HDRSIZE, tmp);
+	writeall(fd, iv, CRYPT_IVSIZE, tmp);
+	writeall(fd, s->cbuf, got + last, tmp);
+	if (fsync(fd) == -1 || close(fd) == -1
+		|| renameat(s->dirfd, tmp, s->dirfd, path) == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	s->newchunks++;
+	s->stored += CRYPT_HDRSIZE + CRYPT_IVSIZE + got + last;
+} // putchunk()
+
+int getchunk(chunkstore *s, const unsigned char *id, size_t len,
+				char *out)
+{
+	/* The len bytes of the chunk named id into out, or -1 having said
+	 * why. It must decrypt, and have that length and that name. */
+	char path[2 * STORE_IDSIZE + 2];
+	unsigned char sum[STORE_IDSIZE];
+	const cryptengine *e;
+	cryptheader hdr;
+	cryptctx c;
+	struct stat sb;
+	size_t got, last, flen;
+	int fd, res;
+
+	chunkpath(id, path);
+	fd = openat(s->dirfd, path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &sb) == -1) {
+		perror(path);
+		if (fd != -1) close(fd);
+		return -1;
+	}
+	flen = sb.st_size;
+	s->cbuf = grow(s->cbuf, &s->cbufsize, flen);
+	res = read(fd, s->cbuf, flen) != (ssize_t)flen;
+	close(fd);
+	if (res || flen < CRYPT_HDRSIZE + CRYPT_IVSIZE
+		|| unpackheader((unsigned char *)s->cbuf, flen, &hdr) <= 0
+		|| !(e = engine_byid(hdr.engine)) || hdr.kdf != KDF_NONE) {
+		fprintf(stderr, "%s: not a chunk\n", path);
+		return -1;
+	}
+	if (ctx_init(&c, e, &hdr, s->key, s->cbuf + CRYPT_HDRSIZE,
+					CRYPT_IVSIZE, ENGINE_DECRYPT)) {
+		fprintf(stderr, "%s: not a chunk\n", path);
+		return -1;
+	}
+	flen -= CRYPT_HDRSIZE + CRYPT_IVSIZE;
+	s->pbuf = grow(s->pbuf, &s->pbufsize, ctx_outsize(&c, flen));
+	res = ctx_update(&c, s->cbuf + CRYPT_HDRSIZE + CRYPT_IVSIZE, flen,
+						s->pbuf, &got);
+	if (ctx_final(&c, s->pbuf + got, &last)) res = -1;
+	got += last;
+	if (!res && hdr.codec) {
+		ssize_t fl = (got < LZ_FRAMEHDR) ? -1 : lz_framelen(s->pbuf);
+		size_t olen;
+		if (fl != (ssize_t)got || lz_unframe(s->pbuf, out, &olen)
+			|| olen != len) res = -1;
+	} else if (!res) {
+		if (got == len) memcpy(out, s->pbuf, len); else res = -1;
+	}
+	if (!res) {
+		hmac(&s->id, out, len, sum);
+		if (memcmp(sum, id, STORE_IDSIZE) != 0) res = -1;
+	}
+	if (res) fprintf(stderr, "%s: authentication failed\n", path);
+	return res;
+} // getchunk()
+
+void recipeout(cryptctx *c, const void *p, size_t len, FILE *fp,
+				char **buf, size_t *bufsize)
+{
+	// len more bytes of the recipe's plain text.
+	size_t got;
+	*buf = grow(*buf, bufsize, ctx_outsize(c, len));
+	(void)ctx_update(c, p, len, *buf, &got);
+	if (fwrite(*buf, 1, got, fp) != got) {
+		perror("fwrite");
+		exit(EXIT_FAILURE);
+	}
+} // recipeout()
+
+char *grow(char *buf, size_t *size, size_t need)
+{
+	// buf with room for need bytes.
+	if (need <= *size) return buf;
+	buf = realloc(buf, need);
+	if (!buf) {
+		perror("malloc failure in grow()");
+		exit(EXIT_FAILURE);
+	}
+	*size = need;
+	return buf;
+} // grow()
+
+void chunkpath(const unsigned char *id, char *path)
+{
+	// ab/cdef..., from the name in hex.
+	int i;
+	sprintf(path, "%02x/", id[0]);
+	for (i = 1; i < STORE_IDSIZE; i++) {
+		sprintf(path + 1 + 2 * i, "%02x", id[i]);
+	}
+} // chunkpath()
+
+void writeall(int fd, const void *buf, size_t len, const char *fn)
+{
+	const char *p = buf;
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			perror(fn);
+			exit(EXIT_FAILURE);
+		}
+		p += n;
+		len -= n;
+	}
+} // writeall()
+
+void hmacinit(hmackey *k, const void *key, size_t len)
+{
+	// RFC 2104, the pads hashed once for every message to come.
+	unsigned char kb[64], pad[64];
+	int i;
+
+	memset(kb, 0, 64);
+	if (len > 64) {
+		sha256_buffer(key, len, kb);
+	} else {
+		memcpy(kb, key, len);
+	}
+	for (i = 0; i < 64; i++) pad[i] = kb[i] ^ 0x36;
+	sha256_init_ctx(&k->inner);
+	sha256_process_block(pad, 64, &k->inner);
+	for (i = 0; i < 64; i++) pad[i] = kb[i] ^ 0x5c;
+	sha256_init_ctx(&k->outer);
+	sha256_process_block(pad, 64, &k->outer);
+	memset(kb, 0, sizeof(kb));
+	memset(pad, 0, sizeof(pad));
+} // hmacinit()
+
+void hmac(const hmackey *k, const void *msg, size_t len,
+			unsigned char *out)
+{
+	// HMAC-SHA256 of msg, 32 bytes at out.
+	struct sha256_ctx c = k->inner;
+	sha256_process_bytes(msg, len, &c);
+	sha256_finish_ctx(&c, out);
+	c = k->outer;
+	sha256_process_bytes(out, 32, &c);
+	sha256_finish_ctx(&c, out);
+} // hmac()
+
+void put32(unsigned char *p, uint32_t v)
+{
+	int i;
+	for (i = 0; i < 4; i++) p[i] = v >> (8 * i);
+} // put32()
+
+uint32_t get32(const unsigned char *p)
+{
+	uint32_t v = 0;
+	int i;
+	for (i = 3; i >= 0; i--) v = (v << 8) | p[i];
+	return v;
+} // get32()
+
+void put64(unsigned char *p, uint64_t v)
+{
+	int i;
+	for (i = 0; i < 8; i++) p[i] = v >> (8 * i);
+} // put64()
+
+uint64_t get64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+	for (i = 7; i >= 0; i--) v = (v << 8) | p[i];
+	return v;
+} // get64()
@@ -0,0 +1,95 @@
+/*
+ * store.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _STORE_H
+# define _STORE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "sha256.h"
+#include "engine.h"
+#include "kdf.h"
+#include "lz.h"
+
+/* --store. Backups of files that change little from one to the next,
+ * kept as the chunks they are made of, each stored once however many
+ * backups have it. The input is cut where a rolling hash of its last
+ * bytes says, so that an insertion or deletion only changes the chunks
+ * it is in, and the chunks after it are found in the store again.
+ * The gear table the rolling hash uses comes from the store's key, so
+ * the cuts say nothing about the content to anyone without it.
+ * A chunk is named by HMAC-SHA256 of its content under a key of the
+ * store's, and is a file of the usual format under the store, in
+ * ab/cdef..., its name in hex, encrypted with another key of the
+ * store's and an IV of its own. A chunk is synced before it is put
+ * in place, as one that is there is taken to be whole, and a backup
+ * syncs the store before it puts its recipe in place, the names and
+ * lengths of its chunks in order, encrypted the same way.
+ * The store's file "config" is a header and IV whose key derivation
+ * the pass phrase goes through, then STORE_MAGIC and a check value
+ * that shows whether it is the right one. The keys are HMACs of labels
+ * under what that derives.
+ * Layout of the plain text of a recipe, integers little endian:
+ *   0..7   magic "CRECIPE1"
+ *   then for each chunk its STORE_IDSIZE byte name and 4 byte length,
+ *   and last the number of chunks and the total length, 8 bytes each.
+*/
+#define STORE_MINCHUNK		(16 * 1024)
+#define STORE_AVGBITS		16			// 64K on average,
+#define STORE_MAXCHUNK		(256 * 1024)
+#define STORE_MAGIC			"CSTORE01"
+#define STORE_RECIPEMAGIC	"CRECIPE1"
+#define STORE_IDSIZE		32
+#define STORE_ENTSIZE		(STORE_IDSIZE + 4)
+#define STORE_FOOTSIZE		16
+
+typedef struct hmackey {
+	struct sha256_ctx inner;	// the pads hashed, ready for a message.
+	struct sha256_ctx outer;
+} hmackey;
+
+typedef struct chunkstore {
+	int dirfd;
+	const cryptengine *e;	// new chunks and recipes are encrypted with,
+	int level;				// and chunks compressed at, if not 0.
+	hmackey id;				// chunk names,
+	char key[KDF_KEYSIZE];	// and their key, in hex.
+	uint64_t gear[256];
+	lzstate z;
+	char *frame;			// a chunk compressed,
+	char *cbuf;				// a chunk's file,
+	size_t cbufsize;
+	char *pbuf;				// and that decrypted.
+	size_t pbufsize;
+	size_t chunks;			// what a backup has done.
+	size_t newchunks;
+	uint64_t bytes;
+	uint64_t stored;
+} chunkstore;
+
+void store_open(chunkstore *s, const char *dir, const char *pw,
+				const cryptengine *e, int level);
+int store_backup(chunkstore *s, FILE *fpi, const char *recipe,
+					size_t bufsize);
+int store_restore(chunkstore *s, const char *recipe, FILE *fpo);
+void store_close(chunkstore *s);
+
+#endif
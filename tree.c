@@ -0,0 +1,297 @@
+/*      tree.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tree.h"
+
+static void *treeworker(void *arg);
+static void readdirectory(treepool *p, treework *w);
+static void queue(treepool *p, treework **dirs, treework **files,
+					size_t *nfiles, treestats *st);
+static void prepend(treework **to, treework *list);
+static treework *newwork(char *in, char *out, off_t size,
+							treework *next);
+static void freework(treework *w);
+static char *pathcat(const char *dir, const char *name);
+static int isinside(const char *dst, const char *src);
+
+int tree_run(const char *src, const char *dst, int nworkers,
+				treefunc fn, void *arg, treestats *st)
+{
+	/* Runs the whole tree on nworkers threads and returns the number
+	 * of files and directories that failed, each having been reported.
+	 * dst is made if it isn't there, but may not be src or anywhere
+	 * under it. */
+	treepool pool;
+	pthread_t *tids;
+	struct stat sb;
+	int i, made;
+
+	if (stat(src, &sb) == -1) {
+		perror(src);
+		exit(EXIT_FAILURE);
+	}
+	if (!S_ISDIR(sb.st_mode)) {
+		fprintf(stderr, "%s: Not a directory\n", src);
+		exit(EXIT_FAILURE);
+	}
+	made = mkdir(dst, sb.st_mode | S_IRWXU) == 0;
+	if (!made && errno != EEXIST) {
+		perror(dst);
+		exit(EXIT_FAILURE);
+	}
+	if (isinside(dst, src)) {
+		fprintf(stderr, "%s is inside %s\n", dst, src);
+		if (made) rmdir(dst);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&pool, 0, sizeof(treepool));
+	pool.dirs = newwork(strdup(src), strdup(dst), 0, NULL);
+	pool.nworkers = nworkers;
+	pool.fn = fn;
+	pool.arg = arg;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.more, NULL);
+	tids = malloc(nworkers * sizeof(pthread_t));
+	if (!tids) {
+		perror("malloc failure in tree_run()");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < nworkers; i++) {
+		int res = pthread_create(&tids[i], NULL, treeworker, &pool);
+		if (res) {
+			errno = res;
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < nworkers; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+	pthread_cond_destroy(&pool.more);
+	pthread_mutex_destroy(&pool.lock);
+	*st = pool.st;
+	return pool.st.failed;
+} // tree_run()
+
+void *treeworker(void *arg)
+{
+	/* Takes a directory to read while there aren't many files waiting,
+	 * otherwise a file, and stops when there is neither and no other
+	 * thread is busy, so can't find more. */
+	treepool *p = arg;
+
+	pthread_mutex_lock(&p->lock);
+	while (1) {
+		treework *w;
+		if (p->dirs && (p->nfiles < TREE_QUEUE || !p->files)) {
+			w = p->dirs;
+			p->dirs = w->next;
+			p->busy++;
+			pthread_mutex_unlock(&p->lock);
+			readdirectory(p, w);
+			pthread_mutex_lock(&p->lock);
+		} else if (p->files) {
+			int threads = 1, res;
+			w = p->files;
+			p->files = w->next;
+			p->nfiles--;
+			p->busy++;
+			if (w->size >= TREE_BIGFILE) threads += p->nworkers - p->busy;
+			pthread_mutex_unlock(&p->lock);
+			res = p->fn(w->in, w->out, threads, p->arg);
+			pthread_mutex_lock(&p->lock);
+			if (res) {
+				p->st.failed++;
+			} else {
+				p->st.files++;
+				p->st.bytes += w->size;
+			}
+		} else if (p->busy) {
+			pthread_cond_wait(&p->more, &p->lock);
+			continue;
+		} else {
+			break;
+		}
+		freework(w);
+		p->busy--;
+		if (!p->busy && !p->dirs && !p->files) {
+			pthread_cond_broadcast(&p->more);	// all done.
+		}
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+} // treeworker()
+
+void readdirectory(treepool *p, treework *w)
+{
+	/* Makes the subdirectories of w under the destination and queues
+	 * them and the files, TREE_BATCH entries at a time so that other
+	 * threads can start on them while the rest are read. */
+	DIR *d = opendir(w->in);
+	struct dirent *de;
+	treework *dirs = NULL, *files = NULL;
+	size_t nfiles = 0, n = 0;
+	treestats st;
+
+	memset(&st, 0, sizeof(treestats));
+	if (!d) {
+		perror(w->in);
+		st.failed++;
+		queue(p, &dirs, &files, &nfiles, &st);
+		return;
+	}
+	while ((de = readdir(d))) {
+		struct stat sb;
+		char *in, *out;
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		if (de->d_type != DT_UNKNOWN && de->d_type != DT_DIR
+			&& de->d_type != DT_REG) {
+			st.skipped++;	// no need to stat it to know.
+			continue;
+		}
+		in = pathcat(w->in, de->d_name);
+		if (fstatat(dirfd(d), de->d_name, &sb, AT_SYMLINK_NOFOLLOW)
+			== -1) {
+			perror(in);
+			free(in);
+			st.failed++;
+			continue;
+		}
+		if (!S_ISDIR(sb.st_mode) && !S_ISREG(sb.st_mode)) {
+			free(in);
+			st.skipped++;
+			continue;
+		}
+		out = pathcat(w->out, de->d_name);
+		if (S_ISDIR(sb.st_mode)) {
+			if (mkdir(out, sb.st_mode | S_IRWXU) == -1 && errno != EEXIST) {
+				perror(out);
+				free(in);
+				free(out);
+				st.failed++;
+				continue;
+			}
+			st.dirs++;
+			dirs = newwork(in, out, 0, dirs);
+		} else {
+			files = newwork(in, out, sb.st_size, files);
+			nfiles++;
+		}
+		if (++n == TREE_BATCH) {
+			queue(p, &dirs, &files, &nfiles, &st);
+			n = 0;
+		}
+	}
+	closedir(d);
+	queue(p, &dirs, &files, &nfiles, &st);
+} // readdirectory()
+
+void queue(treepool *p, treework **dirs, treework **files,
+			size_t *nfiles, treestats *st)
+{
+	// Hands the work and counts to the pool, leaving them empty.
+	pthread_mutex_lock(&p->lock);
+	prepend(&p->dirs, *dirs);
+	prepend(&p->files, *files);
+	p->nfiles += *nfiles;
+	p->st.dirs += st->dirs;
+	p->st.skipped += st->skipped;
+	p->st.failed += st->failed;
+	if (*dirs || *files) pthread_cond_broadcast(&p->more);
+	pthread_mutex_unlock(&p->lock);
+	*dirs = *files = NULL;
+	*nfiles = 0;
+	memset(st, 0, sizeof(treestats));
+} // queue()
+
+void prepend(treework **to, treework *list)
+{
+	// puts list in front of *to.
+	treework *tail = list;
+	if (!list) return;
+	while (tail->next) tail = tail->next;
+	tail->next = *to;
+	*to = list;
+} // prepend()
+
+treework *newwork(char *in, char *out, off_t size, treework *next)
+{
+	// in and out now belong to the work.
+	treework *w = malloc(sizeof(treework));
+	if (!w || !in || !out) {
+		perror("malloc failure in newwork()");
+		exit(EXIT_FAILURE);
+	}
+	w->in = in;
+	w->out = out;
+	w->size = size;
+	w->next = next;
+	return w;
+} // newwork()
+
+void freework(treework *w)
+{
+	free(w->in);
+	free(w->out);
+	free(w);
+} // freework()
+
+char *pathcat(const char *dir, const char *name)
+{
+	// dir/name, with no doubled '/'.
+	size_t dlen = strlen(dir), nlen = strlen(name);
+	char *path = malloc(dlen + nlen + 2);
+	if (!path) {
+		perror("malloc failure in pathcat()");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(path, dir, dlen);
+	if (!dlen || dir[dlen - 1] != '/') path[dlen++] = '/';
+	memcpy(path + dlen, name, nlen + 1);
+	return path;
+} // pathcat()
+
+int isinside(const char *dst, const char *src)
+{
+	// 1 if dst, which exists, is src or somewhere under it.
+	char *rd = realpath(dst, NULL), *rs = realpath(src, NULL);
+	size_t len;
+	int res;
+
+	if (!rd || !rs) {
+		perror("realpath");
+		exit(EXIT_FAILURE);
+	}
+	len = strlen(rs);
+	res = strncmp(rd, rs, len) == 0
+			&& (rd[len] == '\0' || rd[len] == '/' || rs[len - 1] == '/');
+	free(rd);
+	free(rs);
+	return res;
+} // isinside()
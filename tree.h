@@ -0,0 +1,81 @@
+/*
+ * tree.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _TREE_H
+# define _TREE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+/* --tree. A source directory is walked and its files transformed into
+ * the same names under a destination, which is made with the
+ * subdirectories as they are found. Reading the directories and
+ * transforming the files are both work for one pool of threads, so a
+ * deep tree is read by as many of them as there is work for, and they
+ * go back to reading it whenever the files found so far run low.
+ * A file of TREE_BIGFILE or more is given the threads of the pool that
+ * are idle when it is started as well as its own, so a few huge files
+ * still keep every cpu busy while a lot of small ones are done one to
+ * a thread. Symbolic links and anything else that isn't a file or a
+ * directory are passed over, and a file that fails doesn't stop the
+ * others.
+*/
+#define TREE_BIGFILE	(64 * 1024 * 1024)
+#define TREE_QUEUE		4096	// files found before reading stops.
+#define TREE_BATCH		256		// entries queued at a time.
+
+// transforms in to out with up to threads threads, 0 or -1.
+typedef int (*treefunc)(const char *in, const char *out, int threads,
+						void *arg);
+
+typedef struct treestats {
+	size_t files;		// transformed,
+	size_t dirs;		// made under the destination,
+	size_t skipped;		// links, devices and the like,
+	size_t failed;		// files and directories.
+	uint64_t bytes;		// read from the files transformed.
+} treestats;
+
+typedef struct treework {
+	char *in;
+	char *out;
+	off_t size;			// of a file.
+	struct treework *next;
+} treework;
+
+typedef struct treepool {
+	treework *dirs;		// to be read,
+	treework *files;	// to be transformed,
+	size_t nfiles;		// how many of them.
+	int busy;			// threads with something in hand.
+	int nworkers;
+	pthread_mutex_t lock;
+	pthread_cond_t more;
+	treefunc fn;
+	void *arg;
+	treestats st;
+} treepool;
+
+int tree_run(const char *src, const char *dst, int nworkers,
+				treefunc fn, void *arg, treestats *st);
+
+#endif
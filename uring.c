@@ -0,0 +1,300 @@
+/*      uring.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) \
+	&& __has_include(<linux/io_uring.h>)
+# include <linux/io_uring.h>
+# define HAVE_IO_URING 1
+#endif
+
+static void queue(uring *u, const urreq *rq);
+static void blockingio(uring *u);
+#ifdef HAVE_IO_URING
+static int setup(uring *u, unsigned depth);
+static int enter(uring *u, unsigned submit, unsigned wait);
+#endif
+
+void uring_init(uring *u, unsigned depth, char **bufs, unsigned nbufs,
+				size_t bufsize)
+{
+	/* depth is the most requests that will be outstanding at once.
+	 * Each of the nbufs buffers is bufsize bytes. Registering them
+	 * counts against RLIMIT_MEMLOCK, if that is too small the ring is
+	 * used with ordinary reads and writes instead.
+	*/
+	memset(u, 0, sizeof(uring));
+	u->fd = -1;
+	u->depth = depth;
+	u->bufs = bufs;
+	u->nbufs = nbufs;
+#ifdef HAVE_IO_URING
+	if (setup(u, depth) == 0) {
+		struct iovec *iov = malloc(nbufs * sizeof(struct iovec));
+		unsigned i;
+		if (!iov) {
+			perror("malloc failure in uring_init()");
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < nbufs; i++) {
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len = bufsize;
+		}
+		u->fixed = syscall(__NR_io_uring_register, u->fd,
+						IORING_REGISTER_BUFFERS, iov, nbufs) == 0;
+		free(iov);
+		return;
+	}
+#else
+	(void)bufsize;
+#endif
+	u->pending = malloc(depth * sizeof(urreq));
+	u->donetag = malloc(depth * sizeof(uint64_t));
+	u->doneres = malloc(depth * sizeof(ssize_t));
+	if (!u->pending || !u->donetag || !u->doneres) {
+		perror("malloc failure in uring_init()");
+		exit(EXIT_FAILURE);
+	}
+} // uring_init()
+
+void uring_read(uring *u, int fd, int buf, char *addr, size_t len,
+				off_t off, uint64_t tag)
+{
+	// buf is the index of the registered buffer that holds addr.
+	urreq rq = { fd, 0, buf, addr, len, off, tag };
+	queue(u, &rq);
+} // uring_read()
+
+void uring_write(uring *u, int fd, int buf, const char *addr,
+				size_t len, off_t off, uint64_t tag)
+{
+	urreq rq = { fd, 1, buf, (char *)addr, len, off, tag };
+	queue(u, &rq);
+} // uring_write()
+
+void uring_submit(uring *u)
+{
+	// Starts everything queued since the last call.
+#ifdef HAVE_IO_URING
+	if (u->fd != -1) {
+		while (u->queued) {
+			int n = enter(u, u->queued, 0);
+			u->queued -= n;
+		}
+		return;
+	}
+#endif
+	blockingio(u);
+} // uring_submit()
+
+ssize_t uring_wait(uring *u, uint64_t *tag)
+{
+	/* Waits for a request to finish and returns its result, a byte
+	 * count or -errno, with its tag in *tag. Requests finish in any
+	 * order. */
+	ssize_t res;
+#ifdef HAVE_IO_URING
+	if (u->fd != -1) {
+		unsigned head = *u->cqhead;
+		struct io_uring_cqe *cqe;
+		while (head == __atomic_load_n(u->cqtail, __ATOMIC_ACQUIRE)) {
+			enter(u, 0, 1);
+		}
+		cqe = (struct io_uring_cqe *)u->cqes + (head & *u->cqmask);
+		*tag = cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(u->cqhead, head + 1, __ATOMIC_RELEASE);
+		return res;
+	}
+#endif
+	if (!u->ndone) {
+		fputs("uring_wait() with nothing outstanding\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	*tag = u->donetag[u->donehead];
+	res = u->doneres[u->donehead];
+	u->donehead = (u->donehead + 1) % u->depth;
+	u->ndone--;
+	return res;
+} // uring_wait()
+
+void uring_free(uring *u)
+{
+	// Every request must have been waited for.
+#ifdef HAVE_IO_URING
+	if (u->fd != -1) {
+		munmap(u->sqes, u->sqeslen);
+		if (u->cqmap != u->sqmap) munmap(u->cqmap, u->cqmaplen);
+		munmap(u->sqmap, u->sqmaplen);
+		close(u->fd);	// also drops the registered buffers.
+	}
+#endif
+	free(u->pending);
+	free(u->donetag);
+	free(u->doneres);
+	memset(u, 0, sizeof(uring));
+	u->fd = -1;
+} // uring_free()
+
+const char *uring_implname(const uring *u)
+{
+	if (u->fd == -1) return "blocking";
+	return (u->fixed) ? "io_uring, registered buffers" : "io_uring";
+} // uring_implname()
+
+void queue(uring *u, const urreq *rq)
+{
+	/* The caller keeps no more than depth requests outstanding, so
+	 * there is always room. */
+#ifdef HAVE_IO_URING
+	if (u->fd != -1) {
+		unsigned tail = *u->sqtail;
+		unsigned idx = tail & *u->sqmask;
+		struct io_uring_sqe *sqe = (struct io_uring_sqe *)u->sqes + idx;
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		if (u->fixed && rq->buf >= 0) {
+			sqe->opcode = (rq->write) ? IORING_OP_WRITE_FIXED
+										: IORING_OP_READ_FIXED;
+			sqe->buf_index = rq->buf;
+		} else {
+			sqe->opcode = (rq->write) ? IORING_OP_WRITE : IORING_OP_READ;
+		}
+		sqe->fd = rq->fd;
+		sqe->addr = (uintptr_t)rq->addr;
+		sqe->len = rq->len;
+		sqe->off = rq->off;
+		sqe->user_data = rq->tag;
+		u->sqarray[idx] = idx;
+		__atomic_store_n(u->sqtail, tail + 1, __ATOMIC_RELEASE);
+		u->queued++;
+		return;
+	}
+#endif
+	u->pending[u->npending++] = *rq;
+} // queue()
+
+void blockingio(uring *u)
+{
+	/* The fallback. Each queued request is carried out in full, short
+	 * transfers are only left at end of file. */
+	unsigned i;
+	for (i = 0; i < u->npending; i++) {
+		const urreq *rq = &u->pending[i];
+		size_t done = 0;
+		ssize_t n = 0;
+		while (done < rq->len) {
+			if (rq->write) {
+				n = pwrite(rq->fd, rq->addr + done, rq->len - done,
+							rq->off + done);
+			} else {
+				n = pread(rq->fd, rq->addr + done, rq->len - done,
+							rq->off + done);
+			}
+			if (n == -1 && errno == EINTR) continue;
+			if (n <= 0) break;
+			done += n;
+		}
+		unsigned slot = (u->donehead + u->ndone++) % u->depth;
+		u->donetag[slot] = rq->tag;
+		u->doneres[slot] = (n == -1 && !done) ? -errno : (ssize_t)done;
+	}
+	u->npending = 0;
+} // blockingio()
+
+#ifdef HAVE_IO_URING
+int setup(uring *u, unsigned depth)
+{
+	// Creates the ring and maps its queues. Returns -1 if unavailable.
+	struct io_uring_params p;
+	char *sq, *cq;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	fd = syscall(__NR_io_uring_setup, depth, &p);
+	if (fd == -1) return -1;
+	u->sqmaplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cqmaplen = p.cq_off.cqes
+				+ p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cqmaplen > u->sqmaplen) u->sqmaplen = u->cqmaplen;
+		u->cqmaplen = u->sqmaplen;
+	}
+	sq = mmap(NULL, u->sqmaplen, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED) goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, u->cqmaplen, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED) {
+			munmap(sq, u->sqmaplen);
+			goto fail;
+		}
+	}
+	u->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqeslen, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		if (cq != sq) munmap(cq, u->cqmaplen);
+		munmap(sq, u->sqmaplen);
+		goto fail;
+	}
+	u->fd = fd;
+	u->sqmap = sq;
+	u->cqmap = cq;
+	u->sqhead = (unsigned *)(sq + p.sq_off.head);
+	u->sqtail = (unsigned *)(sq + p.sq_off.tail);
+	u->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sqarray = (unsigned *)(sq + p.sq_off.array);
+	u->cqhead = (unsigned *)(cq + p.cq_off.head);
+	u->cqtail = (unsigned *)(cq + p.cq_off.tail);
+	u->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = cq + p.cq_off.cqes;
+	return 0;
+fail:
+	close(fd);
+	return -1;
+} // setup()
+
+int enter(uring *u, unsigned submit, unsigned wait)
+{
+	// Returns the number of requests submitted.
+	int n;
+	do {
+		n = syscall(__NR_io_uring_enter, u->fd, submit, wait,
+					(wait) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (n == -1 && (errno == EINTR || errno == EAGAIN));
+	if (n == -1) {
+		perror("io_uring_enter");
+		exit(EXIT_FAILURE);
+	}
+	return n;
+} // enter()
+#endif
@@ -0,0 +1,75 @@
+/*
+ * uring.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _URING_H
+# define _URING_H
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Asynchronous positional reads and writes. Requests are queued with
+ * uring_read() and uring_write(), handed to the kernel together by
+ * uring_submit(), and their results collected one at a time with
+ * uring_wait(). Where io_uring is available the buffers given to
+ * uring_init() are registered with the kernel so the transfers need
+ * no page pinning per request. Where it is not, the same calls do
+ * blocking pread() and pwrite() at submit time.
+*/
+typedef struct urreq {
+	int fd;
+	int write;
+	int buf;
+	char *addr;
+	size_t len;
+	off_t off;
+	uint64_t tag;
+} urreq;
+
+typedef struct uring {
+	int fd;		// the io_uring, -1 for the blocking fallback.
+	unsigned depth;
+	int fixed;	// the buffers are registered.
+	char **bufs;
+	unsigned nbufs;
+	void *sqmap, *cqmap, *sqes;
+	size_t sqmaplen, cqmaplen, sqeslen;
+	unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+	unsigned *cqhead, *cqtail, *cqmask;
+	void *cqes;
+	unsigned queued;	// prepared, not yet submitted.
+	urreq *pending;		// the fallback's queued requests.
+	unsigned npending;
+	uint64_t *donetag;	// and its completions, a circular queue.
+	ssize_t *doneres;
+	unsigned ndone, donehead;
+} uring;
+
+void uring_init(uring *u, unsigned depth, char **bufs, unsigned nbufs,
+				size_t bufsize);
+void uring_read(uring *u, int fd, int buf, char *addr, size_t len,
+				off_t off, uint64_t tag);
+void uring_write(uring *u, int fd, int buf, const char *addr,
+				size_t len, off_t off, uint64_t tag);
+void uring_submit(uring *u);
+ssize_t uring_wait(uring *u, uint64_t *tag);
+void uring_free(uring *u);
+const char *uring_implname(const uring *u);
+
+#endif
@@ -0,0 +1,116 @@
+/*      xorbuf.c
+ *
+ *	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "xorbuf.h"
+#include "cpufeatures.h"
+#ifdef CRYPT_X86
+#include <immintrin.h>
+#endif
+
+static size_t xor_words(unsigned char *out, const unsigned char *in,
+			const unsigned char *ks, size_t len);
+#ifdef CRYPT_X86
+static size_t xor_avx2(unsigned char *out, const unsigned char *in,
+			const unsigned char *ks, size_t len);
+static size_t xor_avx512(unsigned char *out, const unsigned char *in,
+			const unsigned char *ks, size_t len);
+#endif
+
+void xorbuf(unsigned char *out, const unsigned char *in,
+			const unsigned char *ks, size_t len)
+{
+	/* Each kernel does what it can in whole vectors and says how much
+	 * that was, the bytes left over are done here. */
+	size_t done;
+#ifdef CRYPT_X86
+	unsigned f = cpufeatures();
+	if (f & CPU_AVX512) {
+		done = xor_avx512(out, in, ks, len);
+	} else if (f & CPU_AVX2) {
+		done = xor_avx2(out, in, ks, len);
+	} else {
+		done = xor_words(out, in, ks, len);
+	}
+#else
+	done = xor_words(out, in, ks, len);
+#endif
+	for (; done < len; done++) out[done] = in[done] ^ ks[done];
+} // xorbuf()
+
+size_t xor_words(unsigned char *out, const unsigned char *in,
+			const unsigned char *ks, size_t len)
+{
+	size_t i;
+	for (i = 0; i + 8 <= len; i += 8) {
+		uint64_t a, b;
+		memcpy(&a, in + i, 8);
+		memcpy(&b, ks + i, 8);
+		a ^= b;
+		memcpy(out + i, &a, 8);
+	}
+	return i;
+} // xor_words()
+
+#ifdef CRYPT_X86
+__attribute__((target("avx2")))
+size_t xor_avx2(unsigned char *out, const unsigned char *in,
+			const unsigned char *ks, size_t len)
+{
+	size_t i;
+	for (i = 0; i + 128 <= len; i += 128) {
+		int j;
+		for (j = 0; j < 128; j += 32) {
+			__m256i a = _mm256_loadu_si256((const __m256i *)(in + i + j));
+			__m256i b = _mm256_loadu_si256((const __m256i *)(ks + i + j));
+			_mm256_storeu_si256((__m256i *)(out + i + j),
+								_mm256_xor_si256(a, b));
+		}
+	}
+	for (; i + 32 <= len; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(ks + i));
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_xor_si256(a, b));
+	}
+	return i;
+} // xor_avx2()
+
+__attribute__((target("avx512f")))
+size_t xor_avx512(unsigned char *out, const unsigned char *in,
+			const unsigned char *ks, size_t len)
+{
+	size_t i;
+	for (i = 0; i + 256 <= len; i += 256) {
+		int j;
+		for (j = 0; j < 256; j += 64) {
+			__m512i a = _mm512_loadu_si512(in + i + j);
+			__m512i b = _mm512_loadu_si512(ks + i + j);
+			_mm512_storeu_si512(out + i + j, _mm512_xor_si512(a, b));
+		}
+	}
+	for (; i + 64 <= len; i += 64) {
+		__m512i a = _mm512_loadu_si512(in + i);
+		__m512i b = _mm512_loadu_si512(ks + i);
+		_mm512_storeu_si512(out + i, _mm512_xor_si512(a, b));
+	}
+	return i;
+} // xor_avx512()
+#endif
@@ -0,0 +1,31 @@
+/*
+ * xorbuf.h
+ * 	Copyright 2011 Bob Parker <rlp1938@gmail.com>
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _XORBUF_H
+# define _XORBUF_H
+#include <stddef.h>
+
+/* out = in ^ ks for len bytes, 64 bytes at a time with AVX-512, 32
+ * with AVX2, otherwise a word at a time. out may be in.
+*/
+void xorbuf(unsigned char *out, const unsigned char *in,
+			const unsigned char *ks, size_t len);
+
+#endif